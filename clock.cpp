@@ -0,0 +1,324 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file clock.cpp
+//! \brief Implementation of the real and virtual clocks.
+//!
+
+#include "pch.h"
+#include <vector>
+#include "clock.h"
+
+namespace sr
+{
+
+//!
+//! \brief Returns the current time in whole seconds.
+//!
+//! \note The epoch is arbitrary; only differences are meaningful.
+//!
+//========================================================================
+time_t CClock::GetSeconds ()
+{
+
+	return static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(Now().time_since_epoch()).count());
+}
+
+//!
+//! \brief Block the calling thread for a while.
+//!
+//! \param[in] ms The time to sleep (ms).
+//!
+//========================================================================
+void CClock::SleepFor (uint32_t ms)
+{
+	std::mutex m;
+	std::condition_variable cv;
+	std::unique_lock<std::mutex> lk(m);
+	CLOCKTIME deadline = Now() + std::chrono::milliseconds(ms);
+
+	while (WaitUntil(cv, lk, deadline) != std::cv_status::timeout)
+	{
+	}
+}
+
+//!
+//! \brief Returns the clock used unless another one is injected.
+//!
+//========================================================================
+CClock* CClock::GetSystemClock ()
+{
+	static CSystemClock clock;
+
+	return &clock;
+}
+
+//========================================================================
+std::cv_status CSystemClock::WaitUntil (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline)
+{
+
+	return cv.wait_until(lk, deadline);
+}
+
+//!
+//! \brief Constructor
+//!
+//! Virtual time starts an hour after the epoch, so that code which uses
+//! a zero time as "never" still works.
+//!
+//========================================================================
+CVirtualClock::CVirtualClock () :
+	m_now((CLOCKTIME() + std::chrono::hours(1)).time_since_epoch().count()),
+	m_settle_timeout(1000u)
+{
+
+}
+
+//========================================================================
+CLOCKTIME CVirtualClock::Now ()
+{
+
+	return CLOCKTIME(CLOCKTIME::duration(m_now.load()));
+}
+
+//========================================================================
+std::cv_status CVirtualClock::WaitUntil (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline)
+{
+
+	return Block(cv, lk, deadline);
+}
+
+//========================================================================
+void CVirtualClock::Wait (std::condition_variable& cv, std::unique_lock<std::mutex>& lk)
+{
+
+	Block(cv, lk, CLOCKTIME::max());
+}
+
+//!
+//! \brief Wake the threads waiting on a condition variable.
+//!
+//! The waiters are marked as signalled until they run again, so that
+//! Advance() doesn't move time on before they have reacted.
+//!
+//========================================================================
+void CVirtualClock::Notify (std::condition_variable& cv)
+{
+
+	m_lock.lock();
+	for (std::list<WAITER>::iterator i = m_waiters.begin(); i != m_waiters.end(); ++i)
+	{
+		if (i->cv == &cv)
+		{
+			i->signalled = true;
+		}
+	}
+	m_lock.unlock();
+
+	cv.notify_all();
+}
+
+//!
+//! \brief Move time forward.
+//!
+//! Time is stepped to each waiter's deadline in turn, waking the waiter
+//! and letting every thread settle before the next step.
+//!
+//! \param[in] interval How far to move.
+//!
+//========================================================================
+void CVirtualClock::Advance (std::chrono::milliseconds interval)
+{
+	CLOCKTIME end = Now() + interval;
+	std::vector<WAITER*> due;
+
+	for (;;)
+	{
+		WaitForIdle(m_settle_timeout);
+
+		// STEP TO THE EARLIEST DEADLINE (OR THE END) AND COLLECT THE WAITERS
+		// WHICH ARE THEN DUE. THEY CAN'T LEAVE UNTIL busy IS CLEARED.
+		due.clear();
+		m_lock.lock();
+		CLOCKTIME next = end;
+		for (std::list<WAITER>::iterator i = m_waiters.begin(); i != m_waiters.end(); ++i)
+		{
+			if (!i->signalled && (i->deadline < next))
+			{
+				next = i->deadline;
+			}
+		}
+		if (next > Now())
+		{
+			m_now = next.time_since_epoch().count();
+		}
+		for (std::list<WAITER>::iterator i = m_waiters.begin(); i != m_waiters.end(); ++i)
+		{
+			if (!i->signalled && (i->deadline <= next))
+			{
+				i->signalled = true;
+				++i->busy;
+				due.push_back(&*i);
+			}
+		}
+		m_lock.unlock();
+
+		if (due.empty() && (next >= end))
+		{
+			break;
+		}
+
+		// TAKING THE WAITER'S MUTEX ENSURES IT IS INSIDE wait() BEFORE IT
+		// IS NOTIFIED
+		for (size_t i = 0u; i < due.size(); ++i)
+		{
+			std::lock_guard<std::mutex> lk(*due[i]->mutex);
+			due[i]->cv->notify_all();
+		}
+
+		m_lock.lock();
+		for (size_t i = 0u; i < due.size(); ++i)
+		{
+			--due[i]->busy;
+		}
+		m_changed.notify_all();
+		m_lock.unlock();
+	}
+
+	WaitForIdle(m_settle_timeout);
+}
+
+//!
+//! \brief Wait (in real time) for every thread using the clock to block.
+//!
+//! \param[in] timeout The longest time to wait (ms).
+//!
+//! \retval bool Returns true if the threads are idle, or false if the
+//! timeout expired first (e.g. because a thread is blocked on something
+//! other than the clock).
+//!
+//========================================================================
+bool CVirtualClock::WaitForIdle (uint32_t timeout)
+{
+	std::unique_lock<std::mutex> g(m_lock);
+
+	return m_changed.wait_for(g, std::chrono::milliseconds(timeout), [this] { return IsIdle(); });
+}
+
+//!
+//! \brief Find the earliest deadline any thread is waiting for.
+//!
+//! \param[out] deadline The deadline.
+//!
+//! \retval bool Returns false if no thread is waiting for a deadline.
+//!
+//========================================================================
+bool CVirtualClock::GetNextDeadline (CLOCKTIME& deadline)
+{
+	std::lock_guard<std::mutex> g(m_lock);
+	bool found = false;
+
+	for (std::list<WAITER>::iterator i = m_waiters.begin(); i != m_waiters.end(); ++i)
+	{
+		if (!i->signalled && (i->deadline != CLOCKTIME::max()) && (!found || (i->deadline < deadline)))
+		{
+			deadline = i->deadline;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+//!
+//! \internal
+//! \brief Wait on a condition variable until notified or a virtual
+//! deadline passes.
+//!
+//========================================================================
+std::cv_status CVirtualClock::Block (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline)
+{
+	std::list<WAITER>::iterator i;
+
+	m_lock.lock();
+	if (Now() >= deadline)
+	{
+		m_lock.unlock();
+		return std::cv_status::timeout;
+	}
+
+	WAITER w;
+	w.thread = std::this_thread::get_id();
+	w.cv = &cv;
+	w.mutex = lk.mutex();
+	w.deadline = deadline;
+	w.signalled = false;
+	w.busy = 0u;
+	m_known.insert(w.thread);
+	i = m_waiters.insert(m_waiters.end(), w);
+	m_changed.notify_all();
+	m_lock.unlock();
+
+	cv.wait(lk);
+
+	// ADVANCE() MAY STILL BE USING OUR ENTRY; IT NEEDS lk TO FINISH
+	std::unique_lock<std::mutex> g(m_lock);
+	while (i->busy > 0u)
+	{
+		g.unlock();
+		lk.unlock();
+		g.lock();
+		m_changed.wait(g, [i] { return (i->busy == 0u); });
+		g.unlock();
+		lk.lock();
+		g.lock();
+	}
+	m_waiters.erase(i);
+	m_changed.notify_all();
+
+	return (Now() >= deadline) ? std::cv_status::timeout : std::cv_status::no_timeout;
+}
+
+//!
+//! \internal
+//! \brief True if every known thread is waiting and none has been woken.
+//!
+//! \note Must be called with m_lock held.
+//!
+//========================================================================
+bool CVirtualClock::IsIdle ()
+{
+	size_t waiting = 0u;
+
+	for (std::list<WAITER>::iterator i = m_waiters.begin(); i != m_waiters.end(); ++i)
+	{
+		if (!i->signalled)
+		{
+			++waiting;
+		}
+	}
+
+	return (waiting >= m_known.size());
+}
+
+}
@@ -0,0 +1,136 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file clock.h
+//! \brief Declarations for the clock abstraction.
+//!
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace sr
+{
+
+typedef std::chrono::steady_clock::time_point CLOCKTIME;	//!< A point in (real or virtual) time
+
+//!
+//! \brief A source of time.
+//!
+//! Everything that measures an interval or sleeps until a deadline does
+//! so through a CClock, so that the wall clock can be replaced by a
+//! virtual one under test. Threads wait for a deadline with WaitUntil()
+//! instead of calling wait_until() on the condition variable directly,
+//! and wake each other with Notify() instead of notify_all(), so that a
+//! virtual clock can tell when every thread has finished reacting to the
+//! last change.
+//!
+class CClock
+{
+public:
+	virtual ~CClock () {}
+
+	virtual CLOCKTIME Now () = 0;
+	virtual std::cv_status WaitUntil (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline) = 0;
+	virtual void Wait (std::condition_variable& cv, std::unique_lock<std::mutex>& lk) = 0;
+	virtual void Notify (std::condition_variable& cv) = 0;
+
+	time_t GetSeconds ();
+	void SleepFor (uint32_t ms);
+
+	static CClock* GetSystemClock ();
+};
+
+//!
+//! \brief The real (monotonic) clock.
+//!
+class CSystemClock : public CClock
+{
+public:
+	CLOCKTIME Now () { return std::chrono::steady_clock::now(); }
+	std::cv_status WaitUntil (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline);
+	void Wait (std::condition_variable& cv, std::unique_lock<std::mutex>& lk) { cv.wait(lk); }
+	void Notify (std::condition_variable& cv) { cv.notify_all(); }
+};
+
+//!
+//! \brief A clock which only moves when told to.
+//!
+//! Time stands still until Advance() is called, which steps it from one
+//! waiter's deadline to the next. Before each step Advance() waits (in
+//! real time) until every thread that has ever waited on this clock is
+//! waiting on it again and has no notification outstanding, so each
+//! deadline is reached only after the work due at the previous one is
+//! done. Hours of timeouts and retries therefore pass as fast as the
+//! threads can do the work in between. A thread the clock hasn't seen 
+//! yet can't hold it back, so while threads are still starting it is 
+//! safer to step only as far as GetNextDeadline().
+//!
+class CVirtualClock : public CClock
+{
+public:
+	CVirtualClock ();
+
+	CLOCKTIME Now ();
+	std::cv_status WaitUntil (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline);
+	void Wait (std::condition_variable& cv, std::unique_lock<std::mutex>& lk);
+	void Notify (std::condition_variable& cv);
+
+	void Advance (std::chrono::milliseconds interval);
+	bool WaitForIdle (uint32_t timeout);
+	bool GetNextDeadline (CLOCKTIME& deadline);
+	void SetSettleTimeout (uint32_t timeout) { m_settle_timeout = timeout; }
+
+private:
+	//! A thread waiting on the clock
+	struct WAITER
+	{
+		std::thread::id thread;			//!< The waiting thread
+		std::condition_variable* cv;	//!< What it is waiting on
+		std::mutex* mutex;				//!< The mutex that goes with cv
+		CLOCKTIME deadline;				//!< When it wants waking (max() for never)
+		bool signalled;					//!< Notified, but not yet running again
+		uint32_t busy;					//!< Advance() is about to notify it
+	};
+
+	std::mutex m_lock;					//!< Guards everything below
+	std::condition_variable m_changed;	//!< Signalled when a waiter comes, goes or is notified
+	std::atomic<CLOCKTIME::rep> m_now;	//!< Current virtual time (ticks since the epoch)
+	std::list<WAITER> m_waiters;
+	std::set<std::thread::id> m_known;	//!< Every thread that has waited on this clock
+	uint32_t m_settle_timeout;			//!< Longest (real) wait for the threads to settle (ms)
+
+	std::cv_status Block (std::condition_variable& cv, std::unique_lock<std::mutex>& lk, CLOCKTIME deadline);
+	bool IsIdle ();
+};
+
+}
+
+#endif
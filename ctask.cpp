@@ -26,14 +26,24 @@
 //! \brief Declarations for task abstraction class.
 //!
 
+#include "pch.h"
 #include <memory>
 #include <assert.h>
 #include <signal.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #include "ctask.h"
 
 namespace sr
 {
 
+//! Scheduling attributes of the thread which started the first task
+static THREADATTR s_base_attr;
+static std::once_flag s_base_once;
+
 //!
 //! \brief Destructor.
 //!
@@ -67,7 +77,8 @@ bool CTask::Start ()
 	assert(!m_thread.joinable());
 	assert(m_state == STOPPED);
 
-	m_state = STARTING;
+	std::call_once(s_base_once, [] { GetCurrentThreadAttributes(s_base_attr); });
+	SetState(STARTING);
 
 	try
 	{
@@ -75,12 +86,52 @@ bool CTask::Start ()
 	}
 	catch (...)
 	{
+		SetState(STOPPED);
 		return false;
 	}
 
     return true;
 }
 
+//!
+//! \brief Wait for a task to finish its initialization phase.
+//!
+//! \param[in] timeout The longest time to wait (ms), or TASK_WAIT_FOREVER.
+//!
+//! \retval bool Returns true if the task is running, or false if its 
+//! initialization failed, it has already terminated, or the timeout 
+//! expired.
+//!
+//========================================================================
+bool CTask::WaitUntilRunning (uint32_t timeout)
+{
+	std::unique_lock<std::mutex> lk(m_state_lock);
+
+	if (timeout == TASK_WAIT_FOREVER)
+	{
+		m_state_cv.wait(lk, [this] { return (m_state != STARTING); });
+	}
+	else
+	{
+		m_state_cv.wait_for(lk, std::chrono::milliseconds(timeout), [this] { return (m_state != STARTING); });
+	}
+
+	return (m_state == RUNNING);
+}
+
+//!
+//! \internal
+//! \brief Publish a change of state to any waiting threads.
+//!
+//========================================================================
+void CTask::SetState (STATE state)
+{
+	std::lock_guard<std::mutex> lk(m_state_lock);
+
+	m_state = state;
+	m_state_cv.notify_all();
+}
+
 //!
 //! \brief Signal a task to terminate.
 //!
@@ -129,17 +180,259 @@ void CTask::Run ()
 	if (err == 0)
 #endif
 	{
+		if (!m_thread_name.empty())
+		{
+			SetCurrentThreadName(m_thread_name);
+		}
+
+		// START FROM THE BASE ATTRIBUTES RATHER THAN THOSE INHERITED FROM
+		// THE THREAD WHICH STARTED THIS TASK
+		THREADATTR attr = s_base_attr;
+		if (!m_thread_attr.cpus.empty())
+		{
+			attr.cpus = m_thread_attr.cpus;
+		}
+		if (m_thread_attr.fifo > 0)
+		{
+			attr.fifo = m_thread_attr.fifo;
+		}
+		if (m_thread_attr.set_nice)
+		{
+			attr.nice = m_thread_attr.nice;
+			attr.set_nice = true;
+		}
+		if (!SetCurrentThreadAttributes(attr))
+		{
+			LogWrite(LEVEL_WARNING, "Could not apply all scheduling attributes to thread '%s'.", m_thread_name.c_str());
+		}
+
 		if (OnStart())
 		{
-			m_state = RUNNING;
+			SetState(RUNNING);
 			OnRun();
 		}
 	}
 
 	OnExit();
-	m_state = STOPPED;
+	SetState(STOPPED);
+}
+
+//!
+//! \brief Parse a thread attribute specification.
+//!
+//! \param[in] spec A comma-separated list of settings: "cpu=<n>" or 
+//! "cpu=<first>-<last>" (repeatable) restricts the thread to those CPUs,
+//! "fifo=<1-99>" selects real-time scheduling at that priority and 
+//! "nice=<n>" sets the nice value.
+//!
+//! \retval bool Returns true if the specification was valid.
+//!
+//========================================================================
+bool THREADATTR::Parse (const std::string& spec)
+{
+	vector<string> items = StrTokenize(spec, ",");
+
+	for (size_t i = 0u; i < items.size(); ++i)
+	{
+		vector<string> kv = StrTokenize(items[i], "=");
+		if (kv.size() != 2u)
+		{
+			return false;
+		}
+
+		const string& key = kv[0];
+		const char* val = kv[1].c_str();
+		char* end = 0;
+
+		if (key == "cpu")
+		{
+			unsigned first = strtoul(val, &end, 10);
+			unsigned last = first;
+			if ((end != val) && (*end == '-'))
+			{
+				val = end + 1;
+				last = strtoul(val, &end, 10);
+			}
+			if ((end == val) || (*end != '\0') || (last < first) || (last >= 1024u))
+			{
+				return false;
+			}
+			for (unsigned cpu = first; cpu <= last; ++cpu)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		else if (key == "fifo")
+		{
+			fifo = strtol(val, &end, 10);
+			if ((end == val) || (*end != '\0') || (fifo < 1) || (fifo > 99))
+			{
+				return false;
+			}
+		}
+		else if (key == "nice")
+		{
+			nice = strtol(val, &end, 10);
+			if ((end == val) || (*end != '\0') || (nice < -20) || (nice > 19))
+			{
+				return false;
+			}
+			set_nice = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
+//!
+//! \brief Name the calling thread.
+//!
+//! \param[in] name The new name. Linux truncates it to 15 characters.
+//!
+//! \retval bool Returns true if the thread was named.
+//!
+//========================================================================
+bool SetCurrentThreadName (const std::string& name)
+{
+#ifdef __linux__
+	return (pthread_setname_np(pthread_self(), name.substr(0u, 15u).c_str()) == 0);
+#else
+	(void)name;
+	return false;
+#endif
+}
+
+//!
+//! \brief Read the scheduling attributes of the calling thread.
+//!
+//! \param[out] attr The thread's CPU affinity, SCHED_FIFO priority (0 if
+//! it is not a real-time thread) and, where it is per-thread, nice value.
+//!
+//========================================================================
+void GetCurrentThreadAttributes (THREADATTR& attr)
+{
+
+	attr = THREADATTR();
+
+#ifndef WIN32
+	int policy;
+	sched_param param;
+	if ((pthread_getschedparam(pthread_self(), &policy, &param) == 0) && (policy == SCHED_FIFO))
+	{
+		attr.fifo = param.sched_priority;
+	}
+
+#ifdef __linux__
+	cpu_set_t set;
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+	{
+		for (unsigned cpu = 0u; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &set))
+			{
+				attr.cpus.push_back(cpu);
+			}
+		}
+	}
+
+	errno = 0;
+	pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+	int nice = getpriority(PRIO_PROCESS, tid);
+	if (errno == 0)
+	{
+		attr.nice = nice;
+		attr.set_nice = true;
+	}
+#endif
+#endif
 }
 
+//!
+//! \brief Apply scheduling attributes to the calling thread.
+//!
+//! Only the attributes which differ from the thread's current ones are 
+//! changed, and each independently, so that (for example) CPU pinning 
+//! still takes effect when the process lacks the privilege needed for 
+//! real-time scheduling.
+//!
+//! \param[in] attr The attributes to apply. An empty CPU list or an 
+//! unset nice value leaves those alone; a fifo priority of 0 selects 
+//! normal scheduling.
+//!
+//! \retval bool Returns true if every requested attribute was applied.
+//!
+//========================================================================
+bool SetCurrentThreadAttributes (const THREADATTR& attr)
+{
+	THREADATTR curr;
+	bool result = true;
+
+	GetCurrentThreadAttributes(curr);
+
+#if defined(WIN32)
+	if (!attr.cpus.empty())
+	{
+		DWORD_PTR mask = 0u;
+		for (size_t i = 0u; i < attr.cpus.size(); ++i)
+		{
+			if (attr.cpus[i] < (sizeof(mask) * 8u))
+			{
+				mask |= (static_cast<DWORD_PTR>(1u) << attr.cpus[i]);
+			}
+		}
+		result = (SetThreadAffinityMask(GetCurrentThread(), mask) != 0) && result;
+	}
+	if (attr.fifo > 0)
+	{
+		result = (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0) && result;
+	}
+	else if (attr.set_nice && (attr.nice != 0))
+	{
+		int priority = (attr.nice < 0) ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_BELOW_NORMAL;
+		result = (SetThreadPriority(GetCurrentThread(), priority) != 0) && result;
+	}
+#else
+	if (!attr.cpus.empty() && (attr.cpus != curr.cpus))
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t i = 0u; i < attr.cpus.size(); ++i)
+		{
+			if (attr.cpus[i] < CPU_SETSIZE)
+			{
+				CPU_SET(attr.cpus[i], &set);
+			}
+		}
+		result = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) && result;
+#else
+		result = false;
+#endif
+	}
+	if (attr.fifo != curr.fifo)
+	{
+		sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = attr.fifo;
+		result = (pthread_setschedparam(pthread_self(), (attr.fifo > 0) ? SCHED_FIFO : SCHED_OTHER, &param) == 0) && result;
+	}
+	if (attr.set_nice && (!curr.set_nice || (attr.nice != curr.nice)))
+	{
+#ifdef __linux__
+		// ON LINUX THE NICE VALUE BELONGS TO THE THREAD, NOT THE PROCESS
+		pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+		result = (setpriority(PRIO_PROCESS, tid, attr.nice) == 0) && result;
+#else
+		result = false;
+#endif
+	}
+#endif
+
+	return result;
+}
 
+}
@@ -30,12 +30,38 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 namespace sr
 {
 
+const uint32_t TASK_WAIT_FOREVER = 0xffffffffu;	//!< No timeout for CTask::WaitUntilRunning()
+
+//!
+//! \brief Scheduling attributes for a thread.
+//!
+//! The defaults leave the thread as it was created. Parse() accepts a 
+//! comma-separated list such as "cpu=2,cpu=4-5,fifo=20" or "nice=5".
+//!
+struct THREADATTR
+{
+	std::vector<unsigned> cpus;	//!< CPUs the thread may run on (empty = any)
+	int fifo;					//!< SCHED_FIFO priority, or 0 for normal scheduling
+	int nice;					//!< Nice value, used only if set_nice is true
+	bool set_nice;				//!< True to change the nice value
+
+	THREADATTR() : fifo(0), nice(0), set_nice(false) {}
+	bool Parse (const std::string& spec);
+};
+
+bool SetCurrentThreadName (const std::string& name);
+void GetCurrentThreadAttributes (THREADATTR& attr);
+bool SetCurrentThreadAttributes (const THREADATTR& attr);
+
 //!
 //! \brief A simple task abstraction.
 //!
@@ -53,7 +79,13 @@ namespace sr
 //!
 //! CTask also provides methods to start a task running and to request task 
 //! termination. The task has the option to reject the termination request, if
-//! necessary.
+//! necessary. Other threads can wait for the task to leave its initialization
+//! phase with WaitUntilRunning().
+//!
+//! The task's thread can be given a name and scheduling attributes, which 
+//! it applies to itself before OnStart() is called. Set these before 
+//! calling Start(). Attributes which aren't set are those of the thread 
+//! that started the first task, not of whichever thread started this one.
 //!
 class CTask
 {
@@ -84,8 +116,26 @@ public:
 	//!
 	bool IsShutdown() { return m_shutdown; }
 
+	//!
+	//! \brief Set the name of the task's thread (e.g. as shown by top -H).
+	//!
+	//! \param[in] name The name, of which some systems keep only the first 
+	//! 15 characters.
+	//!
+	void SetThreadName (const std::string& name) { m_thread_name = name; }
+	const std::string& GetThreadName () const { return m_thread_name; }
+
+	//!
+	//! \brief Set the scheduling attributes of the task's thread.
+	//!
+	//! \param[in] attr The CPU affinity and priority to apply.
+	//!
+	void SetThreadAttributes (const THREADATTR& attr) { m_thread_attr = attr; }
+	const THREADATTR& GetThreadAttributes () const { return m_thread_attr; }
+
 	bool Start ();
 	bool Stop ();
+	bool WaitUntilRunning (uint32_t timeout = TASK_WAIT_FOREVER);
 			
 protected:
 	//!
@@ -134,19 +184,33 @@ protected:
 	//!
 	virtual void OnExit() {};
 
+	//!
+	//! \brief Respond to the start of the shutdown process.
+	//!
+	//! This function is called from whichever thread initiated the 
+	//! shutdown, after IsShutdown() has become true. A task whose thread
+	//! blocks waiting for I/O should override this to wake it up.
+	//!
+	virtual void OnShutdown() {};
+
 	//!
 	//! \internal
 	//!
 	//! \brief Called from elsewhere in the task to begin the shutdown process.
 	//!
-	void Shutdown() { m_shutdown = true; }
+	void Shutdown() { m_shutdown = true; OnShutdown(); }
 	
 private:	
-	STATE m_state;		//!< Current state of the task
+	std::atomic<STATE> m_state;		//!< Current state of the task
 	std::atomic<bool> m_shutdown;	//!< Flag to request task termination
 	std::thread m_thread;	//!< The thread which executes this task
+	std::string m_thread_name;	//!< Name given to the thread, if not empty
+	THREADATTR m_thread_attr;	//!< Scheduling attributes of the thread
+	std::mutex m_state_lock;	//!< Pairs with m_state_cv
+	std::condition_variable m_state_cv;	//!< Signalled on every state change
 	
 	void Run ();
+	void SetState (STATE state);
 };
 
 }
@@ -21,21 +21,22 @@
  */
 
 #include "pch.h"
-#include <time.h>
+#include <algorithm>
 #include "ctimer.h"
 
 namespace sr
 {
 
-// MINIMUM SLEEP TIME (MILLISECONDS)
-const uint32_t MIN_SLEEPTIME = 100;
+// SHORTEST PERMITTED TIMER INTERVAL (MILLISECONDS)
+const uint32_t MIN_INTERVAL = 1;
 
 
 //========================================================================
 TIMERREC::TIMERREC () :
   handle(0),
-  count(0),
-  interval(MIN_SLEEPTIME),
+  interval(MIN_INTERVAL),
+  periodic(true),
+  generation(0),
   instance(0),
   callback(NULL)
 {
@@ -47,16 +48,20 @@ TIMERREC::TIMERREC (const TIMERREC& t)
 {
 
   handle = t.handle;
-  count = t.count;
   interval = t.interval;
+  periodic = t.periodic;
+  generation = t.generation;
+  deadline = t.deadline;
   instance = t.instance;
   callback = t.callback;
 }
 
 //========================================================================
 CTimer::CTimer () :
-  m_sleep_time(MIN_SLEEPTIME),
-  m_sequence(0)
+  m_clock(CClock::GetSystemClock()),
+  m_sequence(0),
+  m_num_executors(0),
+  m_executors_stop(false)
 {
 
 }
@@ -71,89 +76,378 @@ CTimer::~CTimer ()
 	m_timers.clear();
 }
 
+//!
+//! \brief Start the executor pool, if one was requested
+//!
+//! \note The executors are started from the manager's thread so that 
+//! they inherit its signal mask. If this fails, OnExit() stops any that
+//! did start.
+//!
 //========================================================================
-//
-//
-//
+bool CTimer::OnStart ()
+{
+
+	m_executors_stop = false;
+	try
+	{
+		for (uint32_t n = 0u; n < m_num_executors; ++n)
+		{
+			m_executors.push_back(std::thread(&CTimer::ExecutorProc, this, n));
+		}
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+//!
+//! \brief Timer manager main loop.
+//!
+//! Sleeps until the earliest deadline, then collects every timer which
+//! has expired and runs (or queues) their callbacks. A periodic timer is
+//! rescheduled relative to its previous deadline, so that it does not 
+//! drift; if it has fallen more than a whole interval behind, or its 
+//! previous callback is still running, the missed calls are skipped.
+//!
 //========================================================================
 void CTimer::OnRun ()
 {
+	std::unique_lock<std::mutex> lk(m_critsect);
+	std::vector<TIMERJOB> expired;
 
     while (!IsShutdown())
     {
-        list<TIMERREC>::iterator i;
-
-        // WALK THE LIST OF TIMERS - UPDATE THEIR COUNTS, AND CALL THE TIMER
-        // HANDLER IF THE TIMER EXPIRES
-        m_critsect.lock();
-        i = m_timers.begin();
-        while (i != m_timers.end())
-        {
-            if (--((*i).count) == 0)
-            {
-                (*i).callback((*i).instance);
-                (*i).count = ((*i).interval / m_sleep_time);
-            }
-            i++;
-        }
-        m_critsect.unlock();
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(m_sleep_time));
+		TIMERCLOCK::time_point now = m_clock->Now();
+
+		expired.clear();
+		while (!m_due.empty())
+		{
+			// DISCARD DEADLINES FOR TIMERS RESTARTED OR DESTROYED SINCE
+			TIMERDUE d = m_due.top();
+			std::unordered_map<HTIMER, TIMERREC>::iterator i = m_timers.find(d.handle);
+			if ((i == m_timers.end()) || (i->second.generation != d.generation))
+			{
+				m_due.pop();
+				continue;
+			}
+			if (now < d.deadline)
+			{
+				break;
+			}
+			m_due.pop();
+
+			TIMERREC& r = i->second;
+			TIMERJOB job;
+
+			job.handle = r.handle;
+			job.callback = r.callback;
+			job.instance = r.instance;
+			job.deadline = d.deadline;
+
+			if (r.periodic)
+			{
+				r.deadline += std::chrono::milliseconds(r.interval);
+				if (r.deadline <= now)
+				{
+					r.deadline = now + std::chrono::milliseconds(r.interval);
+				}
+				Schedule(r);
+			}
+			else
+			{
+				m_timers.erase(i);
+			}
+
+			if (m_running.count(job.handle) > 0u)
+			{
+				m_stats.overruns++;
+				continue;
+			}
+			m_running[job.handle] = std::thread::id();
+
+			uint32_t jitter = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - job.deadline).count());
+			m_stats.jitter_total_us += jitter;
+			m_stats.jitter_max_us = std::max(m_stats.jitter_max_us, jitter);
+			expired.push_back(job);
+		}
+
+		if (!expired.empty())
+		{
+			if (m_executors.empty())
+			{
+				for (size_t n = 0u; n < expired.size(); ++n)
+				{
+					Execute(expired[n], lk);
+				}
+			}
+			else
+			{
+				m_jobs.insert(m_jobs.end(), expired.begin(), expired.end());
+				m_clock->Notify(m_jobs_cv);
+			}
+			continue;
+		}
+
+		if (m_due.empty())
+		{
+			m_clock->Wait(m_wakeup, lk);
+		}
+		else
+		{
+			m_clock->WaitUntil(m_wakeup, lk, m_due.top().deadline);
+		}
     }
 }
 
+//!
+//! \brief Stop the executor pool
+//!
+//! Callbacks queued but not yet started are abandoned.
+//!
 //========================================================================
-HTIMER CTimer::Create (uint32_t interval, void* instance, TIMERCALLBACK callback)
+void CTimer::OnExit ()
 {
+	{
+		std::lock_guard<std::mutex> lk(m_critsect);
+
+		m_executors_stop = true;
+		m_clock->Notify(m_jobs_cv);
+	}
+	for (size_t n = 0u; n < m_executors.size(); ++n)
+	{
+		if (m_executors[n].joinable())
+		{
+			m_executors[n].join();
+		}
+	}
+	m_executors.clear();
+
+	std::lock_guard<std::mutex> lk(m_critsect);
+	m_jobs.clear();
+	m_running.clear();
+	m_clock->Notify(m_idle);
+}
+
+//!
+//! \internal
+//! \brief Executor thread main loop
+//!
+//! \param[in] index The executor's position in the pool.
+//!
+//========================================================================
+void CTimer::ExecutorProc (uint32_t index)
+{
+
+	// SCHEDULING ATTRIBUTES ARE INHERITED FROM THE MANAGER'S THREAD; ONLY
+	// THE NAME NEEDS TO BE SET
+	if (!GetThreadName().empty())
+	{
+		SetCurrentThreadName(GetThreadName() + ".x" + std::to_string(index));
+	}
+
+	std::unique_lock<std::mutex> lk(m_critsect);
+
+	while (!m_executors_stop)
+	{
+		if (m_jobs.empty())
+		{
+			m_clock->Wait(m_jobs_cv, lk);
+			continue;
+		}
+
+		TIMERJOB job = m_jobs.front();
+		m_jobs.pop_front();
+		Execute(job, lk);
+	}
+}
+
+//!
+//! \internal
+//! \brief Run an expired timer's callback
+//!
+//! \param[in] job The expired timer
+//! \param[in] lk The caller's hold on m_critsect, which is released for
+//! the duration of the callback.
+//!
+//========================================================================
+void CTimer::Execute (const TIMERJOB& job, std::unique_lock<std::mutex>& lk)
+{
+
+	// THE TIMER MAY HAVE BEEN DESTROYED WHILE THE JOB WAS QUEUED
+	std::unordered_map<HTIMER, std::thread::id>::iterator i = m_running.find(job.handle);
+	if (i == m_running.end())
+	{
+		return;
+	}
+	i->second = std::this_thread::get_id();
+
+	TIMERCLOCK::time_point start = m_clock->Now();
+	lk.unlock();
+	job.callback(job.instance);
+	TIMERCLOCK::time_point end = m_clock->Now();
+	lk.lock();
+
+	uint32_t latency = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(start - job.deadline).count());
+	uint32_t run = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+	m_stats.fired++;
+	m_stats.latency_total_us += latency;
+	m_stats.latency_max_us = std::max(m_stats.latency_max_us, latency);
+	m_stats.run_total_us += run;
+	m_stats.run_max_us = std::max(m_stats.run_max_us, run);
+
+	m_running.erase(job.handle);
+	m_clock->Notify(m_idle);
+}
+
+//!
+//! \brief Retrieve the dispatch metrics
+//!
+//========================================================================
+void CTimer::GetStats (TIMERSTATS& stats)
+{
+	std::lock_guard<std::mutex> lk(m_critsect);
+
+	stats = m_stats;
+}
+
+//!
+//! \brief Wake the main loop so that it notices the shutdown request
+//!
+//========================================================================
+void CTimer::OnShutdown ()
+{
+	std::lock_guard<std::mutex> lk(m_critsect);
+
+	m_clock->Notify(m_wakeup);
+}
+
+//!
+//! \internal
+//! \brief Queue a timer's current deadline
+//!
+//! \note Assumes the caller is holding m_critsect.
+//!
+//========================================================================
+void CTimer::Schedule (TIMERREC& r)
+{
+	bool earliest = m_due.empty() || (r.deadline < m_due.top().deadline);
+	TIMERDUE d;
+
+	// STALE ENTRIES ARE NORMALLY DISCARDED AS THEY FALL DUE, BUT DON'T LET
+	// FREQUENT RESTARTS OF LONG TIMERS PILE THEM UP
+	if (m_due.size() > (2u * m_timers.size()) + 64u)
+	{
+		std::priority_queue<TIMERDUE, std::vector<TIMERDUE>, std::greater<TIMERDUE>> live;
+
+		while (!m_due.empty())
+		{
+			const TIMERDUE& e = m_due.top();
+			std::unordered_map<HTIMER, TIMERREC>::iterator i = m_timers.find(e.handle);
+			if ((i != m_timers.end()) && (i->second.generation == e.generation))
+			{
+				live.push(e);
+			}
+			m_due.pop();
+		}
+		m_due.swap(live);
+	}
+
+	d.deadline = r.deadline;
+	d.handle = r.handle;
+	d.generation = r.generation;
+	m_due.push(d);
+
+	if (earliest)
+	{
+		m_clock->Notify(m_wakeup);
+	}
+}
+
+//!
+//! \brief Create a timer
+//!
+//! \param[in] interval Time until the first call, and between calls of
+//! a periodic timer (ms).
+//! \param[in] instance Passed to the callback.
+//! \param[in] callback Called from the timer manager's thread when the
+//! timer expires.
+//! \param[in] periodic True for a timer which fires repeatedly, false for
+//! one which fires once and is then destroyed.
+//!
+//! \retval HTIMER A handle to the new timer.
+//!
+//========================================================================
+HTIMER CTimer::Create (uint32_t interval, void* instance, TIMERCALLBACK callback, bool periodic)
+{
+	std::lock_guard<std::mutex> lk(m_critsect);
 	TIMERREC r;
 
 	r.handle = static_cast<HTIMER>(m_sequence++);
-	r.interval = interval;
+	r.interval = std::max(interval, MIN_INTERVAL);
+	r.periodic = periodic;
 	r.instance = instance;
 	r.callback = callback;
+	r.deadline = m_clock->Now() + std::chrono::milliseconds(r.interval);
 
-	r.count = interval/m_sleep_time;
-
-	m_critsect.lock();
-	m_timers.push_back(r);
-	m_critsect.unlock();
+	TIMERREC& t = m_timers[r.handle] = r;
+	Schedule(t);
 
 	return (r.handle);
 }
 
+//!
+//! \brief Destroy a timer
+//!
+//! If the timer's callback is running on another thread, waits for it 
+//! to finish, so that the caller may then release the callback's 
+//! instance data. A callback which has not yet started is cancelled.
+//!
 //========================================================================
 void CTimer::Destroy (HTIMER h)
 {
-	std::lock_guard<std::mutex> lk(m_critsect);
-	list<TIMERREC>::iterator i;
+	std::unique_lock<std::mutex> lk(m_critsect);
 
-	i = m_timers.begin();
-	while (i != m_timers.end())
+	// ITS QUEUED DEADLINE IS DISCARDED WHEN IT FALLS DUE
+	m_timers.erase(h);
+
+	std::unordered_map<HTIMER, std::thread::id>::iterator i = m_running.find(h);
+	if (i != m_running.end())
 	{
-		if (h == (*i).handle)
+		if (i->second == std::thread::id())
+		{
+			m_running.erase(i);
+		}
+		else if (i->second != std::this_thread::get_id())
 		{
-			m_timers.erase(i);
-			break;
+			while (m_running.count(h) != 0u)
+			{
+				m_clock->Wait(m_idle, lk);
+			}
 		}
-		i++;
 	}
 }
 
+//!
+//! \brief Restart a timer's interval from now
+//!
+//! Has no effect on a one-shot timer which has already fired.
+//!
 //========================================================================
 void CTimer::Restart (HTIMER h)
 {
 	std::lock_guard<std::mutex> lk(m_critsect);
-	list<TIMERREC>::iterator i;
 
-	i = m_timers.begin();
-	while (i != m_timers.end())
+	std::unordered_map<HTIMER, TIMERREC>::iterator i = m_timers.find(h);
+	if (i != m_timers.end())
 	{
-		if (h == (*i).handle)
-		{
-			(*i).count = (*i).interval / m_sleep_time;
-			break;
-		}
-		i++;
+		TIMERREC& r = i->second;
+
+		r.generation++;
+		r.deadline = m_clock->Now() + std::chrono::milliseconds(r.interval);
+		Schedule(r);
 	}
 }
 
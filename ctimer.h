@@ -23,9 +23,17 @@
 #ifndef _CTIMER_H_
 #define _CTIMER_H_
 
-#include <list>
-using std::list;
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <deque>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "clock.h"
 #include "ctask.h"
 
 namespace sr
@@ -34,21 +42,25 @@ namespace sr
 typedef uint32_t HTIMER;								//!< HANDLE TO A TIMER OBJECT
 const HTIMER INVALID_TIMER_HANDLE_VALUE = 0xffffffffu;	//!< SENTINEL VALUE FOR AN INVALID TIMER HANDLE
 typedef void (*TIMERCALLBACK)(void*);					//!< SIGNATURE OF A TIMER CALLBACK FUNCTION
+typedef std::chrono::steady_clock TIMERCLOCK;			//!< CLOCK USED FOR TIMER DEADLINES
 
 //!
 //! \internal
-//! \brief A periodic timer object. 
+//! \brief A timer object. 
 //!
-//! This timer object calls the specified function periodically
-//! at the specified interval. It will continue to make these
-//! calls until the timer object is destroyed.
+//! This timer object calls the specified function when its interval
+//! has elapsed. A periodic timer continues to make these calls until
+//! the timer object is destroyed; a one-shot timer is destroyed after
+//! its single call.
 //!
 class TIMERREC
 {
 public:
   HTIMER handle;              //!< THE HANDLE (UNIQUE ID) OF THIS TIMER
-  uint32_t count;             //!< COUNT OF CLOCK TICKS SINCE TIMER LAST FIRED
   uint32_t interval;          //!< CALL INTERVAL (MS)
+  bool periodic;              //!< TRUE IF THE TIMER REARMS ITSELF AFTER FIRING
+  uint32_t generation;        //!< BUMPED BY RESTART() TO INVALIDATE THE QUEUED DEADLINE
+  TIMERCLOCK::time_point deadline; //!< WHEN THE TIMER NEXT FIRES
   void* instance;             //!< APPLICATION-SUPPLIED INSTANCE DATA
   TIMERCALLBACK callback;     //!< POINTER TO A FUNCTION THAT WILL BE CALLED WHEN A TIMER EXPIRES 
 
@@ -56,10 +68,63 @@ public:
   TIMERREC (const TIMERREC& t);  
 };
 
+//!
+//! \internal
+//! \brief An entry in the deadline queue.
+//!
+//! Entries are not removed when their timer is restarted or destroyed;
+//! they are discarded when they reach the head of the queue and no 
+//! longer match the timer's current generation.
+//!
+struct TIMERDUE
+{
+  TIMERCLOCK::time_point deadline;  //!< WHEN THE TIMER IS DUE
+  HTIMER handle;                    //!< THE TIMER CONCERNED
+  uint32_t generation;              //!< THE TIMER'S GENERATION WHEN THIS ENTRY WAS QUEUED
+
+  bool operator> (const TIMERDUE& d) const { return (deadline > d.deadline); }
+};
+
+//!
+//! \brief Timer dispatch metrics
+//!
+//! All times are in microseconds, measured from the deadline. Jitter is
+//! how late the manager noticed that a timer had expired; latency is 
+//! how late its callback actually started (which includes any wait for
+//! an executor).
+//!
+struct TIMERSTATS
+{
+  uint64_t fired;             //!< CALLBACKS RUN
+  uint64_t overruns;          //!< PERIODIC CALLS SKIPPED BECAUSE THE PREVIOUS ONE WAS STILL RUNNING
+  uint64_t jitter_total_us;
+  uint32_t jitter_max_us;
+  uint64_t latency_total_us;
+  uint32_t latency_max_us;
+  uint64_t run_total_us;      //!< TIME SPENT IN CALLBACKS
+  uint32_t run_max_us;
+
+  TIMERSTATS() : fired(0u), overruns(0u), jitter_total_us(0u), jitter_max_us(0u), 
+    latency_total_us(0u), latency_max_us(0u), run_total_us(0u), run_max_us(0u) {}
+};
+
 //!
 //! \brief A timer manager class.
 //!
-//! Manages a set of periodic timer objects.
+//! Manages a set of one-shot and periodic timer objects with millisecond
+//! resolution. The timers are kept in a heap ordered by deadline, and 
+//! the manager's thread sleeps until the earliest one is due (or until 
+//! an earlier one is created), so an idle manager does not wake at all.
+//! Restart() and Destroy() look the timer up by handle.
+//!
+//! Expired timers are collected under the manager's lock, but their 
+//! callbacks run without it, so a callback may create, restart or 
+//! destroy timers and a slow one delays only the callbacks queued behind
+//! it. By default callbacks run on the manager's thread; SetExecutors()
+//! hands them to a small pool instead. A timer's callbacks never overlap.
+//!
+//! Deadlines are measured with the system clock unless SetClock() 
+//! injects another one (e.g. a CVirtualClock for simulation).
 //!
 class CTimer : public sr::CTask
 {
@@ -67,18 +132,52 @@ public:
   CTimer ();
   ~CTimer ();
 
-  HTIMER Create (uint32_t interval, void* instance, TIMERCALLBACK callback);
+  HTIMER Create (uint32_t interval, void* instance, TIMERCALLBACK callback, bool periodic = true);
   void Restart (HTIMER h);
   void Destroy (HTIMER h);
+  void SetExecutors (uint32_t n) { m_num_executors = n; }
+  void SetClock (CClock* clock) { m_clock = clock; }
+  void GetStats (TIMERSTATS& stats);
+  bool OnStart ();
   void OnRun ();
+  void OnExit ();
+
+protected:
+  void OnShutdown ();
 
 private:
-  std::mutex m_critsect;        // SERIALIZES ACCESS TO THE TIMER LIST
-  list<TIMERREC> m_timers;      // THE LIST OF ACTIVE TIMERS
-  uint32_t m_sleep_time;        // TIME BETWEEN THREAD WAKEUPS
+  CClock* m_clock;              // SOURCE OF TIME; SET BEFORE Start()
+  std::mutex m_critsect;        // SERIALIZES ACCESS TO THE TIMERS
+  std::condition_variable m_wakeup;  // SIGNALLED WHEN THE EARLIEST DEADLINE CHANGES
+  std::unordered_map<HTIMER, TIMERREC> m_timers;  // THE ACTIVE TIMERS, BY HANDLE
+  std::priority_queue<TIMERDUE, std::vector<TIMERDUE>, std::greater<TIMERDUE>> m_due;  // PENDING DEADLINES, EARLIEST FIRST
   uint32_t m_sequence;          // USED TO GENERATE TEMPORALLY UNIQUE TIMER HANDLE VALUES
 
-  void UpdateSleepTime (uint32_t new_interval);  
+  //! An expired timer whose callback has yet to run
+  struct TIMERJOB
+  {
+    HTIMER handle;
+    TIMERCALLBACK callback;
+    void* instance;
+    TIMERCLOCK::time_point deadline;
+  };
+
+  // CALLBACKS COLLECTED BUT NOT YET FINISHED, WITH THE THREAD RUNNING EACH
+  // (A DEFAULT ID UNTIL IT STARTS). ALSO GUARDED BY m_critsect.
+  std::unordered_map<HTIMER, std::thread::id> m_running;
+  std::condition_variable m_idle;    // SIGNALLED WHEN A CALLBACK FINISHES
+  TIMERSTATS m_stats;
+
+  // EXECUTOR POOL (EMPTY IF CALLBACKS RUN ON THE MANAGER'S THREAD)
+  uint32_t m_num_executors;
+  std::vector<std::thread> m_executors;
+  std::deque<TIMERJOB> m_jobs;
+  std::condition_variable m_jobs_cv;
+  bool m_executors_stop;
+
+  void Schedule (TIMERREC& r);
+  void Execute (const TIMERJOB& job, std::unique_lock<std::mutex>& lk);
+  void ExecutorProc (uint32_t index);
 };
 
 }
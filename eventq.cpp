@@ -0,0 +1,154 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//!
+//! \file eventq.cpp
+//! \brief Implementation of the CEventQueue class.
+//!
+
+#include "pch.h"
+#include <vector>
+#include "eventq.h"
+
+//!
+//! \brief Constructor
+//!
+//! \param[in] capacity The most events that may be outstanding before
+//! new ones are dropped.
+//! \param[in] handler Called on the queue's thread for each event.
+//!
+//========================================================================
+CEventQueue::CEventQueue (uint32_t capacity, EVENTHANDLER handler) : 
+	m_handler(handler), m_clock(sr::CClock::GetSystemClock())
+{
+
+	m_stats.capacity = capacity;
+}
+
+//!
+//! \brief Queue an event for the handler
+//!
+//! \param[in] source Passed to the handler with the event (e.g. the 
+//! index of the radio it came from).
+//! \param[in] e The event, which is copied.
+//! \param[in] essential True if the event must not be dropped.
+//!
+//! \retval bool Returns false if the queue was full and the event was
+//! dropped.
+//!
+//========================================================================
+bool CEventQueue::Push (uint32_t source, const SCEvent& e, bool essential)
+{
+	QUEUEDEVENT q;
+
+	q.source = source;
+	q.queued = m_clock->Now();
+
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	if (!essential && (m_stats.depth >= m_stats.capacity))
+	{
+		m_stats.dropped++;
+		return false;
+	}
+
+	// ONLY COPY THE EVENT ONCE IT IS KNOWN TO FIT
+	m_queue.push_back(std::move(q));
+	m_queue.back().event = e;
+	m_stats.queued++;
+	m_stats.depth++;
+	m_stats.max_depth = std::max(m_stats.max_depth, m_stats.depth);
+	m_clock->Notify(m_cv);
+
+	return true;
+}
+
+//!
+//! \brief Retrieve the queue metrics
+//!
+//========================================================================
+void CEventQueue::GetStats (EVENTSTATS& stats)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	stats = m_stats;
+}
+
+//!
+//! \brief Hand queued events to the handler
+//!
+//! Everything queued is taken at once, so producers contend for the 
+//! lock only briefly however long the handler takes. Events still 
+//! queued at shutdown are handled before the task exits.
+//!
+//========================================================================
+void CEventQueue::OnRun ()
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+
+	for (;;)
+	{
+		if (m_queue.empty())
+		{
+			if (IsShutdown())
+			{
+				break;
+			}
+			m_clock->Wait(m_cv, lk);
+			continue;
+		}
+
+		std::deque<QUEUEDEVENT> batch;
+		batch.swap(m_queue);
+		lk.unlock();
+
+		std::vector<uint32_t> waits;
+		waits.reserve(batch.size());
+		for (size_t i = 0u; i < batch.size(); ++i)
+		{
+			waits.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+				m_clock->Now() - batch[i].queued).count()));
+			m_handler(batch[i].source, batch[i].event);
+		}
+		batch.clear();
+
+		lk.lock();
+		for (size_t i = 0u; i < waits.size(); ++i)
+		{
+			m_stats.wait_total_us += waits[i];
+			m_stats.wait_max_us = std::max(m_stats.wait_max_us, waits[i]);
+		}
+		m_stats.depth -= static_cast<uint32_t>(waits.size());
+	}
+}
+
+//!
+//! \brief Wake the task so that it notices the shutdown request
+//!
+//========================================================================
+void CEventQueue::OnShutdown ()
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	m_clock->Notify(m_cv);
+}
@@ -0,0 +1,112 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//!
+//! \file eventq.h
+//! \brief Declarations for the CEventQueue class.
+//!
+
+#ifndef _EVENTQ_H_
+#define _EVENTQ_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "clock.h"
+#include "ctask.h"
+#include "scevents.h"
+
+//!
+//! \brief Event queue metrics
+//!
+//! Waits are in microseconds, from when an event was queued to when its
+//! handler was called.
+//!
+struct EVENTSTATS
+{
+	uint64_t queued;			//!< Events accepted
+	uint64_t dropped;			//!< Events discarded because the queue was full
+	uint32_t depth;				//!< Events queued or being handled now
+	uint32_t max_depth;			//!< Highest depth seen
+	uint32_t capacity;			//!< Depth beyond which events are dropped
+	uint64_t wait_total_us;
+	uint32_t wait_max_us;
+
+	EVENTSTATS() : queued(0u), dropped(0u), depth(0u), max_depth(0u), capacity(0u),
+		wait_total_us(0u), wait_max_us(0u) {}
+};
+
+//! Called on the queue's thread for each event, with the source it was queued under
+typedef std::function<void (uint32_t source, SCEvent& e)> EVENTHANDLER;
+
+//!
+//! \brief A bounded queue of events, handled on its own thread.
+//!
+//! Any number of threads may Push() events; the queue's task passes them
+//! to the handler in the order they were queued. Push() copies the event
+//! and never waits for the handler, so a slow handler (e.g. one held up
+//! by client sockets) cannot stall the thread that decoded the event. 
+//!
+//! Once capacity events are outstanding further ones are dropped and 
+//! counted, except those pushed as essential: events which change the 
+//! state of the link are rare, and losing one would leave the handler 
+//! with the wrong idea of it. Losing the result of a command would 
+//! leave the client that sent it waiting for a reply.
+//!
+//! The queue's thread waits on the injected clock (if any), so that a 
+//! virtual clock knows when it has events to handle.
+//!
+class CEventQueue : public sr::CTask
+{
+public:
+	CEventQueue (uint32_t capacity, EVENTHANDLER handler);
+	bool Push (uint32_t source, const SCEvent& e, bool essential = false);
+	void SetClock (sr::CClock* clock) { m_clock = clock; }
+	void GetStats (EVENTSTATS& stats);
+
+protected:
+	void OnRun ();
+	void OnShutdown ();
+
+private:
+	CEventQueue ();
+
+	//! An event waiting to be handled
+	struct QUEUEDEVENT
+	{
+		uint32_t source;
+		SCEvent event;				//!< Held by value; no heap allocation of its own
+		sr::CLOCKTIME queued;		//!< When Push() was called
+	};
+
+	EVENTHANDLER m_handler;
+	sr::CClock* m_clock;			//!< Source of time; set before Start()
+	std::mutex m_lock;				//!< Guards everything below
+	std::condition_variable m_cv;	//!< Signalled when an event is queued, or on shutdown
+	std::deque<QUEUEDEVENT> m_queue;
+	EVENTSTATS m_stats;
+};
+
+#endif
@@ -34,6 +34,8 @@
 
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <mutex>
 
 //!
 //! \brief The Observer class
@@ -51,25 +53,90 @@ public:
 //! \brief The Subject class
 //!
 //! The Subject is the source of the event notifications being
-//! monitored by the Observer. When an event occurs, the Update
-//! method of each Observer is invoked in turn.
+//! monitored by the Observer. An Observer either attaches for every 
+//! event or subscribes to particular types of event. When an event 
+//! occurs, the Update method of each Observer of that type is invoked
+//! in turn.
+//!
+//! Observers are kept in a table with one row per event type, so that
+//! Notify() goes straight to the interested Observers and an Observer 
+//! costs nothing for the events it hasn't subscribed to. T must provide
+//! eventid(), returning a dense index below T::TYPE_COUNT.
+//!
+//! The table is never modified once published. Attach(), Subscribe() and
+//! Detach() build a new copy and swap it in atomically, so they may be
+//! called from any thread, while Notify() takes no lock and iterates 
+//! whichever table was current when it started. An Observer may 
+//! therefore receive one more update from a Notify() already under way
+//! when Detach() returns.
 //!
 template <typename T>
 class Subject
 {
 public:
-	//! \brief Add an Observer to the notification list
-	void Attach (IObserver<T>* o) { m_list.push_back(o); }
-	//! \brief Remove an Observer from the notification list
-	void Detach (IObserver<T>* o) { m_list.remove(o); }
-	//! \brief Send an update to all attached Observers
+	Subject () : m_table(new TABLE(T::TYPE_COUNT)) { }
+
+	//! \brief Add an Observer for every type of event
+	void Attach (IObserver<T>* o) 
+	{ 
+		std::lock_guard<std::mutex> lk(m_write_lock);
+		std::shared_ptr<TABLE> table = std::make_shared<TABLE>(*std::atomic_load(&m_table));
+
+		for (size_t type = 0u; type < table->size(); ++type)
+		{
+			Add((*table)[type], o);
+		}
+		Publish(table);
+	}
+	//! \brief Add an Observer for one type of event
+	void Subscribe (IObserver<T>* o, size_t type)
+	{
+		std::lock_guard<std::mutex> lk(m_write_lock);
+		std::shared_ptr<TABLE> table = std::make_shared<TABLE>(*std::atomic_load(&m_table));
+
+		Add((*table)[type], o);
+		Publish(table);
+	}
+	//! \brief Remove an Observer from the notification lists
+	void Detach (IObserver<T>* o) 
+	{ 
+		std::lock_guard<std::mutex> lk(m_write_lock);
+		std::shared_ptr<TABLE> table = std::make_shared<TABLE>(*std::atomic_load(&m_table));
+
+		for (size_t type = 0u; type < table->size(); ++type)
+		{
+			ROW& row = (*table)[type];
+			row.erase(std::remove(row.begin(), row.end(), o), row.end());
+		}
+		Publish(table);
+	}
+	//! \brief Send an update to the Observers of the event's type
 	void Notify(T& t) 
 	{ 
-		std::for_each(m_list.begin(), m_list.end(), [&t](IObserver<T>* o) { o->Update(t); });
+		std::shared_ptr<const TABLE> table = std::atomic_load(&m_table);
+		const ROW& row = (*table)[t.eventid()];
+
+		std::for_each(row.begin(), row.end(), [&t](IObserver<T>* o) { o->Update(t); });
 	}
 
 private:
-    std::vector<IObserver<T>*> m_list;		//!< The list of registered Observers
+	typedef std::vector<IObserver<T>*> ROW;
+	typedef std::vector<ROW> TABLE;
+
+	static void Add (ROW& row, IObserver<T>* o)
+	{
+		if (std::find(row.begin(), row.end(), o) == row.end())
+		{
+			row.push_back(o);
+		}
+	}
+	void Publish (const std::shared_ptr<TABLE>& table)
+	{
+		std::atomic_store(&m_table, std::shared_ptr<const TABLE>(table));
+	}
+
+	std::shared_ptr<const TABLE> m_table;	//!< The registered Observers, by event type (read only once published)
+	std::mutex m_write_lock;				//!< Serializes changes to the table
 };
 
 #endif
@@ -0,0 +1,174 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file probecache.cpp
+//! \brief Implementation of the CProbeCache class.
+//!
+
+#include "pch.h"
+#include "probecache.h"
+
+//!
+//! \brief Constructor
+//!
+//! \param[in] path The cache file. Entries already in it are loaded.
+//!
+//========================================================================
+CProbeCache::CProbeCache (const string& path) : m_path(path)
+{
+
+	Load();
+}
+
+//!
+//! \brief Find the interface last detected on a device
+//!
+//! \param[in] device The device name, as given on the command line.
+//! \param[out] result What was found there.
+//!
+//! \retval bool Returns false if the device has not been probed.
+//!
+//========================================================================
+bool CProbeCache::Lookup (const string& device, PROBERESULT& result)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	std::map<string, PROBERESULT>::const_iterator i = m_entries.find(device);
+
+	if (i == m_entries.end())
+	{
+		return false;
+	}
+	result = i->second;
+	return true;
+}
+
+//!
+//! \brief Remember the interface detected on a device
+//!
+//! \param[in] device The device name.
+//! \param[in] result What was found there.
+//!
+//========================================================================
+void CProbeCache::Store (const string& device, const PROBERESULT& result)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	std::map<string, PROBERESULT>::const_iterator i = m_entries.find(device);
+
+	// DON'T REWRITE THE FILE ON EVERY START IF NOTHING HAS CHANGED
+	if ((i != m_entries.end()) && (i->second.tts100 == result.tts100) &&
+		(i->second.major == result.major) && (i->second.minor == result.minor))
+	{
+		return;
+	}
+	m_entries[device] = result;
+	Save();
+}
+
+//!
+//! \brief Discard what is known about a device, so that it is probed in
+//! full next time
+//!
+//! \param[in] device The device name.
+//!
+//========================================================================
+void CProbeCache::Forget (const string& device)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	if (m_entries.erase(device) > 0u)
+	{
+		Save();
+	}
+}
+
+//!
+//! \internal
+//! \brief Read the cache file
+//!
+//! Each line holds a device name, "tts100" or "direct", and the TTS-100
+//! version, separated by tabs. Lines which can't be parsed are ignored.
+//!
+//========================================================================
+void CProbeCache::Load ()
+{
+	ifstream f(m_path.c_str());
+	string line;
+
+	while (std::getline(f, line))
+	{
+		vector<string> fields = StrTokenize(line, "\t");
+		PROBERESULT r;
+
+		if ((fields.size() != 3u) || ((fields[1] != "tts100") && (fields[1] != "direct")) ||
+			(sscanf(fields[2].c_str(), "%u.%u", &r.major, &r.minor) != 2))
+		{
+			continue;
+		}
+		r.tts100 = (fields[1] == "tts100");
+		m_entries[fields[0]] = r;
+	}
+	LogWrite(LEVEL_DEBUG, "Loaded %u probe results from %s.", static_cast<uint32_t>(m_entries.size()), m_path.c_str());
+}
+
+//!
+//! \internal
+//! \brief Write the cache file
+//!
+//! The entries are written to a temporary file which then replaces the
+//! cache, so a crash can't leave it half written.
+//!
+//! \note Must be called with m_lock held.
+//!
+//========================================================================
+bool CProbeCache::Save ()
+{
+	string tmp = m_path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wt");
+
+	if (f == 0)
+	{
+		LogWrite(LEVEL_WARNING, "Cannot write probe cache %s.", tmp.c_str());
+		return false;
+	}
+	for (std::map<string, PROBERESULT>::const_iterator i = m_entries.begin(); i != m_entries.end(); ++i)
+	{
+		fprintf(f, "%s\t%s\t%u.%u\n", i->first.c_str(), i->second.tts100 ? "tts100" : "direct", i->second.major, i->second.minor);
+	}
+	if (fclose(f) != 0)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+
+#ifdef WIN32
+	// rename() WON'T REPLACE AN EXISTING FILE HERE
+	remove(m_path.c_str());
+#endif
+	if (rename(tmp.c_str(), m_path.c_str()) != 0)
+	{
+		LogWrite(LEVEL_WARNING, "Cannot replace probe cache %s.", m_path.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
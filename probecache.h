@@ -0,0 +1,73 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file probecache.h
+//! \brief Declarations for the CProbeCache class.
+//!
+
+#ifndef _PROBECACHE_H_
+#define _PROBECACHE_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+
+using std::string;
+
+//! What was found at the end of a serial device
+struct PROBERESULT
+{
+	bool tts100;		//!< True if the radio is behind a TTS-100 interface
+	uint32_t major;		//!< TTS-100 major version number
+	uint32_t minor;		//!< TTS-100 minor version number
+
+	PROBERESULT() : tts100(false), major(0u), minor(0u) {}
+};
+
+//!
+//! \brief A persistent record of the interface detected on each device.
+//!
+//! Detecting that there is no TTS-100 in the way takes several seconds
+//! of unanswered version requests. The result is therefore remembered 
+//! (in a small text file, one device per line) so that the next start 
+//! can go straight to the interface that was there last time. 
+//!
+class CProbeCache
+{
+public:
+	CProbeCache (const string& path);
+	bool Lookup (const string& device, PROBERESULT& result);
+	void Store (const string& device, const PROBERESULT& result);
+	void Forget (const string& device);
+
+private:
+	CProbeCache ();
+	void Load ();
+	bool Save ();
+
+	string m_path;						//!< The cache file
+	std::mutex m_lock;					//!< Serializes access to the entries (and the file)
+	std::map<string, PROBERESULT> m_entries;
+};
+
+#endif
@@ -0,0 +1,880 @@
+/*
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file radioemu.cpp
+//! \brief Implementation of the SiriusConnect radio emulator.
+//!
+
+#include "pch.h"
+#include <algorithm>
+#include "radioemu.h"
+
+//! Maximum number of times a frame is retransmitted to the host
+static const uint32_t EMU_MAX_RETRIES = 3u;
+
+//! Maximum number of frames queued before metadata generation is throttled
+static const size_t EMU_MAX_BACKLOG = 32u;
+
+//! Size of the emulator I/O buffers (bytes)
+static const size_t EMU_BUFSIZE = 64u * 1024u;
+
+//! Number of recently processed host sequence numbers remembered
+static const size_t EMU_SEQ_HISTORY = 16u;
+
+//! The emulated radio's Sirius ID
+static const char* EMU_SID = "012345678901";
+
+//! Canned genre names (long, short)
+static const char* s_genres[8][2] =
+{
+	{ "Pop", "POP" },
+	{ "Rock", "ROCK" },
+	{ "Country", "CTRY" },
+	{ "Jazz & Blues", "JAZZ" },
+	{ "Talk & Entertainment", "TALK" },
+	{ "Sports", "SPRT" },
+	{ "News", "NEWS" },
+	{ "Comedy", "CMDY" }
+};
+
+//!
+//! \brief Constructor
+//!
+//! \param[in] config The emulator configuration
+//!
+//========================================================================
+CRadioEmulator::CRadioEmulator (const SCEMU_CONFIG& config) :
+	m_config(config),
+	m_rng(config.seed),
+	m_inbuf(EMU_BUFSIZE),
+	m_outbuf(EMU_BUFSIZE),
+	m_inESC(false),
+	m_tts_state(config.tts100 ? TTS_LOCKED : TTS_UNLOCKED),
+	m_seq(0u),
+	m_in_flight(false),
+	m_tx_time(0u),
+	m_meta_time(0u),
+	m_power(0x03),
+	m_gain(0),
+	m_mute(0u),
+	m_async(0u),
+	m_channel(184u),
+	m_tz_offset(0),
+	m_tz_dst(0u)
+{
+
+	memset(m_challenge, '\0', sizeof(m_challenge));
+	memset(m_song, '\0', sizeof(m_song));
+}
+
+//!
+//! \brief Feed bytes received from the host into the emulator.
+//!
+//! \param[in] data The received bytes
+//! \param[in] len The number of bytes received
+//! \param[in] now The current time (ms)
+//!
+//========================================================================
+void CRadioEmulator::Input (const uint8_t* data, size_t len, uint64_t now)
+{
+
+	m_stats.rx_bytes += len;
+
+	for (size_t i = 0u; i < len; ++i)
+	{
+		uint8_t c = data[i];
+
+		// UNTIL THE HANDSHAKE IS COMPLETE A TTS-100 DOES NOT SPEAK SCP
+		if (m_tts_state != TTS_UNLOCKED)
+		{
+			InputTTS(c);
+			continue;
+		}
+
+		if (m_inbuf.GetWriteLen() == 0u)
+		{
+			// HOST IS SENDING GARBAGE - PUNT
+			m_stats.rx_resync += m_inbuf.GetReadLen();
+			m_inbuf.Clear();
+		}
+
+		// DE-ESCAPE THE INCOMING DATA
+		if (m_inESC)
+		{
+			m_inESC = false;
+			if (c == ASCII_ESC)
+			{
+				*m_inbuf.GetWritePtr() = ASCII_ESC;
+				m_inbuf.MarkWritten(1u);
+			}
+			else if (c == SENTINEL_ESC)
+			{
+				*m_inbuf.GetWritePtr() = PKT_SENTINEL;
+				m_inbuf.MarkWritten(1u);
+			}
+		}
+		else if (c == ASCII_ESC)
+		{
+			m_inESC = true;
+		}
+		else
+		{
+			*m_inbuf.GetWritePtr() = c;
+			m_inbuf.MarkWritten(1u);
+		}
+	}
+
+	ProcessFrames(now);
+}
+
+//!
+//! \brief Retrieve bytes which the emulator wants to send to the host.
+//!
+//! \param[out] buf Receives the outgoing bytes
+//! \param[in] maxlen The size of the output buffer
+//!
+//! \retval size_t The number of bytes copied into the output buffer
+//!
+//========================================================================
+size_t CRadioEmulator::Output (uint8_t* buf, size_t maxlen)
+{
+	size_t len = std::min(maxlen, m_outbuf.GetReadLen());
+
+	memcpy(buf, m_outbuf.GetReadPtr(), len);
+	m_outbuf.MarkRead(len);
+	return len;
+}
+
+//!
+//! \brief Perform time-driven processing.
+//!
+//! Sends (or resends) the frame at the head of the transmit queue and
+//! generates unsolicited metadata notifications at the configured rate.
+//!
+//! \param[in] now The current time (ms)
+//!
+//========================================================================
+void CRadioEmulator::Poll (uint64_t now)
+{
+
+	if (m_tts_state != TTS_UNLOCKED)
+	{
+		return;
+	}
+
+	// GENERATE METADATA, AF_ALLCHANNELINFO STYLE
+	bool meta = m_config.meta_force || ((m_async & (AF_CHANNELINFO | AF_ALLCHANNELINFO)) != 0u);
+	if ((m_config.meta_rate > 0u) && meta && (m_power != 0u))
+	{
+		uint64_t interval = 1000000u / m_config.meta_rate;	// MICROSECONDS
+		uint64_t now_us = now * 1000u;
+
+		if (m_meta_time == 0u)
+		{
+			m_meta_time = now_us;
+		}
+		while (m_meta_time <= now_us)
+		{
+			m_meta_time += interval;
+			if (m_txq.size() >= EMU_MAX_BACKLOG)
+			{
+				// THE HOST CAN'T KEEP UP; A REAL RADIO WOULD JUST SKIP THE UPDATE
+				continue;
+			}
+
+			SCP_CHANNEL_INDEX channel = m_channel;
+			if (m_config.meta_force || (m_async & AF_ALLCHANNELINFO))
+			{
+				do
+				{
+					channel = static_cast<SCP_CHANNEL_INDEX>(m_rng() % SCP_MAX_CHANNELS);
+				} while (!IsValidChannel(channel));
+			}
+			m_song[channel]++;
+
+			std::vector<uint8_t> payload = { MSG_ASYNC, SCP_ASYNC_SONGINFO, channel };
+			AppendSongInfo(payload, channel);
+			QueueFrame(payload);
+			m_stats.meta_events++;
+		}
+	}
+	else
+	{
+		m_meta_time = 0u;
+	}
+
+	// SERVICE THE TRANSMIT QUEUE (STOP-AND-WAIT)
+	if (!m_txq.empty())
+	{
+		if (!m_in_flight)
+		{
+			TransmitFront(now);
+		}
+		else if (now >= m_tx_time)
+		{
+			if (m_txq.front().retries >= EMU_MAX_RETRIES)
+			{
+				// GIVE UP ON THIS FRAME AND MOVE ON TO THE NEXT
+				m_stats.tx_drops++;
+				m_txq.pop_front();
+				m_in_flight = false;
+				if (!m_txq.empty())
+				{
+					TransmitFront(now);
+				}
+			}
+			else
+			{
+				m_txq.front().retries++;
+				m_stats.tx_retries++;
+				TransmitFront(now);
+			}
+		}
+	}
+}
+
+//!
+//! \brief Returns the time until the emulator next needs to be polled.
+//!
+//! \param[in] now The current time (ms)
+//!
+//! \retval uint32_t Milliseconds until the next scheduled event
+//!
+//========================================================================
+uint32_t CRadioEmulator::GetTimeToNextEvent (uint64_t now)
+{
+	uint64_t next = now + 1000u;
+
+	if (m_tts_state == TTS_UNLOCKED)
+	{
+		if (!m_txq.empty())
+		{
+			next = m_in_flight ? std::min(next, m_tx_time) : now;
+		}
+		if (m_meta_time != 0u)
+		{
+			next = std::min(next, (m_meta_time + 999u) / 1000u);
+		}
+	}
+	return (next > now) ? static_cast<uint32_t>(next - now) : 0u;
+}
+
+//========================================================================
+bool CRadioEmulator::Chance (double ratio)
+{
+
+	if (ratio <= 0.0)
+	{
+		return false;
+	}
+	return (std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) < ratio);
+}
+
+//!
+//! \brief Handle a byte received while the TTS-100 handshake is incomplete.
+//!
+//! \param[in] c The received byte
+//!
+//========================================================================
+void CRadioEmulator::InputTTS (uint8_t c)
+{
+
+	if (m_tts_state == TTS_LOCKED)
+	{
+		if (c == 'V')
+		{
+			static const char* version = "Time Trax TTS-100 Version 1.07\r\n";
+
+			SendRaw(reinterpret_cast<const uint8_t*>(version), strlen(version));
+		}
+		else if (c == 'A')
+		{
+			// ISSUE A CHALLENGE
+			m_challenge[0] = m_challenge[1] = 0x3e;
+			for (size_t i = 2u; i < sizeof(m_challenge); ++i)
+			{
+				m_challenge[i] = static_cast<uint8_t>(m_rng());
+			}
+			SendRaw(m_challenge, sizeof(m_challenge));
+			m_inbuf.Clear();
+			m_tts_state = TTS_CHALLENGED;
+		}
+		return;
+	}
+
+	// COLLECT THE 21-BYTE CHALLENGE RESPONSE
+	*m_inbuf.GetWritePtr() = c;
+	m_inbuf.MarkWritten(1u);
+	if (m_inbuf.GetReadLen() >= 21u)
+	{
+		const uint8_t* resp = m_inbuf.GetReadPtr();
+
+		if ((resp[18] == (m_challenge[2] ^ 0xad)) && (resp[19] == (m_challenge[4] ^ 0x3a)))
+		{
+			SendRaw(reinterpret_cast<const uint8_t*>("P\r\n"), 3u);
+			m_tts_state = TTS_UNLOCKED;
+			LogWrite(LEVEL_INFO, "TTS-100 handshake complete.");
+		}
+		else
+		{
+			SendRaw(reinterpret_cast<const uint8_t*>("F\r\n"), 3u);
+			m_tts_state = TTS_LOCKED;
+			LogWrite(LEVEL_WARNING, "TTS-100 challenge response rejected.");
+		}
+		m_inbuf.Clear();
+	}
+}
+
+//!
+//! \brief Parse and process all complete frames received from the host.
+//!
+//! \param[in] now The current time (ms)
+//!
+//========================================================================
+void CRadioEmulator::ProcessFrames (uint64_t now)
+{
+
+	while (m_inbuf.GetReadLen() >= sizeof(SHDR))
+	{
+		const uint8_t* frame = m_inbuf.GetReadPtr();
+		const SHDR* hdrptr = reinterpret_cast<const SHDR*>(frame);
+
+		if (hdrptr->sentinel != PKT_SENTINEL)
+		{
+			m_stats.rx_resync++;
+			m_inbuf.MarkRead(1u);
+			continue;
+		}
+
+		uint32_t msglen = sizeof(SHDR) + hdrptr->len + 1u;
+		if (msglen > m_inbuf.GetReadLen())
+		{
+			break;
+		}
+
+		uint8_t sum = 0u;
+		for (uint32_t i = 0u; i < msglen; ++i)
+		{
+			sum += frame[i];
+		}
+
+		if (sum != 0u)
+		{
+			m_stats.rx_chksum++;
+			if (!(hdrptr->flags & SF_ACK))
+			{
+				SendACK(hdrptr->seq, SF_ACK | SF_CHKSUM);
+			}
+			msglen = 1u;	// FORCE A RESYNC
+		}
+		else if (hdrptr->flags & SF_ACK)
+		{
+			m_stats.rx_frames++;
+			OnHostACK(hdrptr->seq, hdrptr->flags, now);
+		}
+		else
+		{
+			m_stats.rx_frames++;
+			if (Chance(m_config.busy_ratio))
+			{
+				m_stats.busy_naks++;
+				SendACK(hdrptr->seq, SF_ACK | SF_BUSY);
+			}
+			else
+			{
+				SendACK(hdrptr->seq, SF_ACK);
+
+				// A RETRANSMISSION OF A FRAME WE ALREADY HANDLED?
+				if (std::find(m_recent.begin(), m_recent.end(), hdrptr->seq) != m_recent.end())
+				{
+					m_stats.rx_dups++;
+				}
+				else
+				{
+					m_recent.push_back(hdrptr->seq);
+					if (m_recent.size() > EMU_SEQ_HISTORY)
+					{
+						m_recent.pop_front();
+					}
+					if (hdrptr->len > 0u)
+					{
+						OnCommand(frame + sizeof(SHDR), hdrptr->len);
+					}
+				}
+			}
+		}
+
+		m_inbuf.MarkRead(msglen);
+	}
+}
+
+//!
+//! \brief Handle an acknowledgement from the host.
+//!
+//! \param[in] seq The sequence number being acknowledged
+//! \param[in] flags The acknowledgement flags (SF_XXX)
+//! \param[in] now The current time (ms)
+//!
+//========================================================================
+void CRadioEmulator::OnHostACK (uint8_t seq, uint8_t flags, uint64_t now)
+{
+
+	if (!m_in_flight || (m_txq.front().data[3] != seq))
+	{
+		return;
+	}
+
+	if (flags & SF_CHKSUM)
+	{
+		// HOST SAW A BAD CHECKSUM - RESEND IMMEDIATELY
+		m_stats.tx_retries++;
+		TransmitFront(now);
+	}
+	else if (flags & SF_BUSY)
+	{
+		// HOST IS BUSY - RESEND WHEN THE ACK TIMER EXPIRES
+		m_tx_time = now + m_config.ack_timeout;
+	}
+	else
+	{
+		m_txq.pop_front();
+		m_in_flight = false;
+		if (!m_txq.empty())
+		{
+			TransmitFront(now);
+		}
+	}
+}
+
+//!
+//! \brief Process a command frame payload from the host.
+//!
+//! \param[in] data The frame payload
+//! \param[in] len The length of the payload (bytes)
+//!
+//========================================================================
+void CRadioEmulator::OnCommand (const uint8_t* data, uint32_t len)
+{
+
+	switch (data[0])
+	{
+		case MSG_GET:
+			OnGet(data, len);
+		break;
+
+		case MSG_SET:
+			OnSet(data, len);
+		break;
+
+		default:
+			LogWrite(LEVEL_DEBUG, "Emulator: unknown message type 0x%02x", data[0]);
+		break;
+	}
+}
+
+//!
+//! \brief Answer a GET request.
+//!
+//! \param[in] data The frame payload
+//! \param[in] len The length of the payload (bytes)
+//!
+//========================================================================
+void CRadioEmulator::OnGet (const uint8_t* data, uint32_t len)
+{
+	uint8_t arg = (len > 2u) ? data[2] : 0u;
+	std::vector<uint8_t> resp = { MSG_GET_RESP, static_cast<uint8_t>((len > 1u) ? data[1] : 0u), 0x00, 0x00 };
+
+	switch (resp[1])
+	{
+		case SCP_GET_GAIN:
+			resp.push_back(static_cast<uint8_t>(m_gain));
+		break;
+
+		case SCP_GET_MUTE:
+			resp.push_back(m_mute);
+		break;
+
+		case SCP_GET_POWER:
+			resp.push_back(m_power);
+		break;
+
+		case SCP_GET_CHANNEL:
+			resp.push_back(m_channel);
+		break;
+
+		case SCP_GET_CHANNELINFO:
+			if (IsValidChannel(arg))
+			{
+				AppendChannelInfo(resp, arg);
+				AppendSongInfo(resp, arg);
+			}
+			else
+			{
+				resp[3] = 0x01;
+			}
+		break;
+
+		case SCP_GET_SONGINFO:
+			resp.push_back(arg);
+			AppendSongInfo(resp, arg);
+		break;
+
+		case SCP_GET_CHANNEL_MAP:
+		{
+			uint8_t map[SCP_CHANNEL_BITMAP_SIZE];
+
+			memset(map, '\0', sizeof(map));
+			for (uint32_t ch = 0u; ch < SCP_MAX_CHANNELS; ++ch)
+			{
+				if (IsValidChannel(static_cast<SCP_CHANNEL_INDEX>(ch)))
+				{
+					map[SCP_CHANNEL_BITMAP_SIZE - (ch / 8u) - 1u] |= (1u << (ch % 8u));
+				}
+			}
+			resp.insert(resp.end(), map, map + sizeof(map));
+		}
+		break;
+
+		case SCP_GET_SID:
+			AppendPascalString(resp, EMU_SID);
+		break;
+
+		case SCP_GET_TZINFO:
+			resp.push_back(static_cast<uint8_t>(m_tz_offset >> 8));
+			resp.push_back(static_cast<uint8_t>(m_tz_offset & 0xff));
+			resp.push_back(m_tz_dst);
+		break;
+
+		case SCP_GET_TIME:
+		{
+			time_t t = time(0);
+			tm* tmptr = gmtime(&t);
+			uint16_t year = static_cast<uint16_t>(tmptr->tm_year + 1900);
+
+			resp.push_back(static_cast<uint8_t>(year >> 8));
+			resp.push_back(static_cast<uint8_t>(year & 0xff));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_mon + 1));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_mday));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_hour));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_min));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_sec));
+			resp.push_back(static_cast<uint8_t>(tmptr->tm_wday));
+			resp.push_back(m_tz_dst);
+		}
+		break;
+
+		case SCP_GET_STATUS:
+			resp.push_back(arg);
+			resp.push_back(0x01);
+			resp.push_back(0x00);
+		break;
+
+		case SCP_GET_RSSI:
+			resp.push_back(static_cast<uint8_t>(2u + m_rng() % 2u));
+			resp.push_back(static_cast<uint8_t>(1u + m_rng() % 3u));
+			resp.push_back(static_cast<uint8_t>(m_rng() % 4u));
+		break;
+
+		case SCP_GET_ASYNC:
+			resp.push_back(m_async);
+		break;
+
+		default:
+			resp[3] = 0x01;
+		break;
+	}
+
+	QueueFrame(resp);
+}
+
+//!
+//! \brief Carry out a SET request.
+//!
+//! \param[in] data The frame payload
+//! \param[in] len The length of the payload (bytes)
+//!
+//========================================================================
+void CRadioEmulator::OnSet (const uint8_t* data, uint32_t len)
+{
+	uint8_t arg = (len > 2u) ? data[2] : 0u;
+	std::vector<uint8_t> resp = { MSG_SET_RESP, static_cast<uint8_t>((len > 1u) ? data[1] : 0u), 0x00, 0x00 };
+	std::vector<uint8_t> async;
+
+	switch (resp[1])
+	{
+		case SCP_SET_GAIN:
+			m_gain = static_cast<int8_t>(arg);
+		break;
+
+		case SCP_SET_MUTE:
+			m_mute = arg;
+		break;
+
+		case SCP_SET_POWER:
+			m_power = arg & 0x03;
+		break;
+
+		case SCP_SET_RESET:
+			// LIKE A REAL RADIO, NUMBER FRAMES AFRESH AFTER A RESET
+			m_power = 0u;
+			m_async = 0u;
+			m_seq = 0u;
+			async = { MSG_ASYNC, SCP_ASYNC_RESET };
+		break;
+
+		case SCP_SET_CHANNEL:
+			if (IsValidChannel(arg))
+			{
+				m_channel = arg;
+				AppendChannelInfo(resp, arg);
+				AppendSongInfo(resp, arg);
+				async = { MSG_ASYNC, SCP_ASYNC_STATUS, ST_TUNE, 0x00, arg };
+			}
+			else
+			{
+				resp[3] = 0x01;
+			}
+		break;
+
+		case SCP_SET_TZ_INFO:
+			if (len >= 5u)
+			{
+				m_tz_offset = static_cast<int16_t>((data[2] << 8) | data[3]);
+				m_tz_dst = data[4];
+			}
+		break;
+
+		case SCP_SET_ASYNC:
+			if (len >= 6u)
+			{
+				m_async = data[5];
+			}
+		break;
+
+		default:
+			resp[3] = 0x01;
+		break;
+	}
+
+	QueueFrame(resp);
+	if (!async.empty())
+	{
+		QueueFrame(async);
+	}
+}
+
+//!
+//! \brief Determine whether a channel is part of the emulated lineup.
+//!
+//! The lineup is channels 1-200, with every 13th channel missing so
+//! that the channel map has some holes in it.
+//!
+//========================================================================
+bool CRadioEmulator::IsValidChannel (SCP_CHANNEL_INDEX channel)
+{
+
+	return ((channel >= 1u) && (channel <= 200u) && ((channel % 13u) != 0u));
+}
+
+//========================================================================
+void CRadioEmulator::AppendPascalString (std::vector<uint8_t>& buf, const string& s)
+{
+	size_t len = std::min<size_t>(s.size(), 255u);
+
+	buf.push_back(static_cast<uint8_t>(len));
+	buf.insert(buf.end(), s.begin(), s.begin() + len);
+}
+
+//========================================================================
+void CRadioEmulator::AppendChannelInfo (std::vector<uint8_t>& buf, SCP_CHANNEL_INDEX channel)
+{
+	uint8_t genre = channel % 8u;
+	char tmp[32];
+
+	buf.push_back(channel);
+	buf.push_back(genre);
+	buf.push_back(0x00);
+	buf.push_back(0x00);
+	buf.push_back(0x00);
+	snprintf(tmp, sizeof(tmp), "CH%03u", static_cast<unsigned>(channel));
+	AppendPascalString(buf, tmp);
+	snprintf(tmp, sizeof(tmp), "Channel %u", static_cast<unsigned>(channel));
+	AppendPascalString(buf, tmp);
+	AppendPascalString(buf, s_genres[genre][1]);
+	AppendPascalString(buf, s_genres[genre][0]);
+}
+
+//========================================================================
+void CRadioEmulator::AppendSongInfo (std::vector<uint8_t>& buf, SCP_CHANNEL_INDEX channel)
+{
+	uint32_t song = m_song[channel];
+	uint32_t artist = (channel * 7u + song) % 500u;
+	char tmp[32];
+
+	buf.push_back(5u);	// NUMBER OF FIELDS
+
+	buf.push_back(SIT_ARTIST);
+	snprintf(tmp, sizeof(tmp), "Artist %u", artist);
+	AppendPascalString(buf, tmp);
+
+	buf.push_back(SIT_TITLE);
+	snprintf(tmp, sizeof(tmp), "Song %u-%u", static_cast<unsigned>(channel), song);
+	AppendPascalString(buf, tmp);
+
+	buf.push_back(SIT_COMPOSER);
+	snprintf(tmp, sizeof(tmp), "Composer %u", artist);
+	AppendPascalString(buf, tmp);
+
+	buf.push_back(SIT_SONGID);
+	snprintf(tmp, sizeof(tmp), "%02X%06X", static_cast<unsigned>(channel), song & 0xffffffu);
+	AppendPascalString(buf, tmp);
+
+	buf.push_back(SIT_ARTISTID);
+	snprintf(tmp, sizeof(tmp), "%04X", artist);
+	AppendPascalString(buf, tmp);
+}
+
+//!
+//! \brief Frame a payload and add it to the transmit queue.
+//!
+//! \param[in] payload The frame payload
+//!
+//========================================================================
+void CRadioEmulator::QueueFrame (const std::vector<uint8_t>& payload)
+{
+	TXFRAME f;
+	uint8_t sum = 0u;
+
+	assert(payload.size() <= SCP_MAX_DATA);
+
+	f.retries = 0u;
+	f.data = { PKT_SENTINEL, 0x03, 0x00, m_seq++, 0x00, static_cast<uint8_t>(payload.size()) };
+	f.data.insert(f.data.end(), payload.begin(), payload.end());
+	for (size_t i = 0u; i < f.data.size(); ++i)
+	{
+		sum += f.data[i];
+	}
+	f.data.push_back(static_cast<uint8_t>(~sum + 1));
+
+	m_txq.push_back(f);
+}
+
+//!
+//! \brief Send an acknowledgement frame to the host immediately.
+//!
+//! \param[in] seq Sequence number of the frame being acknowledged
+//! \param[in] flags Acknowledgement flags (SF_XXX)
+//!
+//========================================================================
+void CRadioEmulator::SendACK (uint8_t seq, uint8_t flags)
+{
+	uint8_t buf[sizeof(SHDR) + 1u] = { PKT_SENTINEL, 0x03, 0x00, seq, flags, 0x00, 0x00 };
+	uint8_t sum = 0u;
+
+	for (size_t i = 0u; i < sizeof(SHDR); ++i)
+	{
+		sum += buf[i];
+	}
+	buf[sizeof(SHDR)] = static_cast<uint8_t>(~sum + 1);
+
+	SendEscaped(buf, sizeof(buf), false);
+}
+
+//========================================================================
+void CRadioEmulator::SendRaw (const uint8_t* data, size_t len)
+{
+
+	if (len > m_outbuf.GetWriteLen())
+	{
+		m_stats.overflows += len;
+		return;
+	}
+	memcpy(m_outbuf.GetWritePtr(), data, len);
+	m_outbuf.MarkWritten(len);
+}
+
+//!
+//! \brief Escape a frame and append it to the output buffer.
+//!
+//! \param[in] data The frame, including header and checksum
+//! \param[in] len The length of the frame (bytes)
+//! \param[in] corrupt If true, the checksum byte is deliberately damaged
+//!
+//========================================================================
+void CRadioEmulator::SendEscaped (const uint8_t* data, size_t len, bool corrupt)
+{
+	uint8_t tmpbuf[2u * SCP_MAX_PKT];
+	size_t n = 0u;
+
+	for (size_t i = 0u; i < len; ++i)
+	{
+		uint8_t c = data[i];
+
+		if (corrupt && (i == len - 1u))
+		{
+			c ^= 0x5a;
+		}
+
+		if ((c == PKT_SENTINEL) && (i > 0u))
+		{
+			tmpbuf[n++] = ASCII_ESC;
+			tmpbuf[n++] = SENTINEL_ESC;
+		}
+		else if (c == ASCII_ESC)
+		{
+			tmpbuf[n++] = ASCII_ESC;
+			tmpbuf[n++] = ASCII_ESC;
+		}
+		else
+		{
+			tmpbuf[n++] = c;
+		}
+	}
+
+	SendRaw(tmpbuf, n);
+}
+
+//!
+//! \brief (Re)transmit the frame at the head of the transmit queue.
+//!
+//! \param[in] now The current time (ms)
+//!
+//========================================================================
+void CRadioEmulator::TransmitFront (uint64_t now)
+{
+	TXFRAME& f = m_txq.front();
+	bool corrupt = Chance(m_config.error_ratio);
+
+	if (!m_in_flight)
+	{
+		m_stats.tx_frames++;
+	}
+	if (corrupt)
+	{
+		m_stats.tx_corrupted++;
+	}
+
+	SendEscaped(f.data.data(), f.data.size(), corrupt);
+	m_in_flight = true;
+	m_tx_time = now + m_config.ack_timeout;
+}
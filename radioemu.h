@@ -0,0 +1,161 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _RADIOEMU_H_
+#define _RADIOEMU_H_
+
+//!
+//! \file radioemu.h
+//! \brief Declarations for the SiriusConnect radio emulator.
+//!
+//! The emulator is a transport-independent model of a SiriusConnect
+//! receiver. The host side of the link feeds it the raw bytes it
+//! receives via Input(), drains the bytes it wants to send via Output(),
+//! and calls Poll() periodically so that retransmissions and unsolicited
+//! metadata can be generated. All timekeeping is done with the
+//! millisecond clock values passed in by the caller, so the emulator
+//! runs equally well against a wall clock or a simulated one.
+//!
+
+#include <deque>
+#include <random>
+#include <vector>
+#include "scp.h"
+#include "sobuf.h"
+
+//! Emulator configuration
+struct SCEMU_CONFIG
+{
+	bool tts100;			//!< Require the TTS-100 'V'/'A' handshake before speaking SCP
+	bool meta_force;		//!< Generate metadata even if the host has not enabled it
+	uint32_t meta_rate;		//!< Unsolicited song info notifications per second
+	uint32_t ack_timeout;	//!< Time to wait for an ACK before retransmitting (ms)
+	double error_ratio;		//!< Fraction of outgoing frames sent with a bad checksum
+	double busy_ratio;		//!< Fraction of incoming frames answered with SF_BUSY
+	uint32_t seed;			//!< Seed for the random number generator
+
+	SCEMU_CONFIG() : tts100(false), meta_force(false), meta_rate(0u), ack_timeout(100u),
+		error_ratio(0.0), busy_ratio(0.0), seed(1u) {}
+};
+
+//! Emulator counters
+struct SCEMU_STATS
+{
+	uint64_t rx_bytes;			//!< Raw bytes received from the host
+	uint64_t rx_frames;			//!< Valid frames received from the host
+	uint64_t rx_chksum;			//!< Frames received with a bad checksum
+	uint64_t rx_dups;			//!< Retransmitted frames which were ACKed but not reprocessed
+	uint64_t rx_resync;			//!< Bytes discarded while hunting for a frame sentinel
+	uint64_t tx_frames;			//!< Frames sent to the host (first transmissions)
+	uint64_t tx_retries;		//!< Frames retransmitted to the host
+	uint64_t tx_drops;			//!< Frames abandoned after too many retries
+	uint64_t tx_corrupted;		//!< Frames deliberately sent with a bad checksum
+	uint64_t busy_naks;			//!< Frames deliberately answered with SF_BUSY
+	uint64_t meta_events;		//!< Unsolicited song info notifications generated
+	uint64_t overflows;			//!< Output bytes discarded because the host is not reading
+
+	SCEMU_STATS() : rx_bytes(0u), rx_frames(0u), rx_chksum(0u), rx_dups(0u), rx_resync(0u),
+		tx_frames(0u), tx_retries(0u), tx_drops(0u), tx_corrupted(0u), busy_naks(0u),
+		meta_events(0u), overflows(0u) {}
+};
+
+//!
+//! \brief An emulated SiriusConnect receiver.
+//!
+class CRadioEmulator
+{
+public:
+	CRadioEmulator (const SCEMU_CONFIG& config);
+
+	void Input (const uint8_t* data, size_t len, uint64_t now);
+	size_t Output (uint8_t* buf, size_t maxlen);
+	size_t GetOutputLen () { return m_outbuf.GetReadLen(); }
+	void Poll (uint64_t now);
+	uint32_t GetTimeToNextEvent (uint64_t now);
+	const SCEMU_STATS& GetStats () { return m_stats; }
+
+private:
+	CRadioEmulator ();
+
+	//! TTS-100 handshake state
+	enum TTSSTATE
+	{
+		TTS_LOCKED,			//!< Only 'V' and 'A' are understood
+		TTS_CHALLENGED,		//!< Waiting for the challenge response
+		TTS_UNLOCKED		//!< SCP traffic passes through to the radio
+	};
+
+	//! An outgoing frame (unescaped)
+	struct TXFRAME
+	{
+		std::vector<uint8_t> data;	//!< Header, payload and checksum
+		uint32_t retries;			//!< Number of retransmissions so far
+	};
+
+	SCEMU_CONFIG m_config;			//!< Emulator configuration
+	SCEMU_STATS m_stats;			//!< Emulator counters
+	std::mt19937 m_rng;				//!< Drives the fault and metadata generators
+	sr::SOBuffer m_inbuf;			//!< De-escaped bytes received from the host
+	sr::SOBuffer m_outbuf;			//!< Escaped bytes waiting to be sent to the host
+	bool m_inESC;					//!< True if the last byte received was an ESC
+
+	// TTS-100 EMULATION
+	TTSSTATE m_tts_state;			//!< Handshake state
+	uint8_t m_challenge[15];		//!< The last challenge sent to the host
+
+	// LINK STATE
+	uint8_t m_seq;					//!< Next outgoing frame sequence number
+	std::deque<uint8_t> m_recent;	//!< Recently processed host frame sequence numbers
+	std::deque<TXFRAME> m_txq;		//!< Frames waiting to be sent; the front one is in flight
+	bool m_in_flight;				//!< True if the front frame has been sent and not ACKed
+	uint64_t m_tx_time;				//!< Time at which the front frame is due to be (re)sent
+	uint64_t m_meta_time;			//!< Time at which the next metadata event is due
+
+	// RADIO STATE
+	uint8_t m_power;
+	int8_t m_gain;
+	uint8_t m_mute;
+	uint8_t m_async;
+	SCP_CHANNEL_INDEX m_channel;
+	int16_t m_tz_offset;
+	uint8_t m_tz_dst;
+	uint32_t m_song[SCP_MAX_CHANNELS];	//!< Per-channel song counter
+
+	bool Chance (double ratio);
+	void InputTTS (uint8_t c);
+	void ProcessFrames (uint64_t now);
+	void OnHostACK (uint8_t seq, uint8_t flags, uint64_t now);
+	void OnCommand (const uint8_t* data, uint32_t len);
+	void OnGet (const uint8_t* data, uint32_t len);
+	void OnSet (const uint8_t* data, uint32_t len);
+	bool IsValidChannel (SCP_CHANNEL_INDEX channel);
+	void AppendPascalString (std::vector<uint8_t>& buf, const string& s);
+	void AppendChannelInfo (std::vector<uint8_t>& buf, SCP_CHANNEL_INDEX channel);
+	void AppendSongInfo (std::vector<uint8_t>& buf, SCP_CHANNEL_INDEX channel);
+	void QueueFrame (const std::vector<uint8_t>& payload);
+	void SendACK (uint8_t seq, uint8_t flags);
+	void SendRaw (const uint8_t* data, size_t len);
+	void SendEscaped (const uint8_t* data, size_t len, bool corrupt);
+	void TransmitFront (uint64_t now);
+};
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file scemu.cpp
+//! \brief SiriusConnect radio emulator (UNIX only).
+//!
+//! Presents an emulated SiriusConnect receiver on a pseudo-terminal so
+//! that sircond can be exercised without real hardware. Point sircond
+//! at the slave device name printed at startup (or at the symlink
+//! given with -l).
+//!
+
+#include "pch.h"
+#include <poll.h>
+#include <termios.h>
+#include <algorithm>
+#include "radioemu.h"
+
+static volatile sig_atomic_t s_shutdown = 0;
+
+//========================================================================
+static void OnSignal (int sig)
+{
+
+	s_shutdown = 1;
+}
+
+//========================================================================
+static uint64_t NowMs ()
+{
+
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//========================================================================
+static void Usage (const char* prog)
+{
+
+	printf("Usage: %s [options]\n", prog);
+	printf("  -t          Emulate a TTS-100 interface ('V'/'A' handshake)\n");
+	printf("  -r <rate>   Song info notifications per second (default 0)\n");
+	printf("  -a          Generate notifications even if the host has not enabled them\n");
+	printf("  -e <ratio>  Fraction of outgoing frames sent with a bad checksum\n");
+	printf("  -y <ratio>  Fraction of incoming frames answered with SF_BUSY\n");
+	printf("  -d <baud>   Pace output at the given data rate (default unpaced)\n");
+	printf("  -s <seed>   Random number generator seed\n");
+	printf("  -l <path>   Create a symlink to the slave device at <path>\n");
+	printf("  -v          Log protocol activity to stdout\n");
+}
+
+//========================================================================
+static void PrintStats (const SCEMU_STATS& s, uint64_t elapsed)
+{
+	double secs = (elapsed > 0u) ? (elapsed / 1000.0) : 1.0;
+
+	printf("elapsed %.1fs\n", elapsed / 1000.0);
+	printf("rx: %llu bytes, %llu frames (%.1f/s), %llu bad checksum, %llu duplicate, %llu resync\n",
+		static_cast<unsigned long long>(s.rx_bytes),
+		static_cast<unsigned long long>(s.rx_frames),
+		s.rx_frames / secs,
+		static_cast<unsigned long long>(s.rx_chksum),
+		static_cast<unsigned long long>(s.rx_dups),
+		static_cast<unsigned long long>(s.rx_resync));
+	printf("tx: %llu frames (%.1f/s), %llu retries, %llu dropped, %llu corrupted, %llu busy\n",
+		static_cast<unsigned long long>(s.tx_frames),
+		s.tx_frames / secs,
+		static_cast<unsigned long long>(s.tx_retries),
+		static_cast<unsigned long long>(s.tx_drops),
+		static_cast<unsigned long long>(s.tx_corrupted),
+		static_cast<unsigned long long>(s.busy_naks));
+	printf("metadata: %llu notifications, %llu bytes overflowed\n",
+		static_cast<unsigned long long>(s.meta_events),
+		static_cast<unsigned long long>(s.overflows));
+}
+
+//========================================================================
+int main (int argc, char* argv[])
+{
+	SCEMU_CONFIG config;
+	uint32_t baud = 0u;
+	string link;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "tr:ae:y:d:s:l:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 't': config.tts100 = true; break;
+			case 'r': config.meta_rate = strtoul(optarg, 0, 10); break;
+			case 'a': config.meta_force = true; break;
+			case 'e': config.error_ratio = atof(optarg); break;
+			case 'y': config.busy_ratio = atof(optarg); break;
+			case 'd': baud = strtoul(optarg, 0, 10); break;
+			case 's': config.seed = strtoul(optarg, 0, 10); break;
+			case 'l': link = optarg; break;
+			case 'v':
+				LogSetLevel(EL_DEBUG);
+				LogOpen("/dev/stdout");
+			break;
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+
+	// CREATE THE PSEUDO-TERMINAL
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+	{
+		perror("posix_openpt");
+		return 1;
+	}
+	const char* slave_name = ptsname(master);
+
+	// HOLD THE SLAVE SIDE OPEN IN RAW MODE SO THAT THE HOST CAN COME AND
+	// GO WITHOUT THE MASTER SEEING A HANGUP
+	int slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if (slave < 0)
+	{
+		perror("open slave");
+		return 1;
+	}
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	if (!link.empty())
+	{
+		unlink(link.c_str());
+		if (symlink(slave_name, link.c_str()) != 0)
+		{
+			perror("symlink");
+			return 1;
+		}
+	}
+
+	printf("Emulated radio on %s%s%s\n", slave_name,
+		link.empty() ? "" : " -> ", link.c_str());
+	fflush(stdout);
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+
+	CRadioEmulator emu(config);
+	uint64_t start = NowMs();
+	uint64_t paced = start;		// TIME AT WHICH THE PACED OUTPUT WILL HAVE DRAINED
+	uint8_t buf[4096];
+	uint8_t pend[4096];			// OUTPUT WAITING FOR THE PTY TO ACCEPT IT
+	size_t pendlen = 0u;
+	size_t pendoff = 0u;
+
+	while (!s_shutdown)
+	{
+		uint64_t now = NowMs();
+		struct pollfd pfd;
+
+		pfd.fd = master;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		bool output = (pendlen > 0u) || (emu.GetOutputLen() > 0u);
+		if (output && (paced <= now))
+		{
+			pfd.events |= POLLOUT;
+		}
+
+		int timeout = static_cast<int>(emu.GetTimeToNextEvent(now));
+		if (output && (paced > now))
+		{
+			timeout = std::min<int>(timeout, static_cast<int>(paced - now));
+		}
+
+		if (poll(&pfd, 1, timeout) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		now = NowMs();
+		if (pfd.revents & POLLIN)
+		{
+			ssize_t n = read(master, buf, sizeof(buf));
+			if (n > 0)
+			{
+				emu.Input(buf, static_cast<size_t>(n), now);
+			}
+		}
+
+		emu.Poll(now);
+
+		if ((pendlen == 0u) && (paced <= now))
+		{
+			size_t maxlen = sizeof(pend);
+
+			if (baud > 0u)
+			{
+				// 10 BIT TIMES PER BYTE; SEND AT MOST 10MS WORTH AT A TIME
+				maxlen = std::max<size_t>(1u, baud / 1000u);
+			}
+			pendlen = emu.Output(pend, maxlen);
+			pendoff = 0u;
+		}
+
+		if (pendlen > 0u)
+		{
+			ssize_t n = write(master, pend + pendoff, pendlen);
+			if (n > 0)
+			{
+				pendoff += n;
+				pendlen -= n;
+				if (baud > 0u)
+				{
+					paced = now + (static_cast<uint64_t>(n) * 10000u) / baud;
+				}
+			}
+		}
+	}
+
+	PrintStats(emu.GetStats(), NowMs() - start);
+
+	if (!link.empty())
+	{
+		unlink(link.c_str());
+	}
+	close(slave);
+	close(master);
+	LogClose();
+	return 0;
+}
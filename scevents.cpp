@@ -21,6 +21,7 @@
 */
 
 #include "pch.h"
+#include <algorithm>
 #include "sircon.h"
 #include "scevents.h"
 
@@ -29,6 +30,73 @@
 //! \brief Implementation of SiriusConnect event classes.
 //!
 
+//!
+//! \brief Take a copy of the payload holding the text fields
+//!
+//! \param[in] data Pointer to the message data
+//! \param[in] len Length of the message data (anything past 
+//! SCP_MAX_DATA is ignored)
+//!
+//========================================================================
+void SCETEXT::Load (const uint8_t* data, size_t len)
+{
+
+	m_len = std::min(len, static_cast<size_t>(SCP_MAX_DATA));
+	memcpy(m_buf, data, m_len);
+}
+
+//!
+//! \brief Locate the Pascal string (length byte, then text) at an offset
+//!
+//! \param[in] offset Where the length byte is
+//! \param[out] ref The field; left empty if the string is truncated
+//!
+//! \retval size_t The number of octets taken by the string, or everything
+//! left if it runs past the end of the payload.
+//!
+//========================================================================
+size_t SCETEXT::Parse (size_t offset, SCETEXTREF& ref) const
+{
+
+	ref = SCETEXTREF();
+	if (offset >= m_len)
+	{
+		return 0u;
+	}
+
+	size_t len = m_buf[offset];
+	if ((offset + 1u + len) > m_len)
+	{
+		LogWrite(LEVEL_DEBUG, "Text field at offset %u overruns the payload", static_cast<unsigned>(offset));
+		return (m_len - offset);
+	}
+
+	ref.offset = static_cast<uint8_t>(offset + 1u);
+	ref.len = static_cast<uint8_t>(len);
+	return (len + 1u);
+}
+
+//!
+//! \brief Add text from elsewhere (e.g. a saved snapshot)
+//!
+//! \param[in] s The text; truncated if there isn't room for it all
+//!
+//! \retval SCETEXTREF The new field
+//!
+//========================================================================
+SCETEXTREF SCETEXT::Append (const string& s)
+{
+	SCETEXTREF ref;
+	size_t len = std::min(s.size(), SCP_MAX_DATA - m_len);
+
+	memcpy(m_buf + m_len, s.data(), len);
+	ref.offset = static_cast<uint8_t>(m_len);
+	ref.len = static_cast<uint8_t>(len);
+	m_len += len;
+
+	return ref;
+}
+
 //!
 //! \brief Parse the contents 
 //!
@@ -261,6 +329,10 @@ size_t SCESongInfo::deserialize(uint8_t* data, size_t len)
 		return 0;
 	}
 
+	// THE FIELDS STAY WHERE THEY ARE, IN A COPY OF THE PAYLOAD
+	text.Load(data, len);
+	len = std::min(len, static_cast<size_t>(SCP_MAX_DATA));
+
 	// GET THE NUMBER OF FIELDS
 	num_fields = data[offset++];
 
@@ -272,36 +344,39 @@ size_t SCESongInfo::deserialize(uint8_t* data, size_t len)
 		switch (tag)
 		{
 			case SIT_ARTIST:
-				offset += CopyPascalString(data + offset, artist);
+				offset += text.Parse(offset, artist);
 			break;
 
 			case SIT_TITLE:
-				offset += CopyPascalString(data + offset, title);
+				offset += text.Parse(offset, title);
 			break;
 
 			case SIT_ALBUM:
-				offset += CopyPascalString(data + offset, album);
+				offset += text.Parse(offset, album);
 			break;
 
 			case SIT_COMPOSER:
-				offset += CopyPascalString(data + offset, composer);
+				offset += text.Parse(offset, composer);
 			break;
 
 			case SIT_SONGID:
-				offset += CopyPascalString(data + offset, song_id);
+				offset += text.Parse(offset, song_id);
 			break;
 
 			case SIT_ARTISTID:
-				offset += CopyPascalString(data + offset, artist_id);
+				offset += text.Parse(offset, artist_id);
 			break;
 
 			case SIT_ERASE:
 			break;
 
 			default:
+			{
+				SCETEXTREF unknown;
+
 				LogWrite(LEVEL_DEBUG, "Unknown Song Info field tag %u", tag);
-				string tmpstr;
-				offset += CopyPascalString(data + offset, tmpstr);
+				offset += text.Parse(offset, unknown);
+			}
 			break;
 		}
 	}
@@ -322,23 +397,32 @@ size_t SCEChannelInfo::deserialize(uint8_t* data, size_t len)
 {
 	size_t offset = 0u;
 
+	// SANITY CHECK
+	if (len < 5u)
+	{
+		return len;
+	}
+
 	channel = data[offset++];
 	genre = data[offset++];
 
+	// THE NAMES STAY WHERE THEY ARE, IN A COPY OF THE PAYLOAD
+	text.Load(data, len);
+
 	// SKIP PAST THE UNKNOWN STUFF
 	offset = 5;
 
 	// PARSE SHORT CHANNEL NAME
-	offset += CopyPascalString(data + offset, sname);
+	offset += text.Parse(offset, sname);
 
 	// PARSE LONG CHANNEL NAME
-	offset += CopyPascalString(data + offset, lname);
+	offset += text.Parse(offset, lname);
 
 	// PARSE SHORT GENRE NAME
-	offset += CopyPascalString(data + offset, sgenre);
+	offset += text.Parse(offset, sgenre);
 
 	// PARSE LONG GENRE NAME
-	offset += CopyPascalString(data + offset, lgenre);
+	offset += text.Parse(offset, lgenre);
 
 	return offset;
 }
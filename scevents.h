@@ -28,44 +28,157 @@
 //! \brief Declarations for SiriusConnect event classes
 //!
 
+#include <cassert>
 #include <iostream>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include "scp.h"
 
+using std::string;
+
+//!
+//! \brief Dense identifiers for the SiriusConnect event classes
+//!
+//! Each event class carries its own ID, and an SCEvent holding it 
+//! reports it from eventid(), so that tables of subscribers can be 
+//! indexed by event type directly.
+//!
+enum SCEVENTID
+{
+	SCE_INVALID,		//!< An empty SCEvent
+	SCE_STARTUP,
+	SCE_DETACHED,
+	SCE_ATTACHED,
+	SCE_GETRESULT,
+	SCE_SETRESULT,
+	SCE_SIRIUSID,
+	SCE_GAIN,
+	SCE_MUTE,
+	SCE_SONGID,
+	SCE_SONGINFO,
+	SCE_CHANNEL,
+	SCE_TUNEACCEPTED,
+	SCE_CHANNELINFO,
+	SCE_CHANNELMAP,
+	SCE_STATUS,
+	SCE_RSSI,
+	SCE_SIGNAL,
+	SCE_ANTENNA,
+	SCE_RESET,
+	SCE_POWER,
+	SCE_TIMEZONEINFO,
+	SCE_TIME,
+	SCE_SHUTDOWN,
+	SCE_COUNT
+};
+
+//!
+//! \brief Where a text field sits within an SCETEXT
 //!
-//! \brief Event (virtual) base class.
+struct SCETEXTREF
+{
+	SCETEXTREF () : offset(0u), len(0u) {}
+	uint8_t offset;		//!< First character
+	uint8_t len;		//!< Number of characters
+};
+
 //!
-//! All SiriusConnect event classes are derived from this base class. 
-//! These objects are simple wrappers for the details of each event.
+//! \brief A view of a text field, valid while its SCETEXT is
 //!
-struct SCEvent
+struct SCETEXTVIEW
 {
-	virtual size_t deserialize(uint8_t* data, size_t len) { return 0u; };
-	friend std::ostream& operator<< (std::ostream& out, SCEvent e)
+	const char* data;
+	size_t len;
+
+	//! \brief Make an owned copy (for a consumer that keeps the text)
+	string str () const { return string(data, len); }
+	friend std::ostream& operator<< (std::ostream& out, const SCETEXTVIEW& v)
 	{
-		out << "INVALID";
+		out.write(v.data, v.len);
 		return out;
 	}
 };
 
+//!
+//! \brief The text fields of an event, held in place
+//!
+//! Decoding keeps a copy of the frame payload and records each Pascal
+//! string field as an SCETEXTREF into it, checked against the payload's
+//! length, rather than building a std::string per field. The copy has a
+//! fixed size, so an event holding one can be queued or cached by value
+//! without touching the heap; std::strings are only made (with str()) 
+//! by consumers which keep the text.
+//!
+class SCETEXT
+{
+public:
+	SCETEXT () : m_len(0u) {}
+
+	void Load (const uint8_t* data, size_t len);
+	size_t Parse (size_t offset, SCETEXTREF& ref) const;
+	SCETEXTREF Append (const string& s);
+
+	//! \brief Look up a field
+	SCETEXTVIEW operator[] (const SCETEXTREF& ref) const
+	{
+		SCETEXTVIEW v = { reinterpret_cast<const char*>(m_buf) + ref.offset, ref.len };
+		return v;
+	}
+
+private:
+	uint8_t m_buf[SCP_MAX_DATA];	//!< The fields (Pascal strings) and whatever surrounds them
+	size_t m_len;					//!< Octets of m_buf in use
+};
+
 //!
 //! \brief Startup event
 //!
-struct SCEStartup : public SCEvent
+struct SCEStartup
 {
-	friend std::ostream& operator<< (std::ostream& out, SCEStartup e)
+	static const SCEVENTID ID = SCE_STARTUP;
+	friend std::ostream& operator<< (std::ostream& out, const SCEStartup& e)
 	{
 		out << "STARTUP";
 		return out;
 	}
 };
 
+//!
+//! \brief The serial device has gone away (e.g. the adapter was unplugged)
+//!
+struct SCEDetached
+{
+	static const SCEVENTID ID = SCE_DETACHED;
+	friend std::ostream& operator<< (std::ostream& out, const SCEDetached& e)
+	{
+		out << "DETACHED";
+		return out;
+	}
+};
+
+//!
+//! \brief The serial device has come back and the interface is ready again
+//!
+struct SCEAttached
+{
+	static const SCEVENTID ID = SCE_ATTACHED;
+	friend std::ostream& operator<< (std::ostream& out, const SCEAttached& e)
+	{
+		out << "ATTACHED";
+		return out;
+	}
+};
+
 //!
 //! \brief Result code from a GET request
 //!
-struct SCEGetResult : public SCEvent
+struct SCEGetResult
 {
+	static const SCEVENTID ID = SCE_GETRESULT;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEGetResult e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEGetResult& e)
 	{
 		out << "GET," << static_cast<unsigned>(e.result);
 		return out;
@@ -76,15 +189,17 @@ struct SCEGetResult : public SCEvent
 //!
 //! \brief Result code from a SET request
 //!
-struct SCESetResult : public SCEvent
+struct SCESetResult
 {
+	static const SCEVENTID ID = SCE_SETRESULT;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCESetResult e)
+	friend std::ostream& operator<< (std::ostream& out, const SCESetResult& e)
 	{
 		out << "SET," << static_cast<unsigned>(e.result);
 		return out;
 	}
 	uint16_t result;
+	uint8_t id;			//!< The SET request (SCP_SET_XXX) being answered
 };
 
 //!
@@ -95,10 +210,11 @@ struct SCESetResult : public SCEvent
 //! for subscription purposes. This event contains the attached 
 //! radio's SID string.
 //!
-struct SCESiriusID : public SCEvent
+struct SCESiriusID
 {
+	static const SCEVENTID ID = SCE_SIRIUSID;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCESiriusID e)
+	friend std::ostream& operator<< (std::ostream& out, const SCESiriusID& e)
 	{
 		out << "SID," << e.sid;
 		return out;
@@ -109,10 +225,11 @@ struct SCESiriusID : public SCEvent
 //!
 //! \brief Gain value
 //!
-struct SCEGain : public SCEvent
+struct SCEGain
 {
+	static const SCEVENTID ID = SCE_GAIN;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEGain e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEGain& e)
 	{
 		out << "GAIN," << static_cast<int>(e.gain);
 		return out;
@@ -123,10 +240,11 @@ struct SCEGain : public SCEvent
 //!
 //! \brief Mute value
 //!
-struct SCEMute : public SCEvent
+struct SCEMute
 {
+	static const SCEVENTID ID = SCE_MUTE;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEMute e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEMute& e)
 	{
 		out << "MUTE," << static_cast<unsigned>(e.mute);
 		return out;
@@ -141,10 +259,11 @@ struct SCEMute : public SCEvent
 //! their service. This identifier consists of a short string of
 //! printable ASCII characters.
 //!
-struct SCESongID : public SCEvent
+struct SCESongID
 {
+	static const SCEVENTID ID = SCE_SONGID;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCESongID e)
+	friend std::ostream& operator<< (std::ostream& out, const SCESongID& e)
 	{
 		out << "SONGID," << "\"" << e.songid << "\"";
 		return out;
@@ -155,27 +274,29 @@ struct SCESongID : public SCEvent
 //!
 //! \brief Song info
 //!
-struct SCESongInfo : public SCEvent
+struct SCESongInfo
 {
+	static const SCEVENTID ID = SCE_SONGINFO;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCESongInfo e)
+	friend std::ostream& operator<< (std::ostream& out, const SCESongInfo& e)
 	{
 		out << "SONGINFO,";
 		out << static_cast<unsigned>(e.channel) << ",";
-		out << "\"" << e.song_id << "\",";
-		out << "\"" << e.artist_id << "\",";
-		out << "\"" << e.title << "\",";
-		out << "\"" << e.artist << "\",";
-		out << "\"" << e.composer << "\"";
+		out << "\"" << e.text[e.song_id] << "\",";
+		out << "\"" << e.text[e.artist_id] << "\",";
+		out << "\"" << e.text[e.title] << "\",";
+		out << "\"" << e.text[e.artist] << "\",";
+		out << "\"" << e.text[e.composer] << "\"";
 		return out;
 	}
 	SCP_CHANNEL_INDEX channel;	//!< The channel where this song is playing
-	string title;				//!< Song title
-	string artist;				//!< Artist's name
-	string album;				//!< Album name
-	string composer;			//!< Composer's name 
-	string song_id;				//!< Sirius song ID string
-	string artist_id;			//!< Sirius artist ID string
+	SCETEXT text;				//!< Holds the fields below
+	SCETEXTREF title;			//!< Song title
+	SCETEXTREF artist;			//!< Artist's name
+	SCETEXTREF album;			//!< Album name
+	SCETEXTREF composer;		//!< Composer's name 
+	SCETEXTREF song_id;			//!< Sirius song ID string
+	SCETEXTREF artist_id;		//!< Sirius artist ID string
 };
 
 //!
@@ -184,10 +305,11 @@ struct SCESongInfo : public SCEvent
 //! This event indicates the channel to which the radio is currently
 //! tuned.
 //!
-struct SCEChannel : public SCEvent
+struct SCEChannel
 {
+	static const SCEVENTID ID = SCE_CHANNEL;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEChannel e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEChannel& e)
 	{
 		out << "CHANNEL," << static_cast<unsigned>(e.channel);
 		return out;
@@ -195,29 +317,49 @@ struct SCEChannel : public SCEvent
 	SCP_CHANNEL_INDEX channel;
 };
 
+//!
+//! \brief Tune request accepted
+//!
+//! This event indicates that the radio has acknowledged a SET CHANNEL
+//! request. The tune itself has not necessarily completed; that is 
+//! confirmed later by the SET response or a tune status notification.
+//!
+struct SCETuneAccepted
+{
+	static const SCEVENTID ID = SCE_TUNEACCEPTED;
+	friend std::ostream& operator<< (std::ostream& out, const SCETuneAccepted& e)
+	{
+		out << "TUNING," << static_cast<unsigned>(e.channel);
+		return out;
+	}
+	SCP_CHANNEL_INDEX channel;	//!< The channel being tuned
+};
+
 //!
 //! \brief Info for a channel
 //!
-struct SCEChannelInfo : public SCEvent
+struct SCEChannelInfo
 {
+	static const SCEVENTID ID = SCE_CHANNELINFO;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEChannelInfo e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEChannelInfo& e)
 	{
 		out << "CHANNELINFO,";
 		out << static_cast<unsigned>(e.channel) << ",";
 		out << static_cast<unsigned>(e.genre) << ",";
-		out << "\"" << e.lname << "\",";
-		out << "\"" << e.sname << "\",";
-		out << "\"" << e.lgenre << "\",";
-		out << "\"" << e.sgenre << "\"";
+		out << "\"" << e.text[e.lname] << "\",";
+		out << "\"" << e.text[e.sname] << "\",";
+		out << "\"" << e.text[e.lgenre] << "\",";
+		out << "\"" << e.text[e.sgenre] << "\"";
 		return out;
 	}
 	SCP_CHANNEL_INDEX channel;	//!< Sirius channel number
 	uint8_t genre;				//!< Sirius genre code
-	string sname;				//!< Short channel name
-	string lname;				//!< Long channel name
-	string sgenre;				//!< Short genre name
-	string lgenre;				//!< Long genre name
+	SCETEXT text;				//!< Holds the fields below
+	SCETEXTREF sname;			//!< Short channel name
+	SCETEXTREF lname;			//!< Long channel name
+	SCETEXTREF sgenre;			//!< Short genre name
+	SCETEXTREF lgenre;			//!< Long genre name
 };
 
 //!
@@ -231,10 +373,11 @@ struct SCEChannelInfo : public SCEvent
 //! to Sirius channel 223, and the least significant bit of the last byte 
 //! corresponds to Sirius channel 0.
 //!
-struct SCEChannelMap : public SCEvent
+struct SCEChannelMap
 {
+	static const SCEVENTID ID = SCE_CHANNELMAP;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEChannelMap e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEChannelMap& e)
 	{
 		out << "CHANNELMAP";
 		return out;
@@ -245,10 +388,11 @@ struct SCEChannelMap : public SCEvent
 //!
 //! \brief Status
 //!
-struct SCEStatus : public SCEvent
+struct SCEStatus
 {
+	static const SCEVENTID ID = SCE_STATUS;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEStatus e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEStatus& e)
 	{
 		out << "STATUS,";
 		out << static_cast<unsigned>(e.type) << ",";
@@ -264,10 +408,11 @@ struct SCEStatus : public SCEvent
 //!
 //! \brief RSSI event
 //!
-struct SCERSSI : public SCEvent
+struct SCERSSI
 {
+	static const SCEVENTID ID = SCE_RSSI;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCERSSI e)
+	friend std::ostream& operator<< (std::ostream& out, const SCERSSI& e)
 	{
 		out << "RSSI,";
 		out << static_cast<unsigned>(e.composite) << ",";
@@ -283,10 +428,11 @@ struct SCERSSI : public SCEvent
 //!
 //! \brief Signal acquired/lost event
 //!
-struct SCESignal : public SCEvent
+struct SCESignal
 {
+	static const SCEVENTID ID = SCE_SIGNAL;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCESignal e)
+	friend std::ostream& operator<< (std::ostream& out, const SCESignal& e)
 	{
 		out << "SIGNAL," << static_cast<unsigned>(e.signal);
 		return out;
@@ -297,10 +443,11 @@ struct SCESignal : public SCEvent
 //!
 //! \brief Antenna connected/disconnected event
 //!
-struct SCEAntenna : public SCEvent
+struct SCEAntenna
 {
+	static const SCEVENTID ID = SCE_ANTENNA;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEAntenna e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEAntenna& e)
 	{
 		out << "ANTENNA," << static_cast<unsigned>(e.antenna);
 		return out;
@@ -311,9 +458,10 @@ struct SCEAntenna : public SCEvent
 //!
 //! \brief Reset event
 //!
-struct SCEReset : public SCEvent
+struct SCEReset
 {
-	friend std::ostream& operator<< (std::ostream& out, SCEReset e)
+	static const SCEVENTID ID = SCE_RESET;
+	friend std::ostream& operator<< (std::ostream& out, const SCEReset& e)
 	{
 		out << "RESET";
 		return out;
@@ -323,10 +471,11 @@ struct SCEReset : public SCEvent
 //!
 //! \brief Current power setting
 //!
-struct SCEPower : public SCEvent
+struct SCEPower
 {
+	static const SCEVENTID ID = SCE_POWER;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCEPower e)
+	friend std::ostream& operator<< (std::ostream& out, const SCEPower& e)
 	{
 		out << "POWER," << static_cast<unsigned>(e.power);
 		return out;
@@ -337,10 +486,11 @@ struct SCEPower : public SCEvent
 //!
 //! \brief Time Zone settings
 //!
-struct SCETimeZoneInfo : public SCEvent
+struct SCETimeZoneInfo
 {
+	static const SCEVENTID ID = SCE_TIMEZONEINFO;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCETimeZoneInfo e)
+	friend std::ostream& operator<< (std::ostream& out, const SCETimeZoneInfo& e)
 	{
 
 		out << "TZINFO," << static_cast<int>(e.offset) << "," << static_cast<unsigned>(e.dst);
@@ -353,10 +503,11 @@ struct SCETimeZoneInfo : public SCEvent
 //!
 //! \brief Time event
 //!
-struct SCETime : public SCEvent
+struct SCETime
 {
+	static const SCEVENTID ID = SCE_TIME;
 	size_t deserialize(uint8_t* data, size_t len);
-	friend std::ostream& operator<< (std::ostream& out, SCETime e)
+	friend std::ostream& operator<< (std::ostream& out, const SCETime& e)
 	{
 		out << "TIME,";
 		out << static_cast<unsigned>(e.year) << ",";
@@ -382,13 +533,185 @@ struct SCETime : public SCEvent
 //!
 //! \brief Shutdown event
 //!
-struct SCEShutdown : public SCEvent
+struct SCEShutdown
 {
-	friend std::ostream& operator<< (std::ostream& out, SCEShutdown e)
+	static const SCEVENTID ID = SCE_SHUTDOWN;
+	friend std::ostream& operator<< (std::ostream& out, const SCEShutdown& e)
 	{
 		out << "SHUTDOWN";
 		return out;
 	}
 };
 
+//!
+//! \brief Every event class, with its identifier
+//!
+//! Expands X(id, type) once for each; used to generate the dispatch 
+//! switch in SCEvent::visit().
+//!
+#define SCE_EVENT_TYPES(X) \
+	X(SCE_STARTUP, SCEStartup) \
+	X(SCE_DETACHED, SCEDetached) \
+	X(SCE_ATTACHED, SCEAttached) \
+	X(SCE_GETRESULT, SCEGetResult) \
+	X(SCE_SETRESULT, SCESetResult) \
+	X(SCE_SIRIUSID, SCESiriusID) \
+	X(SCE_GAIN, SCEGain) \
+	X(SCE_MUTE, SCEMute) \
+	X(SCE_SONGID, SCESongID) \
+	X(SCE_SONGINFO, SCESongInfo) \
+	X(SCE_CHANNEL, SCEChannel) \
+	X(SCE_TUNEACCEPTED, SCETuneAccepted) \
+	X(SCE_CHANNELINFO, SCEChannelInfo) \
+	X(SCE_CHANNELMAP, SCEChannelMap) \
+	X(SCE_STATUS, SCEStatus) \
+	X(SCE_RSSI, SCERSSI) \
+	X(SCE_SIGNAL, SCESignal) \
+	X(SCE_ANTENNA, SCEAntenna) \
+	X(SCE_RESET, SCEReset) \
+	X(SCE_POWER, SCEPower) \
+	X(SCE_TIMEZONEINFO, SCETimeZoneInfo) \
+	X(SCE_TIME, SCETime) \
+	X(SCE_SHUTDOWN, SCEShutdown)
+
+//!
+//! \brief Any one SiriusConnect event
+//!
+//! A tagged union over the closed set of event classes above. The event
+//! is held in place (there is no heap allocation), so SCEvents can be 
+//! built on the stack and queued by value. Handlers reach the event 
+//! either through get<>() after checking eventid(), or through visit(),
+//! which calls a visitor's operator() with the concrete type.
+//!
+class SCEvent
+{
+public:
+	static const size_t TYPE_COUNT = SCE_COUNT;	//!< The number of distinct eventid() values
+
+	SCEvent () : m_id(SCE_INVALID) {}
+	SCEvent (const SCEvent& e) : m_id(SCE_INVALID) { e.visit(COPY(*this)); }
+	SCEvent (SCEvent&& e) : m_id(SCE_INVALID) { e.visit(MOVE(*this)); }
+	~SCEvent () { clear(); }
+
+	SCEvent& operator= (const SCEvent& e)
+	{
+		if (this != &e)
+		{
+			clear();
+			e.visit(COPY(*this));
+		}
+		return *this;
+	}
+
+	SCEvent& operator= (SCEvent&& e)
+	{
+		if (this != &e)
+		{
+			clear();
+			e.visit(MOVE(*this));
+		}
+		return *this;
+	}
+
+	//! \brief Identify the event held (SCE_INVALID if none)
+	SCEVENTID eventid () const { return m_id; }
+
+	//! \brief Replace the event held with a new E built from args
+	template <typename E, typename... A> E& emplace (A&&... args)
+	{
+		clear();
+		new (&m_storage) E(std::forward<A>(args)...);
+		m_id = E::ID;
+		return get<E>();
+	}
+
+	//! \brief Access the event held, which must be an E
+	template <typename E> E& get ()
+	{
+		assert(m_id == E::ID);
+		return *static_cast<E*>(static_cast<void*>(&m_storage));
+	}
+
+	template <typename E> const E& get () const
+	{
+		assert(m_id == E::ID);
+		return *static_cast<const E*>(static_cast<const void*>(&m_storage));
+	}
+
+	//! \brief Call v(event) with the concrete type; does nothing if empty
+	template <typename V> void visit (V&& v)
+	{
+		switch (m_id)
+		{
+#define SCE_VISIT_CASE(id, type) case id: v(get<type>()); break;
+			SCE_EVENT_TYPES(SCE_VISIT_CASE)
+#undef SCE_VISIT_CASE
+			default:
+			break;
+		}
+	}
+
+	template <typename V> void visit (V&& v) const
+	{
+		switch (m_id)
+		{
+#define SCE_VISIT_CASE(id, type) case id: v(get<type>()); break;
+			SCE_EVENT_TYPES(SCE_VISIT_CASE)
+#undef SCE_VISIT_CASE
+			default:
+			break;
+		}
+	}
+
+	//! \brief Destroy the event held, leaving this SCEvent empty
+	void clear ()
+	{
+		visit(DESTROY());
+		m_id = SCE_INVALID;
+	}
+
+	friend std::ostream& operator<< (std::ostream& out, const SCEvent& e)
+	{
+		if (e.m_id == SCE_INVALID)
+		{
+			out << "INVALID";
+		}
+		e.visit(PRINT(out));
+		return out;
+	}
+
+private:
+	struct COPY
+	{
+		explicit COPY (SCEvent& dest) : dest(dest) {}
+		template <typename E> void operator() (const E& e) { dest.emplace<E>(e); }
+		SCEvent& dest;
+	};
+
+	struct MOVE
+	{
+		explicit MOVE (SCEvent& dest) : dest(dest) {}
+		template <typename E> void operator() (E& e) { dest.emplace<E>(std::move(e)); }
+		SCEvent& dest;
+	};
+
+	struct DESTROY
+	{
+		template <typename E> void operator() (E& e) { e.~E(); }
+	};
+
+	struct PRINT
+	{
+		explicit PRINT (std::ostream& out) : out(out) {}
+		template <typename E> void operator() (const E& e) { out << e; }
+		std::ostream& out;
+	};
+
+	SCEVENTID m_id;
+	//! Room for any one of SCE_EVENT_TYPES (each expands to ", type")
+#define SCE_STORAGE_TYPE(id, type) , type
+	std::aligned_union<0 SCE_EVENT_TYPES(SCE_STORAGE_TYPE)>::type m_storage;
+#undef SCE_STORAGE_TYPE
+};
+
 #endif
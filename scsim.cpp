@@ -0,0 +1,375 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file scsim.cpp
+//! \brief Faster-than-real-time simulation of the daemon (UNIX only).
+//!
+//! Runs a complete CSirServer in-process against emulated radios (sim:
+//! devices), with every timer, link timeout and emulator event driven 
+//! by a virtual clock. A script of timed commands is played through a 
+//! client connection and the replies are printed with the virtual time
+//! at which they arrived, so that hours of link behaviour (keepalives,
+//! retransmissions, refreshes) can be examined in seconds.
+//!
+//! Each script line has the form "<seconds> <command>", e.g.
+//!
+//!     0 GET CHANNEL
+//!     600 CONTROL ACQUIRE
+//!     601 SET CHANNEL 20
+//!
+//! Blank lines and lines starting with '#' are ignored.
+//!
+
+#include "pch.h"
+#include <poll.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "clock.h"
+#include "sirserver.h"
+
+//! A command to be sent at a given (virtual) time
+struct SIMCMD
+{
+	uint64_t at;		//!< Milliseconds after startup
+	string command;
+};
+
+static const uint32_t SCSIM_STEP = 100u;		//!< Clock step while idle (ms)
+static const uint32_t SCSIM_REPLY_WAIT = 20u;	//!< Real time allowed for a reply before the clock moves on (ms)
+static const uint32_t SCSIM_REPLY_LIMIT = 30000u;	//!< Virtual time allowed for a reply (ms)
+static const uint32_t SCSIM_QUIET_STEPS = 5u;	//!< Quiet steps which end a reply
+
+//========================================================================
+static void Usage (const char* prog)
+{
+
+	printf("Usage: %s [options] [<script>]\n", prog);
+	printf("  -n <radios>  Number of emulated radios (default 1)\n");
+	printf("  -T <secs>    Virtual time to run for after the last command (default 3600)\n");
+	printf("  -P <port>    Port for the client connection (default 6115)\n");
+	printf("  -S <ms>      Real time to let threads settle before each step (default 100)\n");
+	printf("  -c <file>    Probe cache, as for sircond (default none)\n");
+	printf("  -t           Emulate a TTS-100 interface\n");
+	printf("  -r <rate>    Song info notifications per second\n");
+	printf("  -a           Generate notifications even if the host has not enabled them\n");
+	printf("  -e <ratio>   Fraction of radio frames sent with a bad checksum\n");
+	printf("  -y <ratio>   Fraction of host frames answered with SF_BUSY\n");
+	printf("  -s <seed>    Random number generator seed (radio n uses seed + n)\n");
+	printf("  -v           Log daemon activity to stdout\n");
+}
+
+//!
+//! \brief Print any complete lines received from the server
+//!
+//! \param[in] sock The client socket.
+//! \param[in,out] partial Data received after the last newline.
+//! \param[in] elapsed Virtual time since startup (ms), for the timestamps.
+//! \param[in] wait Real time to wait for data (ms).
+//!
+//! \retval bool Returns true if anything was received.
+//!
+//========================================================================
+static bool Drain (int sock, string& partial, uint64_t elapsed, uint32_t wait)
+{
+	bool received = false;
+	struct pollfd pfd;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	while (poll(&pfd, 1, static_cast<int>(wait)) > 0)
+	{
+		char buf[4096];
+		ssize_t n = recv(sock, buf, sizeof(buf), 0);
+		if (n <= 0)
+		{
+			break;
+		}
+		partial.append(buf, static_cast<size_t>(n));
+		received = true;
+
+		size_t eol;
+		while ((eol = partial.find('\n')) != string::npos)
+		{
+			string line = partial.substr(0u, eol);
+			partial.erase(0u, eol + 1u);
+			printf("%10.3f  %s\n", elapsed / 1000.0, line.c_str());
+		}
+
+		// ONLY WAIT FOR THE START OF A REPLY
+		wait = 0u;
+	}
+
+	fflush(stdout);
+	return received;
+}
+
+//!
+//! \brief Send a command and print the reply
+//!
+//! The server's thread runs in real time, so it is given a (real) moment
+//! to pick the command up and answer before the clock moves on. Replies
+//! which need no timeouts therefore arrive at the virtual time the 
+//! command was sent. After that the clock runs until the server has 
+//! been quiet for a while.
+//!
+//========================================================================
+static bool Command (int sock, string& partial, sr::CVirtualClock& clock, 
+	const std::function<uint64_t()>& elapsed, const string& command)
+{
+	string line = command + "\n";
+
+	printf("%10.3f> %s\n", elapsed() / 1000.0, command.c_str());
+	if (send(sock, line.data(), line.size(), 0) != static_cast<ssize_t>(line.size()))
+	{
+		perror("send");
+		return false;
+	}
+
+	uint64_t sent = elapsed();
+	uint32_t quiet = 0u;
+	bool replied = false;
+	while ((elapsed() - sent) < SCSIM_REPLY_LIMIT)
+	{
+		if (Drain(sock, partial, elapsed(), SCSIM_REPLY_WAIT))
+		{
+			replied = true;
+			quiet = 0u;
+			continue;
+		}
+		if (replied && (++quiet >= SCSIM_QUIET_STEPS))
+		{
+			break;
+		}
+		clock.Advance(std::chrono::milliseconds(SCSIM_STEP));
+	}
+	return true;
+}
+
+//!
+//! \brief Read a command script
+//!
+//========================================================================
+static bool LoadScript (const char* path, std::vector<SIMCMD>& script)
+{
+	ifstream in(path);
+	string line;
+
+	if (!in)
+	{
+		return false;
+	}
+	while (std::getline(in, line))
+	{
+		std::istringstream ss(line);
+		double secs;
+		SIMCMD c;
+
+		if (line.empty() || (line[0] == '#'))
+		{
+			continue;
+		}
+		if (!(ss >> secs) || (secs < 0.0))
+		{
+			return false;
+		}
+		std::getline(ss >> std::ws, c.command);
+		c.at = static_cast<uint64_t>(secs * 1000.0);
+		script.push_back(c);
+	}
+
+	std::stable_sort(script.begin(), script.end(), 
+		[](const SIMCMD& a, const SIMCMD& b) { return (a.at < b.at); });
+	return true;
+}
+
+//========================================================================
+int main (int argc, char* argv[])
+{
+	uint32_t radios = 1u;
+	uint32_t duration = 3600u;
+	uint32_t port = 6115u;
+	uint32_t settle = 100u;
+	uint32_t seed = 1u;
+	string options;
+	string probefile;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:T:P:S:c:tr:ae:y:s:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': radios = strtoul(optarg, 0, 10); break;
+			case 'T': duration = strtoul(optarg, 0, 10); break;
+			case 'P': port = strtoul(optarg, 0, 10); break;
+			case 'S': settle = strtoul(optarg, 0, 10); break;
+			case 'c': probefile = optarg; break;
+			case 't': options += ",tts"; break;
+			case 'r': options += string(",rate=") + optarg; break;
+			case 'a': options += ",force"; break;
+			case 'e': options += string(",error=") + optarg; break;
+			case 'y': options += string(",busy=") + optarg; break;
+			case 's': seed = strtoul(optarg, 0, 10); break;
+			case 'v':
+				LogSetLevel(EL_DEBUG);
+				LogOpen("/dev/stdout");
+			break;
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+
+	std::vector<SIMCMD> script;
+	if ((optind < argc) && !LoadScript(argv[optind], script))
+	{
+		printf("Cannot read script %s\n", argv[optind]);
+		return 1;
+	}
+	if ((radios < 1u) || (port == 0u) || (port > 0xffffu))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// THE DAEMON'S SIGNAL HANDLING IS NOT IN PLAY. KEEP A DROPPED CLIENT,
+	// OR THE SIGTERM RAISED WHEN THE SERVER EXITS, FROM KILLING US.
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGTERM, SIG_IGN);
+
+	// BUILD THE DAEMON AROUND A VIRTUAL CLOCK
+	vector<string> devices;
+	for (uint32_t i = 0u; i < radios; ++i)
+	{
+		devices.push_back("sim:seed=" + std::to_string(seed + i) + options);
+	}
+	sr::CVirtualClock clock;
+	clock.SetSettleTimeout(settle);
+	CSirServer server(devices);
+	server.SetClock(&clock);
+	server.SetPort(static_cast<uint16_t>(port));
+	std::unique_ptr<CProbeCache> probe_cache(probefile.empty() ? 0 : new CProbeCache(probefile));
+	server.SetProbeCache(probe_cache.get());
+
+	std::chrono::steady_clock::time_point real_start = std::chrono::steady_clock::now();
+	sr::CLOCKTIME start = clock.Now();
+	std::function<uint64_t()> Elapsed = [&]() -> uint64_t
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock.Now() - start).count());
+	};
+
+	// STARTUP (e.g. TTS-100 DETECTION) TAKES VIRTUAL TIME TOO. THREADS ARE
+	// STILL BEING CREATED, SO ONLY STEP TO DEADLINES SOMEONE IS WAITING FOR.
+	// THE SERVER TAKES CLIENTS BEFORE THE RADIOS ARE READY, BUT THE SCRIPT
+	// STARTS ONCE THEY ARE.
+	if (!server.Start())
+	{
+		printf("Failed to start the server\n");
+		return 1;
+	}
+	while ((server.GetState() == CSirServer::STARTING) || 
+		((server.GetState() == CSirServer::RUNNING) && server.IsInitializing()))
+	{
+		sr::CLOCKTIME next;
+		clock.WaitForIdle(settle);
+		if (clock.GetNextDeadline(next))
+		{
+			clock.Advance(std::chrono::duration_cast<std::chrono::milliseconds>(next - clock.Now()) + std::chrono::milliseconds(1));
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	if (server.GetState() != CSirServer::RUNNING)
+	{
+		printf("Server failed to initialize\n");
+		server.Stop();
+		return 1;
+	}
+	printf("%10.3f  (started)\n", Elapsed() / 1000.0);
+
+	// CONNECT AS A CLIENT
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<uint16_t>(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((sock < 0) || (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0))
+	{
+		perror("connect");
+		server.Stop();
+		return 1;
+	}
+
+	// PLAY THE SCRIPT. AFTER EACH COMMAND THE CLOCK ONLY MOVES ONCE THE 
+	// SERVER HAS HAD A (REAL) MOMENT TO ANSWER, SO REPLIES WHICH NEED NO
+	// TIMEOUTS ARRIVE AT THE VIRTUAL TIME THE COMMAND WAS SENT.
+	string partial;
+	for (size_t i = 0u; i < script.size(); ++i)
+	{
+		while (Elapsed() < script[i].at)
+		{
+			clock.Advance(std::chrono::milliseconds(std::min<uint64_t>(SCSIM_STEP * 10u, script[i].at - Elapsed())));
+			Drain(sock, partial, Elapsed(), 0u);
+		}
+
+		if (!Command(sock, partial, clock, Elapsed, script[i].command))
+		{
+			break;
+		}
+	}
+
+	// LET THE LINK RUN UNATTENDED, REPORTING ANY NOTIFICATIONS
+	uint64_t end = Elapsed() + (static_cast<uint64_t>(duration) * 1000u);
+	while (Elapsed() < end)
+	{
+		clock.Advance(std::chrono::milliseconds(std::min<uint64_t>(SCSIM_STEP * 10u, end - Elapsed())));
+		Drain(sock, partial, Elapsed(), 0u);
+	}
+
+	// FINISH WITH THE LINK COUNTERS
+	Command(sock, partial, clock, Elapsed, "GET LINKSTATS");
+	closesocket(sock);
+
+	// SHUTDOWN MAY ALSO BE WAITING ON VIRTUAL TIMEOUTS
+	std::atomic<bool> stopped(false);
+	std::thread stopper([&]() { server.Stop(); stopped = true; });
+	while (!stopped)
+	{
+		clock.Advance(std::chrono::milliseconds(SCSIM_STEP));
+	}
+	stopper.join();
+
+	double real = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - real_start).count() / 1000.0;
+	double virt = Elapsed() / 1000.0;
+	printf("simulated %.1fs in %.1fs (%.0fx)\n", virt, real, (real > 0.0) ? (virt / real) : 0.0);
+
+	LogClose();
+	return 0;
+}
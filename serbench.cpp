@@ -0,0 +1,287 @@
+/*
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//!
+//! \file serbench.cpp
+//! \brief Serial receive latency benchmark (UNIX only).
+//!
+//! Measures how long received data takes to reach the application 
+//! under each of the serial port's latency and read batching settings.
+//! Frames are written either to the master side of a pseudo-terminal 
+//! (the default), to a local socket standing in for a TCP serial server
+//! (-t), or, with -d, to a real port whose TX and RX lines are looped 
+//! back, and read back through the same CSerialPort code that sircond 
+//! uses.
+//!
+
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "serial.h"
+
+//! A port configuration to be measured
+struct BENCHSETTING
+{
+	const char* name;
+	bool low_latency;
+	uint8_t vmin;
+	uint8_t vtime;
+};
+
+static const BENCHSETTING s_settings[] =
+{
+	{ "default",         false, 1u,  0u },
+	{ "lowlat",          true,  1u,  0u },
+	{ "batch16",         false, 16u, 1u },
+	{ "batch64",         false, 64u, 1u },
+	{ "lowlat+batch16",  true,  16u, 1u },
+	{ "lowlat+batch64",  true,  64u, 1u }
+};
+
+//========================================================================
+static uint64_t NowUs ()
+{
+
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//========================================================================
+static void Usage (const char* prog)
+{
+
+	printf("Usage: %s [options]\n", prog);
+	printf("  -d <device>  Loopback serial device (default: a pseudo-terminal)\n");
+	printf("  -t           Measure the network backend against a local TCP server\n");
+	printf("  -r <baud>    Data rate (default 57600)\n");
+	printf("  -n <frames>  Frames per setting (default 100)\n");
+	printf("  -s <bytes>   Frame size (default 64)\n");
+	printf("  -i <ms>      Interval between frames (default 20)\n");
+}
+
+//========================================================================
+int main (int argc, char* argv[])
+{
+	string device;
+	uint32_t baud = 57600u;
+	uint32_t frames = 100u;
+	uint32_t size = 64u;
+	uint32_t interval = 20u;
+	bool tcp = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:tr:n:s:i:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': device = optarg; break;
+			case 't': tcp = true; break;
+			case 'r': baud = strtoul(optarg, 0, 10); break;
+			case 'n': frames = strtoul(optarg, 0, 10); break;
+			case 's': size = strtoul(optarg, 0, 10); break;
+			case 'i': interval = strtoul(optarg, 0, 10); break;
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+	if ((frames == 0u) || (size == 0u) || (size > 4096u))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// WITH -t, WRITE TO THE SERVER SIDE OF A LOCAL TCP CONNECTION
+	int master = -1;
+	int listener = -1;
+	if (tcp)
+	{
+		struct sockaddr_in addr;
+		socklen_t addrlen = sizeof(addr);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		if ((listener < 0) || (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) ||
+			(listen(listener, 1) != 0) || (getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &addrlen) != 0))
+		{
+			perror("listen");
+			return 1;
+		}
+		device = "tcp://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+	}
+
+	// WITHOUT A LOOPBACK DEVICE, WRITE TO THE MASTER SIDE OF A PTY
+	else if (device.empty())
+	{
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+		{
+			perror("posix_openpt");
+			return 1;
+		}
+		device = ptsname(master);
+	}
+
+	sr::CSerialPort* port = sr::CSerialPort::Create(device);
+	if ((port == 0) || (port->Open(device) != 0))
+	{
+		printf("Cannot open %s\n", device.c_str());
+		return 1;
+	}
+	port->SetDataRate(baud);
+	if (listener >= 0)
+	{
+		master = accept(listener, 0, 0);
+		if (master < 0)
+		{
+			perror("accept");
+			return 1;
+		}
+	}
+
+	printf("%s, %u frames of %u bytes every %ums\n", device.c_str(), frames, size, interval);
+	printf("%-16s %8s %12s %12s %12s %12s\n", "setting", "reads/fr", "byte avg us", "frame avg us", "frame p99 us", "frame max us");
+
+	std::vector<uint8_t> frame(size, 0x55u);
+	for (size_t s = 0u; s < sizeof(s_settings) / sizeof(s_settings[0]); ++s)
+	{
+		const BENCHSETTING& setting = s_settings[s];
+
+		// START FROM THE DEFAULTS, THEN APPLY THIS SETTING
+		port->SetLowLatency(false);
+		port->SetReadBatching(1u, 0u);
+		if (setting.low_latency && (port->SetLowLatency(true) != 0))
+		{
+			printf("%-16s (low latency mode not supported)\n", setting.name);
+			continue;
+		}
+		if (port->SetReadBatching(setting.vmin, setting.vtime) != 0)
+		{
+			printf("%-16s (read batching not supported)\n", setting.name);
+			continue;
+		}
+
+		// DISCARD ANYTHING LEFT OVER FROM THE LAST RUN
+		uint8_t buf[4096];
+		while (port->Recv(buf, sizeof(buf), 50u) > 0)
+		{
+		}
+
+		std::vector<uint64_t> sent(frames, 0u);
+		std::vector<uint64_t> arrived(static_cast<size_t>(frames) * size, 0u);
+		std::atomic<bool> done(false);
+
+		std::thread writer([&]()
+		{
+			for (uint32_t f = 0u; f < frames; ++f)
+			{
+				sent[f] = NowUs();
+				if (master >= 0)
+				{
+					ssize_t rc = write(master, frame.data(), frame.size());
+					(void)rc;
+				}
+				else
+				{
+					port->Send(frame.data(), frame.size(), 1000u);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+			}
+			done = true;
+		});
+
+		// TIMESTAMP EVERY BYTE AS IT IS DELIVERED
+		size_t total = arrived.size();
+		size_t received = 0u;
+		uint64_t reads = 0u;
+		uint64_t idle_since = NowUs();
+		while (received < total)
+		{
+			int32_t n = port->Recv(buf, std::min(sizeof(buf), total - received), 100u);
+			uint64_t now = NowUs();
+
+			if (n > 0)
+			{
+				reads++;
+				for (int32_t i = 0; i < n; ++i)
+				{
+					arrived[received++] = now;
+				}
+				idle_since = now;
+			}
+			else if (done && ((now - idle_since) > 2000000u))
+			{
+				break;
+			}
+		}
+		writer.join();
+
+		if (received < total)
+		{
+			printf("%-16s (lost %u bytes)\n", setting.name, static_cast<unsigned>(total - received));
+			continue;
+		}
+
+		// REDUCE TO PER-BYTE AND PER-FRAME LATENCIES
+		uint64_t byte_total = 0u;
+		std::vector<uint64_t> frame_lat(frames);
+		for (uint32_t f = 0u; f < frames; ++f)
+		{
+			for (uint32_t b = 0u; b < size; ++b)
+			{
+				byte_total += arrived[f * size + b] - sent[f];
+			}
+			frame_lat[f] = arrived[f * size + size - 1u] - sent[f];
+		}
+		std::sort(frame_lat.begin(), frame_lat.end());
+
+		uint64_t frame_total = 0u;
+		for (uint32_t f = 0u; f < frames; ++f)
+		{
+			frame_total += frame_lat[f];
+		}
+
+		printf("%-16s %8.2f %12llu %12llu %12llu %12llu\n",
+			setting.name,
+			static_cast<double>(reads) / frames,
+			static_cast<unsigned long long>(byte_total / total),
+			static_cast<unsigned long long>(frame_total / frames),
+			static_cast<unsigned long long>(frame_lat[(frames * 99u) / 100u]),
+			static_cast<unsigned long long>(frame_lat.back()));
+	}
+
+	port->Close();
+	delete port;
+	if (master >= 0)
+	{
+		close(master);
+	}
+	if (listener >= 0)
+	{
+		close(listener);
+	}
+	return 0;
+}
@@ -32,6 +32,8 @@
 namespace sr
 {
 
+class CClock;
+
 //!
 //! \brief Serial port abstraction class.
 //!
@@ -44,13 +46,21 @@ class CSerialPort
 {
 public:
 	static CSerialPort* New ();		//!< SERIAL PORT FACTORY FUNCTION
+	static CSerialPort* Create (const string& device);	//!< FACTORY WHICH ALSO UNDERSTANDS NETWORK (tcp://, rfc2217://) AND SIMULATED (sim:) DEVICES
 	virtual int32_t Open (const string& device) = 0;
 	virtual int32_t SetDataRate (unsigned baud) = 0;
 	virtual int32_t Send (const uint8_t* data, size_t size, unsigned timeout) = 0;
 	virtual int32_t Recv (uint8_t* data, size_t maxSize, unsigned timeout) = 0;
 	virtual void Close () = 0;
+	virtual int32_t SetLowLatency (bool on) { return ErrorInvalidSettings; }	//!< DISABLE DRIVER-SIDE RECEIVE BUFFERING
+	virtual int32_t SetReadBatching (uint8_t vmin, uint8_t vtime) { return ErrorInvalidSettings; }	//!< TERMIOS-STYLE READ BATCHING
+	virtual int GetFd () { return -1; }				//!< DESCRIPTOR FOR THE OPEN PORT, OR -1 IF NOT AVAILABLE
+	virtual bool SetWakeFd (int fd) { return false; }	//!< RECV() RETURNS ErrorWakeup WHEN fd BECOMES READABLE
+	virtual void SetClock (CClock* clock) {}		//!< TIME SOURCE, FOR PORTS WHICH MODEL TIMING THEMSELVES
 	virtual ~CSerialPort () = 0;
 
+	static const unsigned TimeoutInfinite = 0xffffffffu;	//!< BLOCK UNTIL DATA (OR A WAKEUP) ARRIVES
+
 	enum Errors
 	{
 		ErrorUnspecified	 = -100,	//!< UNKNOWN ERROR
@@ -59,7 +69,8 @@ public:
 		ErrorInvalidSettings = -103,	//!< SPECIFIED SETTINGS ARE NOT VALID FOR THE DEVICE
 		ErrorTransmitError	 = -104,	//!< AN ERROR OCCURRED DURING DATA TRANSMISSION
 		ErrorReceiveError	 = -105,	//!< AN ERROR OCCURRED DURING DATA RECEPTION
-		ErrorTimeout         = -106		//!< OPERATION TIMED OUT
+		ErrorTimeout         = -106,	//!< OPERATION TIMED OUT
+		ErrorWakeup          = -107		//!< OPERATION INTERRUPTED BY THE WAKE DESCRIPTOR
 	};
 };
 
@@ -0,0 +1,401 @@
+/*
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file serial_fault.cpp
+//! \brief Implementation of the fault-injecting serial port decorator.
+//!
+
+#include "pch.h"
+#include <algorithm>
+#include "scp.h"
+#include "serial_fault.h"
+
+namespace sr
+{
+
+//!
+//! \brief Parse a fault policy specification
+//!
+//! The specification is a comma-separated list of key=value pairs, e.g.
+//! "drop=0.001,corrupt=0.001,loss=0.01,delay=0.05,delayms=200,seed=42".
+//! Recognized keys are drop, corrupt, dup, delay, delayms, loss, seed
+//! and dir (rx, tx or both). Keys not present keep their current value.
+//!
+//! \param[in] spec The policy specification
+//!
+//! \retval bool Returns true if the specification was valid
+//!
+//========================================================================
+bool FAULTPOLICY::Parse (const string& spec)
+{
+	vector<string> items = StrTokenize(spec, ",");
+
+	for (size_t i = 0u; i < items.size(); ++i)
+	{
+		vector<string> kv = StrTokenize(items[i], "=");
+		if (kv.size() != 2u)
+		{
+			return false;
+		}
+
+		const string& key = kv[0];
+		const char* val = kv[1].c_str();
+
+		if (key == "drop")
+		{
+			drop = atof(val);
+		}
+		else if (key == "corrupt")
+		{
+			corrupt = atof(val);
+		}
+		else if (key == "dup")
+		{
+			dup = atof(val);
+		}
+		else if (key == "delay")
+		{
+			delay = atof(val);
+		}
+		else if (key == "delayms")
+		{
+			delay_ms = strtoul(val, 0, 10);
+		}
+		else if (key == "loss")
+		{
+			frame_loss = atof(val);
+		}
+		else if (key == "seed")
+		{
+			seed = strtoul(val, 0, 10);
+		}
+		else if (key == "dir")
+		{
+			if (kv[1] == "rx")
+			{
+				direction = FAULT_RX;
+			}
+			else if (kv[1] == "tx")
+			{
+				direction = FAULT_TX;
+			}
+			else if (kv[1] == "both")
+			{
+				direction = FAULT_BOTH;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//!
+//! \brief Public constructor
+//!
+//! \param[in] port The port to be decorated. The decorator assumes
+//! ownership of this object.
+//! \param[in] policy The fault injection policy
+//!
+//========================================================================
+CFaultSerialPort::CFaultSerialPort (CSerialPort* port, const FAULTPOLICY& policy) :
+	m_port(port),
+	m_policy(policy),
+	m_rng(policy.seed),
+	m_rx_discard(false)
+{
+
+}
+
+//========================================================================
+CFaultSerialPort::~CFaultSerialPort ()
+{
+
+	if (m_port != 0)
+	{
+		delete m_port;
+		m_port = 0;
+	}
+}
+
+//========================================================================
+int32_t CFaultSerialPort::Open (const string& device)
+{
+
+	return m_port->Open(device);
+}
+
+//========================================================================
+int32_t CFaultSerialPort::SetDataRate (uint32_t baud)
+{
+
+	return m_port->SetDataRate(baud);
+}
+
+//========================================================================
+void CFaultSerialPort::Close ()
+{
+
+	m_port->Close();
+
+	std::lock_guard<std::mutex> lk(m_lock);
+	m_rx_pending.clear();
+	m_rx_discard = false;
+}
+
+//!
+//! \brief Retrieve the count of faults injected so far
+//!
+//! \param[out] rx Faults injected into received data
+//! \param[out] tx Faults injected into transmitted data
+//!
+//========================================================================
+void CFaultSerialPort::GetStats (FAULTSTATS& rx, FAULTSTATS& tx)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	rx = m_rx_stats;
+	tx = m_tx_stats;
+}
+
+//!
+//! \internal
+//! \brief Roll the dice
+//!
+//! \note Assumes the caller is holding m_lock
+//!
+//========================================================================
+bool CFaultSerialPort::Chance (double ratio)
+{
+
+	if (ratio <= 0.0)
+	{
+		return false;
+	}
+	return (std::generate_canonical<double, 32>(m_rng) < ratio);
+}
+
+//!
+//! \internal
+//! \brief Apply the byte-level faults to a block of data
+//!
+//! \param[in] data The undamaged data
+//! \param[in] len Length of the data (bytes)
+//! \param[out] out The damaged data is appended here
+//! \param[in,out] stats Counters to be updated
+//!
+//! \note Assumes the caller is holding m_lock
+//!
+//========================================================================
+void CFaultSerialPort::Damage (const uint8_t* data, size_t len, std::vector<uint8_t>& out, FAULTSTATS& stats)
+{
+
+	for (size_t i = 0u; i < len; ++i)
+	{
+		uint8_t c = data[i];
+
+		if (Chance(m_policy.drop))
+		{
+			stats.dropped++;
+			continue;
+		}
+		if (Chance(m_policy.corrupt))
+		{
+			c ^= static_cast<uint8_t>(1u << (m_rng() % 8u));
+			stats.corrupted++;
+		}
+		out.push_back(c);
+		if (Chance(m_policy.dup))
+		{
+			out.push_back(c);
+			stats.duplicated++;
+		}
+	}
+}
+
+//!
+//! \brief Transmit data through the decorated port
+//!
+//! Every call to Send() is treated as a single frame for the purposes
+//! of frame loss. Dropped data is reported to the caller as sent, just
+//! as it would be by a real port with a bad cable.
+//!
+//========================================================================
+int32_t CFaultSerialPort::Send (const uint8_t* data, size_t size, uint32_t timeout)
+{
+
+	if ((m_policy.direction & FAULT_TX) == 0u)
+	{
+		return m_port->Send(data, size, timeout);
+	}
+
+	std::vector<uint8_t> out;
+	bool delay = false;
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+
+		m_tx_stats.bytes += size;
+		if (Chance(m_policy.frame_loss))
+		{
+			m_tx_stats.frames_lost++;
+			return static_cast<int32_t>(size);
+		}
+		Damage(data, size, out, m_tx_stats);
+		if (Chance(m_policy.delay))
+		{
+			m_tx_stats.delayed++;
+			delay = true;
+		}
+	}
+
+	// A STALLED TRANSMITTER HOLDS UP THE CALLER
+	if (delay)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(m_policy.delay_ms));
+	}
+
+	if (!out.empty())
+	{
+		int32_t result = m_port->Send(out.data(), out.size(), timeout);
+		if (result < 0)
+		{
+			return result;
+		}
+	}
+
+	return static_cast<int32_t>(size);
+}
+
+//!
+//! \brief Receive data through the decorated port
+//!
+//! An incoming frame is lost by discarding everything from its sentinel
+//! up to the next one. Delayed data is held back (along with everything
+//! received after it, so that ordering is preserved) until its release
+//! time has passed.
+//!
+//========================================================================
+int32_t CFaultSerialPort::Recv (uint8_t* data, size_t maxSize, uint32_t timeout)
+{
+
+	if ((m_policy.direction & FAULT_RX) == 0u)
+	{
+		return m_port->Recv(data, maxSize, timeout);
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	bool ready = false;
+	uint32_t wait = timeout;
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+
+		if (!m_rx_pending.empty())
+		{
+			if (m_rx_pending.front().release <= now)
+			{
+				ready = true;
+			}
+			else
+			{
+				uint32_t remaining = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+					m_rx_pending.front().release - now).count()) + 1u;
+				wait = std::min(wait, remaining);
+			}
+		}
+	}
+
+	if (!ready)
+	{
+		std::vector<uint8_t> in(maxSize);
+
+		int32_t result = m_port->Recv(in.data(), maxSize, wait);
+		if ((result < 0) && (result != ErrorTimeout))
+		{
+			return result;
+		}
+
+		if (result > 0)
+		{
+			std::lock_guard<std::mutex> lk(m_lock);
+			std::vector<uint8_t> out;
+
+			m_rx_stats.bytes += result;
+			for (int32_t i = 0; i < result; ++i)
+			{
+				// EACH SENTINEL STARTS A NEW FRAME, WHICH MAY BE LOST
+				if (in[i] == PKT_SENTINEL)
+				{
+					m_rx_discard = Chance(m_policy.frame_loss);
+					if (m_rx_discard)
+					{
+						m_rx_stats.frames_lost++;
+					}
+				}
+				if (!m_rx_discard)
+				{
+					Damage(&in[i], 1u, out, m_rx_stats);
+				}
+			}
+
+			now = std::chrono::steady_clock::now();
+			DELAYED d;
+			d.release = now;
+			if (Chance(m_policy.delay))
+			{
+				m_rx_stats.delayed++;
+				d.release += std::chrono::milliseconds(m_policy.delay_ms);
+			}
+			if (!m_rx_pending.empty() && (m_rx_pending.back().release > d.release))
+			{
+				d.release = m_rx_pending.back().release;
+			}
+			for (size_t i = 0u; i < out.size(); ++i)
+			{
+				d.c = out[i];
+				m_rx_pending.push_back(d);
+			}
+		}
+	}
+
+	// RELEASE WHATEVER DATA IS DUE
+	std::lock_guard<std::mutex> lk(m_lock);
+	size_t n = 0u;
+
+	now = std::chrono::steady_clock::now();
+	while ((n < maxSize) && !m_rx_pending.empty() && (m_rx_pending.front().release <= now))
+	{
+		data[n++] = m_rx_pending.front().c;
+		m_rx_pending.pop_front();
+	}
+
+	return (n > 0u) ? static_cast<int32_t>(n) : static_cast<int32_t>(ErrorTimeout);
+}
+
+}
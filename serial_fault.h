@@ -0,0 +1,136 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file serial_fault.h
+//! \brief Declarations for the fault-injecting serial port decorator.
+//!
+
+#ifndef _SERIAL_FAULT_H_
+#define _SERIAL_FAULT_H_
+
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "serial.h"
+
+namespace sr
+{
+
+//! Directions to which a fault policy applies
+enum FaultDirection
+{
+	FAULT_RX = 0x01,		//!< DATA RECEIVED FROM THE DEVICE
+	FAULT_TX = 0x02,		//!< DATA SENT TO THE DEVICE
+	FAULT_BOTH = 0x03
+};
+
+//!
+//! \brief Fault injection policy
+//!
+//! Each ratio is the probability (0.0 - 1.0) of the corresponding
+//! fault occurring. Byte faults are rolled for every byte, delays for
+//! every chunk of data passed through the port, and frame losses for
+//! every SCP frame.
+//!
+struct FAULTPOLICY
+{
+	double drop;			//!< Probability that a byte is dropped
+	double corrupt;			//!< Probability that a byte has a bit flipped
+	double dup;				//!< Probability that a byte is sent twice
+	double delay;			//!< Probability that a chunk of data is delayed
+	uint32_t delay_ms;		//!< Length of an injected delay (ms)
+	double frame_loss;		//!< Probability that an entire frame is lost
+	uint32_t direction;		//!< Directions affected (FAULT_XXX)
+	uint32_t seed;			//!< Random number generator seed
+
+	FAULTPOLICY() : drop(0.0), corrupt(0.0), dup(0.0), delay(0.0), delay_ms(50u),
+		frame_loss(0.0), direction(FAULT_BOTH), seed(1u) {}
+	bool Parse (const string& spec);
+};
+
+//! Counts of injected faults
+struct FAULTSTATS
+{
+	uint64_t bytes;			//!< Bytes passed to the decorator
+	uint64_t dropped;		//!< Bytes dropped
+	uint64_t corrupted;		//!< Bytes corrupted
+	uint64_t duplicated;	//!< Bytes duplicated
+	uint64_t delayed;		//!< Chunks delayed
+	uint64_t frames_lost;	//!< Frames discarded in their entirety
+
+	FAULTSTATS() : bytes(0u), dropped(0u), corrupted(0u), duplicated(0u), delayed(0u),
+		frames_lost(0u) {}
+};
+
+//!
+//! \brief A serial port decorator which injects faults.
+//!
+//! Wraps any other CSerialPort (real or replay) and damages the data
+//! passing through it according to a seeded, and therefore repeatable,
+//! FAULTPOLICY. The wrapped port is owned by the decorator.
+//!
+class CFaultSerialPort : public CSerialPort
+{
+public:
+	CFaultSerialPort (CSerialPort* port, const FAULTPOLICY& policy);
+	~CFaultSerialPort ();
+	int32_t Open (const string& device);
+	int32_t SetDataRate (uint32_t baud);
+	int32_t Send (const uint8_t* data, size_t size, uint32_t timeout);
+	int32_t Recv (uint8_t* data, size_t maxSize, uint32_t timeout);
+	void Close ();
+	int32_t SetLowLatency (bool on) { return m_port->SetLowLatency(on); }
+	int32_t SetReadBatching (uint8_t vmin, uint8_t vtime) { return m_port->SetReadBatching(vmin, vtime); }
+	int GetFd () { return m_port->GetFd(); }
+	bool SetWakeFd (int fd) { return m_port->SetWakeFd(fd); }
+	void SetClock (CClock* clock) { m_port->SetClock(clock); }
+
+	void GetStats (FAULTSTATS& rx, FAULTSTATS& tx);
+
+private:
+	CFaultSerialPort ();
+
+	//! A received byte waiting out an injected delay
+	struct DELAYED
+	{
+		std::chrono::steady_clock::time_point release;
+		uint8_t c;
+	};
+
+	CSerialPort* m_port;			//!< The decorated port
+	FAULTPOLICY m_policy;			//!< What to break, and how often
+	std::mutex m_lock;				//!< Send() and Recv() run on different threads
+	std::mt19937 m_rng;				//!< Drives all fault decisions
+	FAULTSTATS m_rx_stats;
+	FAULTSTATS m_tx_stats;
+	bool m_rx_discard;				//!< True while discarding a lost incoming frame
+	std::deque<DELAYED> m_rx_pending;	//!< Received data not yet released to the caller
+
+	bool Chance (double ratio);
+	void Damage (const uint8_t* data, size_t len, std::vector<uint8_t>& out, FAULTSTATS& stats);
+};
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file serial_sim.cpp
+//! \brief Implementation of the simulated serial port.
+//!
+
+#include "pch.h"
+#include <algorithm>
+#include "serial_sim.h"
+
+namespace sr
+{
+
+static const char SIM_PREFIX[] = "sim:";
+
+//========================================================================
+CSimSerialPort::CSimSerialPort () : m_clock(CClock::GetSystemClock()), m_emu(0)
+{
+
+}
+
+//========================================================================
+CSimSerialPort::~CSimSerialPort ()
+{
+
+	Close();
+}
+
+//!
+//! \brief Returns true if the device name refers to a simulated radio
+//!
+//========================================================================
+bool CSimSerialPort::IsSimDevice (const string& device)
+{
+
+	return (device.compare(0u, sizeof(SIM_PREFIX) - 1u, SIM_PREFIX) == 0);
+}
+
+//!
+//! \brief Parse the emulator settings from a "sim:" device name
+//!
+//! \param[in] device The device name.
+//! \param[out] config The emulator configuration.
+//!
+//! \retval bool Returns true if the device name was valid.
+//!
+//========================================================================
+bool CSimSerialPort::ParseConfig (const string& device, SCEMU_CONFIG& config)
+{
+
+	if (!IsSimDevice(device))
+	{
+		return false;
+	}
+
+	vector<string> items = StrTokenize(device.substr(sizeof(SIM_PREFIX) - 1u), ",");
+	for (size_t i = 0u; i < items.size(); ++i)
+	{
+		vector<string> kv = StrTokenize(items[i], "=");
+		if (kv.empty())
+		{
+			continue;
+		}
+
+		const string& key = kv[0];
+		if ((kv.size() == 1u) && (key == "tts"))
+		{
+			config.tts100 = true;
+		}
+		else if ((kv.size() == 1u) && (key == "force"))
+		{
+			config.meta_force = true;
+		}
+		else if (kv.size() != 2u)
+		{
+			return false;
+		}
+		else if (key == "rate")
+		{
+			config.meta_rate = strtoul(kv[1].c_str(), 0, 10);
+		}
+		else if (key == "error")
+		{
+			config.error_ratio = atof(kv[1].c_str());
+		}
+		else if (key == "busy")
+		{
+			config.busy_ratio = atof(kv[1].c_str());
+		}
+		else if (key == "seed")
+		{
+			config.seed = strtoul(kv[1].c_str(), 0, 10);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//========================================================================
+int32_t CSimSerialPort::Open (const string& device)
+{
+	SCEMU_CONFIG config;
+
+	if (!ParseConfig(device, config))
+	{
+		return ErrorInvalidPort;
+	}
+
+	std::lock_guard<std::mutex> lk(m_lock);
+	if (m_emu != 0)
+	{
+		return ErrorPortInUse;
+	}
+	m_emu = new CRadioEmulator(config);
+
+	return 0;
+}
+
+//========================================================================
+void CSimSerialPort::Close ()
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	delete m_emu;
+	m_emu = 0;
+}
+
+//!
+//! \brief Pass data from the host to the emulated radio
+//!
+//========================================================================
+int32_t CSimSerialPort::Send (const uint8_t* data, size_t size, uint32_t timeout)
+{
+
+	m_lock.lock();
+	if (m_emu == 0)
+	{
+		m_lock.unlock();
+		return ErrorTransmitError;
+	}
+	m_emu->Input(data, size, NowMs());
+	m_lock.unlock();
+
+	// THE RADIO MAY HAVE SOMETHING TO SAY NOW
+	m_clock->Notify(m_rx_cv);
+
+	return static_cast<int32_t>(size);
+}
+
+//!
+//! \brief Wait for data from the emulated radio
+//!
+//! The emulator is polled whenever it has something scheduled, so its
+//! retransmissions and notifications happen on time.
+//!
+//========================================================================
+int32_t CSimSerialPort::Recv (uint8_t* data, size_t maxSize, uint32_t timeout)
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+	CLOCKTIME deadline = CLOCKTIME::max();
+
+	if (timeout != TimeoutInfinite)
+	{
+		deadline = m_clock->Now() + std::chrono::milliseconds(timeout);
+	}
+
+	for (;;)
+	{
+		if (m_emu == 0)
+		{
+			return ErrorReceiveError;
+		}
+
+		uint64_t now = NowMs();
+		m_emu->Poll(now);
+		size_t n = m_emu->Output(data, maxSize);
+		if (n > 0u)
+		{
+			return static_cast<int32_t>(n);
+		}
+		if (m_clock->Now() >= deadline)
+		{
+			return ErrorTimeout;
+		}
+
+		uint32_t next = std::max(1u, m_emu->GetTimeToNextEvent(now));
+		m_clock->WaitUntil(m_rx_cv, lk, std::min(deadline, m_clock->Now() + std::chrono::milliseconds(next)));
+	}
+}
+
+//========================================================================
+uint64_t CSimSerialPort::NowMs ()
+{
+
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		m_clock->Now().time_since_epoch()).count());
+}
+
+}
@@ -0,0 +1,82 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file serial_sim.h
+//! \brief Declarations for the simulated serial port.
+//!
+
+#ifndef _SERIAL_SIM_H_
+#define _SERIAL_SIM_H_
+
+#include <condition_variable>
+#include <mutex>
+#include "serial.h"
+#include "clock.h"
+#include "radioemu.h"
+
+namespace sr
+{
+
+//!
+//! \brief A serial port with an emulated radio on the other end.
+//!
+//! The emulator runs inside the port, on whichever thread calls Send()
+//! or Recv(), and keeps time with the port's clock. With a virtual clock
+//! this lets the whole daemon be simulated faster than real time. The
+//! device name has the form "sim:" followed by an optional 
+//! comma-separated list of emulator settings:
+//!
+//!   tts          Require the TTS-100 handshake
+//!   rate=<n>     Song info notifications per second
+//!   force        Generate notifications even if not enabled
+//!   error=<r>    Fraction of frames sent with a bad checksum
+//!   busy=<r>     Fraction of frames answered with SF_BUSY
+//!   seed=<n>     Random number generator seed
+//!
+class CSimSerialPort : public CSerialPort
+{
+public:
+	CSimSerialPort ();
+	~CSimSerialPort ();
+	int32_t Open (const string& device);
+	int32_t SetDataRate (uint32_t baud) { return 0; }
+	int32_t Send (const uint8_t* data, size_t size, uint32_t timeout);
+	int32_t Recv (uint8_t* data, size_t maxSize, uint32_t timeout);
+	void Close ();
+	void SetClock (CClock* clock) { m_clock = clock; }
+
+	static bool IsSimDevice (const string& device);
+	static bool ParseConfig (const string& device, SCEMU_CONFIG& config);
+
+private:
+	CClock* m_clock;				//!< Time source for the emulator and for timeouts
+	std::mutex m_lock;				//!< Send() and Recv() run on different threads
+	std::condition_variable m_rx_cv;	//!< Signalled when the host sends data
+	CRadioEmulator* m_emu;			//!< The radio, or null if the port is closed
+
+	uint64_t NowMs ();
+};
+
+}
+
+#endif
@@ -0,0 +1,705 @@
+/*
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file serial_tcp.cpp
+//! \brief Network version of the serial port abstraction.
+//!
+//! Reaches a radio attached to a TCP serial server (e.g. ser2net). Two
+//! device name forms are recognized:
+//!
+//!   tcp://host:port      Raw mode; the data rate is fixed by the server
+//!   rfc2217://host:port  Telnet mode with the RFC 2217 COM-PORT option,
+//!                        which lets SetDataRate() change the server's
+//!                        data rate (needed by the TTS-100 handshake)
+//!
+//! sim: names get a simulated radio (see serial_sim.h); any other device 
+//! name is handed to the local serial port factory.
+//!
+
+#include "pch.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#ifndef WIN32
+#include <netinet/tcp.h>
+#endif
+#include "serial.h"
+#include "serial_sim.h"
+
+#ifdef WIN32
+#define SOCKERR()		WSAGetLastError()
+#define ERR_WOULDBLOCK	WSAEWOULDBLOCK
+#define ERR_INPROGRESS	WSAEWOULDBLOCK
+#define ERR_INTR		WSAEINTR
+#define SHUT_BOTH		SD_BOTH
+#else
+#define SOCKERR()		errno
+#define ERR_WOULDBLOCK	EWOULDBLOCK
+#define ERR_INPROGRESS	EINPROGRESS
+#define ERR_INTR		EINTR
+#define SHUT_BOTH		SHUT_RDWR
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+namespace sr
+{
+
+//! Time allowed for the connection to the serial server (ms)
+static const uint32_t TCP_CONNECT_TIMEOUT = 5000u;
+
+// TELNET PROTOCOL (RFC 854, RFC 2217)
+static const uint8_t TELNET_SE = 240u;
+static const uint8_t TELNET_SB = 250u;
+static const uint8_t TELNET_WILL = 251u;
+static const uint8_t TELNET_WONT = 252u;
+static const uint8_t TELNET_DO = 253u;
+static const uint8_t TELNET_DONT = 254u;
+static const uint8_t TELNET_IAC = 255u;
+static const uint8_t TELOPT_BINARY = 0u;
+static const uint8_t TELOPT_SGA = 3u;
+static const uint8_t TELOPT_COMPORT = 44u;
+static const uint8_t COMPORT_SET_BAUDRATE = 1u;
+
+//!
+//! \brief TCP version of the serial port abstraction.
+//!
+class TCPSerialPort : public CSerialPort
+{
+public:
+	TCPSerialPort ();
+	~TCPSerialPort ();
+	int32_t Open (const string& device);
+	int32_t SetDataRate (uint32_t baud);
+	int32_t Send (const uint8_t* data, size_t size, uint32_t timeout);
+	int32_t Recv (uint8_t* data, size_t maxSize, uint32_t timeout);
+	void Close ();
+	int32_t SetLowLatency (bool on);
+	int32_t SetReadBatching (uint8_t vmin, uint8_t vtime) { return ((vmin <= 1u) && (vtime == 0u)) ? 0 : ErrorInvalidSettings; }	//!< ONLY "NO BATCHING" IS MEANINGFUL
+	int GetFd () { return static_cast<int>(m_sock); }
+	bool SetWakeFd (int fd);
+
+	static bool IsNetworkDevice (const string& device);
+
+private:
+	//! Telnet receive parser state
+	enum TELNETSTATE
+	{
+		TS_DATA,		//!< Ordinary data
+		TS_IAC,			//!< An IAC has been received
+		TS_OPTION,		//!< A WILL/WONT/DO/DONT has been received
+		TS_SB,			//!< Inside a subnegotiation
+		TS_SB_IAC		//!< An IAC has been received inside a subnegotiation
+	};
+
+	SOCKET m_sock;
+	bool m_telnet;			//!< True if speaking RFC 2217 rather than raw TCP
+	int m_wake_fd;			//!< Descriptor which interrupts Recv() when readable
+	std::mutex m_tx_lock;	//!< Serializes Send() and telnet replies sent by Recv()
+	TELNETSTATE m_tstate;	//!< Telnet receive parser state
+	uint8_t m_tcmd;			//!< The WILL/WONT/DO/DONT being received
+
+	int32_t SendRaw (const uint8_t* data, size_t size, uint32_t timeout);
+	size_t FilterTelnet (uint8_t* data, size_t len);
+	void OnTelnetOption (uint8_t cmd, uint8_t option);
+};
+
+//!
+//! \brief Compute the time remaining until a deadline
+//!
+//! \param[in] deadline The deadline
+//! \param[in] timeout The original timeout (ms), which may be infinite
+//! \param[out] tv The time remaining
+//!
+//! \retval timeval* Pointer to tv, or null if the wait is unbounded
+//!
+//========================================================================
+static struct timeval* Remaining (const std::chrono::steady_clock::time_point& deadline, uint32_t timeout, struct timeval& tv)
+{
+
+	if (timeout == CSerialPort::TimeoutInfinite)
+	{
+		return 0;
+	}
+
+	int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+	if (us < 0)
+	{
+		us = 0;
+	}
+	tv.tv_sec = static_cast<long>(us / 1000000);
+	tv.tv_usec = static_cast<long>(us % 1000000);
+	return &tv;
+}
+
+//!
+//! \brief Put a socket into non-blocking mode
+//!
+//========================================================================
+static bool SetNonBlocking (SOCKET s)
+{
+#ifdef WIN32
+	u_long on = 1;
+
+	return (ioctlsocket(s, FIONBIO, &on) == 0);
+#else
+	return (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == 0);
+#endif
+}
+
+//========================================================================
+TCPSerialPort::TCPSerialPort () :
+	m_sock(INVALID_SOCKET),
+	m_telnet(false),
+	m_wake_fd(-1),
+	m_tstate(TS_DATA),
+	m_tcmd(0u)
+{
+
+}
+
+//========================================================================
+TCPSerialPort::~TCPSerialPort ()
+{
+
+	Close();
+}
+
+//!
+//! \brief Determine whether a device name refers to a network serial server
+//!
+//========================================================================
+bool TCPSerialPort::IsNetworkDevice (const string& device)
+{
+
+	return ((device.compare(0u, 6u, "tcp://") == 0) || (device.compare(0u, 10u, "rfc2217://") == 0));
+}
+
+//!
+//! \brief Connect to the serial server
+//!
+//! \param[in] device tcp://host:port or rfc2217://host:port (IPv6
+//! addresses are written in brackets, e.g. tcp://[::1]:2001)
+//!
+//! \retval int32_t 0 if successful, otherwise a negative error code
+//!
+//========================================================================
+int32_t TCPSerialPort::Open (const string& device)
+{
+
+	if (m_sock != INVALID_SOCKET)
+	{
+		return ErrorPortInUse;
+	}
+	if (!IsNetworkDevice(device))
+	{
+		return ErrorInvalidPort;
+	}
+
+	// SPLIT THE DEVICE NAME INTO ITS PARTS
+	m_telnet = (device[0] == 'r');
+	string hostport = device.substr(device.find("://") + 3u);
+	size_t colon = hostport.find_last_of(':');
+	if ((colon == string::npos) || (colon == 0u) || (colon + 1u == hostport.size()))
+	{
+		LogWrite(LEVEL_ERROR, "Network device %s is not of the form host:port", device.c_str());
+		return ErrorInvalidPort;
+	}
+	string host = hostport.substr(0u, colon);
+	string service = hostport.substr(colon + 1u);
+	if ((host.size() > 2u) && (host[0] == '[') && (host[host.size() - 1u] == ']'))
+	{
+		host = host.substr(1u, host.size() - 2u);
+	}
+
+	struct addrinfo hints;
+	struct addrinfo* res = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &res);
+	if (rc != 0)
+	{
+		LogWrite(LEVEL_ERROR, "Cannot resolve %s: %s", host.c_str(), gai_strerror(rc));
+		return ErrorInvalidPort;
+	}
+
+	// TRY EACH ADDRESS IN TURN, WITHOUT BLOCKING FOREVER ON ANY OF THEM
+	SOCKET sock = INVALID_SOCKET;
+	for (struct addrinfo* ai = res; (ai != 0) && (sock == INVALID_SOCKET); ai = ai->ai_next)
+	{
+		SOCKET s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (s == INVALID_SOCKET)
+		{
+			continue;
+		}
+		SetNonBlocking(s);
+
+		bool connected = (connect(s, ai->ai_addr, static_cast<socklen_t>(ai->ai_addrlen)) == 0);
+		if (!connected && (SOCKERR() == ERR_INPROGRESS))
+		{
+			fd_set wfds;
+			struct timeval tv;
+			int err = 0;
+			socklen_t errlen = sizeof(err);
+
+			FD_ZERO(&wfds);
+			FD_SET(s, &wfds);
+			tv.tv_sec = TCP_CONNECT_TIMEOUT / 1000u;
+			tv.tv_usec = (TCP_CONNECT_TIMEOUT % 1000u) * 1000u;
+			connected = (select(static_cast<int>(s) + 1, 0, &wfds, 0, &tv) == 1) &&
+				(getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &errlen) == 0) &&
+				(err == 0);
+		}
+
+		if (connected)
+		{
+			sock = s;
+		}
+		else
+		{
+			closesocket(s);
+		}
+	}
+	freeaddrinfo(res);
+
+	if (sock == INVALID_SOCKET)
+	{
+		LogWrite(LEVEL_ERROR, "Cannot connect to %s", device.c_str());
+		return ErrorInvalidPort;
+	}
+
+	// SCP FRAMES ARE SMALL AND LATENCY SENSITIVE; NOTICE A DEAD SERVER EVENTUALLY
+	int on = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+	setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char*>(&on), sizeof(on));
+
+	m_tstate = TS_DATA;
+	{
+		// Send() MAY BE CALLED FROM OTHER THREADS; IT SEES THE SOCKET ONCE IT IS READY
+		std::lock_guard<std::mutex> lk(m_tx_lock);
+		m_sock = sock;
+	}
+	if (m_telnet)
+	{
+		// ASK FOR AN 8-BIT CLEAN CHANNEL AND THE COM-PORT CONTROL OPTION
+		const uint8_t offer[] =
+		{
+			TELNET_IAC, TELNET_WILL, TELOPT_BINARY, TELNET_IAC, TELNET_DO, TELOPT_BINARY,
+			TELNET_IAC, TELNET_WILL, TELOPT_SGA, TELNET_IAC, TELNET_DO, TELOPT_SGA,
+			TELNET_IAC, TELNET_WILL, TELOPT_COMPORT
+		};
+
+		std::lock_guard<std::mutex> lk(m_tx_lock);
+		SendRaw(offer, sizeof(offer), 1000u);
+	}
+
+	LogWrite(LEVEL_INFO, "Connected to serial server %s", device.c_str());
+	return 0;
+}
+
+//!
+//! \brief Set the data rate
+//!
+//! In raw mode the data rate is whatever the server is configured for,
+//! so the request is accepted and ignored. In RFC 2217 mode the server
+//! is asked to change it.
+//!
+//========================================================================
+int32_t TCPSerialPort::SetDataRate (uint32_t baud)
+{
+
+	if (m_sock == INVALID_SOCKET)
+	{
+		return ErrorInvalidPort;
+	}
+	if (!m_telnet)
+	{
+		return 0;
+	}
+
+	std::vector<uint8_t> req;
+	req.push_back(TELNET_IAC);
+	req.push_back(TELNET_SB);
+	req.push_back(TELOPT_COMPORT);
+	req.push_back(COMPORT_SET_BAUDRATE);
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		uint8_t b = static_cast<uint8_t>(baud >> shift);
+
+		req.push_back(b);
+		if (b == TELNET_IAC)
+		{
+			req.push_back(TELNET_IAC);
+		}
+	}
+	req.push_back(TELNET_IAC);
+	req.push_back(TELNET_SE);
+
+	std::lock_guard<std::mutex> lk(m_tx_lock);
+	return (SendRaw(req.data(), req.size(), 1000u) < 0) ? ErrorInvalidSettings : 0;
+}
+
+//!
+//! \brief Enable or disable Nagle's algorithm
+//!
+//! The network analogue of the UART driver's low latency mode. Nagle
+//! is disabled by default.
+//!
+//========================================================================
+int32_t TCPSerialPort::SetLowLatency (bool on)
+{
+	int flag = on ? 1 : 0;
+
+	if (m_sock == INVALID_SOCKET)
+	{
+		return ErrorInvalidPort;
+	}
+	if (setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag)) != 0)
+	{
+		return ErrorInvalidSettings;
+	}
+	return 0;
+}
+
+//!
+//! \brief Set a descriptor which interrupts a blocked Recv()
+//!
+//========================================================================
+bool TCPSerialPort::SetWakeFd (int fd)
+{
+
+#ifdef WIN32
+	return false;
+#else
+	m_wake_fd = fd;
+	return true;
+#endif
+}
+
+//========================================================================
+void TCPSerialPort::Close ()
+{
+
+	// NOT WHILE SendRaw() IS USING THE SOCKET, WHICH COULD BE REUSED AS
+	// SOON AS IT IS CLOSED
+	std::lock_guard<std::mutex> lk(m_tx_lock);
+	if (m_sock != INVALID_SOCKET)
+	{
+		closesocket(m_sock);
+		m_sock = INVALID_SOCKET;
+	}
+}
+
+//!
+//! \internal
+//! \brief Write a block of data to the socket
+//!
+//! A block is written in its entirety or not at all. Should the timeout
+//! expire part way through, the connection is shut down rather than 
+//! leave half a frame on the stream; Recv() then reports the error and
+//! the port is reopened.
+//!
+//! \note Assumes the caller is holding m_tx_lock
+//!
+//========================================================================
+int32_t TCPSerialPort::SendRaw (const uint8_t* data, size_t size, uint32_t timeout)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(
+		(timeout == TimeoutInfinite) ? 0u : timeout);
+	size_t sent = 0u;
+
+	// THE PORT MAY HAVE BEEN CLOSED SINCE THE CALLER LAST LOOKED
+	if (m_sock == INVALID_SOCKET)
+	{
+		return ErrorInvalidPort;
+	}
+
+	while (sent < size)
+	{
+		int n = send(m_sock, reinterpret_cast<const char*>(data + sent), static_cast<int>(size - sent), MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			sent += static_cast<size_t>(n);
+			continue;
+		}
+
+		int err = SOCKERR();
+		if ((n < 0) && (err == ERR_INTR))
+		{
+			continue;
+		}
+		if ((n < 0) && (err != ERR_WOULDBLOCK))
+		{
+			return ErrorTransmitError;
+		}
+
+		// THE SOCKET BUFFER IS FULL; WAIT FOR ROOM
+		fd_set wfds;
+		struct timeval tv;
+
+		FD_ZERO(&wfds);
+		FD_SET(m_sock, &wfds);
+		if (select(static_cast<int>(m_sock) + 1, 0, &wfds, 0, Remaining(deadline, timeout, tv)) == 0)
+		{
+			if (sent > 0u)
+			{
+				LogWrite(LEVEL_WARNING, "Serial server stalled mid-frame; dropping the connection.");
+				shutdown(m_sock, SHUT_BOTH);
+				return ErrorTransmitError;
+			}
+			return ErrorTimeout;
+		}
+	}
+
+	return static_cast<int32_t>(size);
+}
+
+//========================================================================
+int32_t TCPSerialPort::Send (const uint8_t* data, size_t size, uint32_t timeout)
+{
+
+	std::lock_guard<std::mutex> lk(m_tx_lock);
+
+	// CLOSE() TAKES THE LOCK TOO, SO THE SOCKET STAYS VALID UNTIL WE RETURN
+	if (m_sock == INVALID_SOCKET)
+	{
+		return ErrorInvalidPort;
+	}
+	if (!m_telnet)
+	{
+		return SendRaw(data, size, timeout);
+	}
+
+	// IAC BYTES IN THE DATA ARE DOUBLED
+	std::vector<uint8_t> buf;
+	buf.reserve(size + 8u);
+	for (size_t i = 0u; i < size; ++i)
+	{
+		buf.push_back(data[i]);
+		if (data[i] == TELNET_IAC)
+		{
+			buf.push_back(TELNET_IAC);
+		}
+	}
+
+	int32_t result = SendRaw(buf.data(), buf.size(), timeout);
+	return (result < 0) ? result : static_cast<int32_t>(size);
+}
+
+//!
+//! \internal
+//! \brief Answer a telnet option negotiation
+//!
+//! Only the options offered in Open() are accepted. Acceptances are
+//! not acknowledged again, which keeps the negotiation from looping.
+//!
+//========================================================================
+void TCPSerialPort::OnTelnetOption (uint8_t cmd, uint8_t option)
+{
+	bool supported = (option == TELOPT_BINARY) || (option == TELOPT_SGA) || (option == TELOPT_COMPORT);
+	uint8_t reply[3] = { TELNET_IAC, 0u, option };
+
+	if (supported || (cmd == TELNET_WONT) || (cmd == TELNET_DONT))
+	{
+		return;
+	}
+
+	reply[1] = (cmd == TELNET_DO) ? TELNET_WONT : TELNET_DONT;
+
+	std::lock_guard<std::mutex> lk(m_tx_lock);
+	SendRaw(reply, sizeof(reply), 1000u);
+}
+
+//!
+//! \internal
+//! \brief Strip telnet commands from received data (in place)
+//!
+//! \retval size_t Number of data bytes remaining
+//!
+//========================================================================
+size_t TCPSerialPort::FilterTelnet (uint8_t* data, size_t len)
+{
+	size_t out = 0u;
+
+	for (size_t i = 0u; i < len; ++i)
+	{
+		uint8_t c = data[i];
+
+		switch (m_tstate)
+		{
+			case TS_DATA:
+				if (c == TELNET_IAC)
+				{
+					m_tstate = TS_IAC;
+				}
+				else
+				{
+					data[out++] = c;
+				}
+			break;
+
+			case TS_IAC:
+				if (c == TELNET_IAC)
+				{
+					// AN ESCAPED 0xFF DATA BYTE
+					data[out++] = c;
+					m_tstate = TS_DATA;
+				}
+				else if ((c >= TELNET_WILL) && (c <= TELNET_DONT))
+				{
+					m_tcmd = c;
+					m_tstate = TS_OPTION;
+				}
+				else if (c == TELNET_SB)
+				{
+					m_tstate = TS_SB;
+				}
+				else
+				{
+					m_tstate = TS_DATA;
+				}
+			break;
+
+			case TS_OPTION:
+				OnTelnetOption(m_tcmd, c);
+				m_tstate = TS_DATA;
+			break;
+
+			case TS_SB:
+				// SUBNEGOTIATIONS (E.G. COM-PORT REPLIES) ARE IGNORED
+				if (c == TELNET_IAC)
+				{
+					m_tstate = TS_SB_IAC;
+				}
+			break;
+
+			case TS_SB_IAC:
+				m_tstate = (c == TELNET_SE) ? TS_DATA : TS_SB;
+			break;
+		}
+	}
+
+	return out;
+}
+
+//========================================================================
+int32_t TCPSerialPort::Recv (uint8_t* data, size_t maxSize, uint32_t timeout)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(
+		(timeout == TimeoutInfinite) ? 0u : timeout);
+
+	if (m_sock == INVALID_SOCKET)
+	{
+		return ErrorInvalidPort;
+	}
+
+	while (true)
+	{
+		fd_set rfds;
+		struct timeval tv;
+		int highest = static_cast<int>(m_sock);
+
+		FD_ZERO(&rfds);
+		FD_SET(m_sock, &rfds);
+#ifndef WIN32
+		if (m_wake_fd != -1)
+		{
+			FD_SET(m_wake_fd, &rfds);
+			highest = std::max(highest, m_wake_fd);
+		}
+#endif
+		int n = select(highest + 1, &rfds, 0, 0, Remaining(deadline, timeout, tv));
+		if (n == 0)
+		{
+			return ErrorTimeout;
+		}
+		if (n < 0)
+		{
+			return (SOCKERR() == ERR_INTR) ? ErrorTimeout : ErrorReceiveError;
+		}
+
+		// DATA TAKES PRIORITY; A PENDING WAKEUP WILL BE SEEN ON THE NEXT CALL
+		if (!FD_ISSET(m_sock, &rfds))
+		{
+			return ErrorWakeup;
+		}
+
+		int result = recv(m_sock, reinterpret_cast<char*>(data), static_cast<int>(maxSize), 0);
+		if (result == 0)
+		{
+			// THE SERVER HUNG UP
+			return ErrorReceiveError;
+		}
+		if (result < 0)
+		{
+			int err = SOCKERR();
+			if ((err != ERR_WOULDBLOCK) && (err != ERR_INTR))
+			{
+				return ErrorReceiveError;
+			}
+		}
+		else
+		{
+			size_t len = m_telnet ? FilterTelnet(data, static_cast<size_t>(result)) : static_cast<size_t>(result);
+			if (len > 0u)
+			{
+				return static_cast<int32_t>(len);
+			}
+		}
+
+		// NOTHING BUT TELNET CHATTER; KEEP WAITING
+		if ((timeout != TimeoutInfinite) && (std::chrono::steady_clock::now() >= deadline))
+		{
+			return ErrorTimeout;
+		}
+	}
+}
+
+//!
+//! \brief Serial port factory which understands network device names
+//!
+//! \param[in] device The name of the device which will be opened
+//!
+//! \retval CSerialPort* A network port for tcp:// and rfc2217:// names,
+//! a simulated radio for sim: names, otherwise a local serial port
+//!
+//========================================================================
+CSerialPort* CSerialPort::Create (const string& device)
+{
+
+	if (TCPSerialPort::IsNetworkDevice(device))
+	{
+		return new TCPSerialPort;
+	}
+	if (CSimSerialPort::IsSimDevice(device))
+	{
+		return new CSimSerialPort;
+	}
+	return New();
+}
+
+}
@@ -3,7 +3,14 @@
 //
 
 #include "pch.h"
+#include <poll.h>
 #include <termios.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#include "sobuf.h"
 #include "serial.h"
 
 //!
@@ -14,6 +21,9 @@
 namespace sr
 {
 
+//! Size of the transmit ring (bytes)
+static const size_t SERIAL_TX_RING_SIZE = 4096u;
+
 //!
 //! \brief UNIX version of the serial port abstraction.
 //!
@@ -27,19 +37,204 @@ public:
 	int32_t Send (const uint8_t* data, size_t size, uint32_t timeout);
 	int32_t Recv (uint8_t* data, size_t maxSize, uint32_t timeout);
 	void Close ();
+	int32_t SetLowLatency (bool on);
+	int32_t SetReadBatching (uint8_t vmin, uint8_t vtime);
+	int GetFd () { return m_fd; }
+	bool SetWakeFd (int fd);
 
 private:
 	~UNIXSerialPort ();
 
 	string m_device;
 	int m_fd;
+	int m_wr_fd;		//!< Descriptor written to; m_fd unless reads are batched
+	int m_wake_fd;		//!< Descriptor which interrupts Recv() when readable
+	std::mutex m_tx_lock;	//!< Serializes access to the transmit ring
+	SOBuffer m_txbuf;		//!< Data accepted by Send() but not yet written
+
+	bool Flush ();
 };
 
 //========================================================================
 UNIXSerialPort::UNIXSerialPort () :
-	m_fd(-1)
+	m_fd(-1),
+	m_wr_fd(-1),
+	m_wake_fd(-1),
+	m_txbuf(SERIAL_TX_RING_SIZE)
+{
+
+}
+
+//!
+//! \brief Compute the poll() timeout remaining until a deadline
+//!
+//! \param[in] deadline The deadline
+//! \param[in] timeout The original timeout (ms), which may be infinite
+//!
+//========================================================================
+static int RemainingMs (const std::chrono::steady_clock::time_point& deadline, uint32_t timeout)
+{
+
+	if (timeout == CSerialPort::TimeoutInfinite)
+	{
+		return -1;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now >= deadline)
+	{
+		return 0;
+	}
+	return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+}
+
+//!
+//! \brief Enable or disable the driver's low latency mode
+//!
+//! USB-serial adapters (FTDI and friends) hold received data for up to
+//! 16ms by default before passing it up to the host. Setting 
+//! ASYNC_LOW_LATENCY asks the driver to deliver it immediately, at the 
+//! cost of more interrupts. Only available on Linux, and only for 
+//! drivers which implement TIOCSSERIAL.
+//!
+//! \param[in] on True to enable low latency mode
+//!
+//! \retval int32_t Returns 0 on success or a negative error code
+//!
+//========================================================================
+int32_t UNIXSerialPort::SetLowLatency (bool on)
+{
+
+    if (m_fd == -1)
+    {
+        return ErrorInvalidPort;
+    }
+
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct ss;
+
+    if (ioctl(m_fd, TIOCGSERIAL, &ss) != 0)
+    {
+        return ErrorInvalidSettings;
+    }
+    if (on)
+    {
+        ss.flags |= ASYNC_LOW_LATENCY;
+    }
+    else
+    {
+        ss.flags &= ~ASYNC_LOW_LATENCY;
+    }
+    if (ioctl(m_fd, TIOCSSERIAL, &ss) != 0)
+    {
+        return ErrorInvalidSettings;
+    }
+    return 0;
+#else
+    return ErrorInvalidSettings;
+#endif
+}
+
+//!
+//! \brief Configure read batching
+//!
+//! With the defaults (VMIN=1, VTIME=0) every byte that arrives wakes 
+//! the reader. Raising VMIN and/or VTIME lets the line discipline 
+//! collect a burst (e.g. a song info frame) into a single read: a read
+//! completes when vmin bytes have arrived, or when the line has been 
+//! idle for vtime tenths of a second after the first byte. Reads 
+//! block within a burst, so a wakeup may be delayed by up to vtime.
+//! A vmin above 1 requires a non-zero vtime, or a short frame (such as
+//! an ACK) could be held back indefinitely.
+//!
+//! Batched reads need the descriptor to block, but writes never may, so
+//! while batching is on the port is opened a second time for writing. 
+//! Batching is refused if the device can't be opened again.
+//!
+//! \param[in] vmin Minimum number of bytes per read (1 - 255)
+//! \param[in] vtime Inter-byte timeout (tenths of a second)
+//!
+//! \retval int32_t Returns 0 on success or a negative error code
+//!
+//========================================================================
+int32_t UNIXSerialPort::SetReadBatching (uint8_t vmin, uint8_t vtime)
+{
+    struct termios tio;
+
+    if (m_fd == -1)
+    {
+        return ErrorInvalidPort;
+    }
+    if ((vmin == 0u) || ((vmin > 1u) && (vtime == 0u)))
+    {
+        return ErrorInvalidSettings;
+    }
+
+    bool batching = ((vmin > 1u) || (vtime > 0u));
+    std::lock_guard<std::mutex> lk(m_tx_lock);
+
+    if (batching && (m_wr_fd == m_fd))
+    {
+        int fd = open(m_device.c_str(), O_WRONLY | O_NOCTTY | O_NONBLOCK);
+        if (fd == -1)
+        {
+            return ErrorInvalidSettings;
+        }
+        m_wr_fd = fd;
+    }
+
+    if (tcgetattr(m_fd, &tio) != 0)
+    {
+        return ErrorUnspecified;
+    }
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = vtime;
+    if (tcsetattr(m_fd, TCSANOW, &tio) != 0)
+    {
+        return ErrorInvalidSettings;
+    }
+
+    // VMIN AND VTIME ONLY APPLY TO BLOCKING READS
+    int flags = fcntl(m_fd, F_GETFL);
+    if (batching)
+    {
+        flags &= ~O_NONBLOCK;
+    }
+    else
+    {
+        flags |= O_NONBLOCK;
+    }
+    fcntl(m_fd, F_SETFL, flags);
+
+    if (!batching && (m_wr_fd != m_fd))
+    {
+        close(m_wr_fd);
+        m_wr_fd = m_fd;
+    }
+
+    // WHICHEVER DESCRIPTOR IS WRITTEN TO, Flush() RELIES ON IT NOT BLOCKING
+    fcntl(m_wr_fd, F_SETFL, fcntl(m_wr_fd, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+//!
+//! \brief Set a descriptor which interrupts a blocked Recv()
+//!
+//! When the descriptor becomes readable, Recv() returns ErrorWakeup
+//! (unless data is also waiting). The descriptor is typically the read
+//! end of a self-pipe or an eventfd; draining it is the caller's job.
+//!
+//! \param[in] fd The wake descriptor, or -1 to remove it
+//!
+//! \retval bool Always returns true
+//!
+//========================================================================
+bool UNIXSerialPort::SetWakeFd (int fd)
 {
 
+	m_wake_fd = fd;
+	return true;
 }
 
 //========================================================================
@@ -91,8 +286,8 @@ int32_t UNIXSerialPort::Open (const string& device)
         return ErrorPortInUse;
     }
 
-    m_fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
-    if (m_fd == -1)
+    int fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1)
     {
         return ErrorInvalidPort;
     }
@@ -109,8 +304,14 @@ int32_t UNIXSerialPort::Open (const string& device)
     newtio.c_cc[VTIME] = 0;
     newtio.c_cc[VMIN] = 1;
 
-    tcflush(m_fd, TCIFLUSH);
-    tcsetattr(m_fd, TCSANOW, &newtio);
+    tcflush(fd, TCIFLUSH);
+    tcsetattr(fd, TCSANOW, &newtio);
+
+    // Send() MAY BE CALLED FROM OTHER THREADS; IT SEES THE PORT ONCE IT IS READY
+    std::lock_guard<std::mutex> lk(m_tx_lock);
+    m_device = device;
+    m_fd = fd;
+    m_wr_fd = fd;
 
     return 0;
 }
@@ -119,70 +320,255 @@ int32_t UNIXSerialPort::Open (const string& device)
 void UNIXSerialPort::Close ()
 {
 
+    // NOT WHILE Send() OR Flush() IS USING THE DESCRIPTOR, WHICH COULD BE
+    // REUSED AS SOON AS IT IS CLOSED
+    std::lock_guard<std::mutex> lk(m_tx_lock);
+    if (m_wr_fd != m_fd)
+    {
+        close(m_wr_fd);
+    }
     if (m_fd != -1)
     {
         close(m_fd);
         m_fd = -1;
     }
+    m_wr_fd = -1;
+    m_txbuf.Clear();
+}
+
+//!
+//! \brief Write as much pending transmit data as the port will take
+//!
+//! The write descriptor must be non-blocking: a full driver then fails
+//! the write with EAGAIN and the rest stays in the ring, which is what
+//! lets Send() honour its timeout and never stall with m_tx_lock held.
+//! Open() opens the port that way and SetReadBatching() keeps it so.
+//!
+//! \retval bool Returns false if a write error occurred, or the port 
+//! has been closed
+//!
+//! \note Assumes the caller is holding m_tx_lock
+//!
+//========================================================================
+bool UNIXSerialPort::Flush ()
+{
+
+    if (m_fd == -1)
+    {
+        return false;
+    }
+
+    while (m_txbuf.GetReadLen() > 0u)
+    {
+        ssize_t n = write(m_wr_fd, m_txbuf.GetReadPtr(), m_txbuf.GetReadLen());
+        if (n > 0)
+        {
+            m_txbuf.MarkRead(static_cast<size_t>(n));
+        }
+        else if ((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            // THE DRIVER IS FULL; THE REST GOES WHEN THE PORT IS WRITABLE
+            break;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
+//!
+//! \brief Transmit data
+//!
+//! The data is appended to the transmit ring and as much of it as 
+//! possible is written out within the timeout. A block of data is
+//! either queued in its entirety or not at all, so a frame is never
+//! cut short by a partial write; whatever the driver cannot take now 
+//! is drained by later calls to Send() or Recv() as the port becomes 
+//! writable.
+//!
+//! \param[in] data The data to send
+//! \param[in] size Number of bytes to send
+//! \param[in] timeout Maximum time to wait (ms)
+//!
+//! \retval int32_t The number of bytes accepted (always size), or a 
+//! negative error code
+//!
 //========================================================================
 int32_t UNIXSerialPort::Send (const uint8_t* data, size_t size, uint32_t timeout)
 {
 
+    if (size > SERIAL_TX_RING_SIZE)
+    {
+        return ErrorTransmitError;
+    }
+
+    std::lock_guard<std::mutex> lk(m_tx_lock);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    struct pollfd pfd;
+
+    // CLOSE() TAKES THE LOCK TOO, SO THE DESCRIPTOR STAYS VALID UNTIL WE RETURN
     if (m_fd == -1)
     {
         return ErrorInvalidPort;
     }
 
-    fd_set fds;
-    int result;
-    timeval tv;
-    FD_ZERO(&fds);
-    FD_SET(m_fd, &fds);
-    tv.tv_sec = 0;
-    tv.tv_usec = timeout * 1000;
-    int n = select(m_fd + 1, 0, &fds, 0, &tv);
+    pfd.fd = m_wr_fd;
+    pfd.events = POLLOUT;
 
-    if (n == 0)
+    // MAKE ROOM FOR ALL OF THE DATA
+    if (!Flush())
+    {
+        return ErrorTransmitError;
+    }
+    while (m_txbuf.GetFreeLen() < size)
     {
-        return ErrorTimeout;
+        int wait = RemainingMs(deadline, timeout);
+        if (wait == 0)
+        {
+            return ErrorTimeout;
+        }
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, wait) < 0) && (errno != EINTR))
+        {
+            return ErrorTransmitError;
+        }
+        if (!Flush())
+        {
+            return ErrorTransmitError;
+        }
     }
 
-    result = write(m_fd, data, size);
-    if (result < 0)
+    if (m_txbuf.GetWriteLen() < size)
     {
-        return ErrorTransmitError;
+        m_txbuf.Compact();
     }
-    return result;
+    memcpy(m_txbuf.GetWritePtr(), data, size);
+    m_txbuf.MarkWritten(size);
+
+    // PUSH IT OUT
+    while (true)
+    {
+        if (!Flush())
+        {
+            return ErrorTransmitError;
+        }
+        if (m_txbuf.GetReadLen() == 0u)
+        {
+            break;
+        }
+
+        int wait = RemainingMs(deadline, timeout);
+        if (wait == 0)
+        {
+            LogWrite(LEVEL_DEBUG, "Serial TX: %u bytes left queued.", static_cast<unsigned>(m_txbuf.GetReadLen()));
+            break;
+        }
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, wait) < 0) && (errno != EINTR))
+        {
+            return ErrorTransmitError;
+        }
+    }
+
+    return static_cast<int32_t>(size);
 }
 
 //========================================================================
 int32_t UNIXSerialPort::Recv (uint8_t* data, size_t maxSize, uint32_t timeout)
 {
-    fd_set fds;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(
+        (timeout == TimeoutInfinite) ? 0u : timeout);
+    struct pollfd pfd[3];
+    nfds_t nfds = 1;
     int result;
-    timeval tv;
 
     if (m_fd == -1)
     {
         return ErrorInvalidPort;
     }
 
-    FD_ZERO(&fds);
-    FD_SET(m_fd, &fds);
-    tv.tv_sec = 0;
-    tv.tv_usec = timeout * 1000;
-    int n = select(m_fd + 1, &fds, 0, 0, &tv);
+    pfd[0].fd = m_fd;
+    if (m_wake_fd != -1)
+    {
+        pfd[1].fd = m_wake_fd;
+        pfd[1].events = POLLIN;
+        nfds = 2;
+    }
 
-    if (n == 0)
+    while (true)
     {
-        return ErrorTimeout;
+        // ALSO WATCH FOR WRITABILITY WHILE TRANSMIT DATA IS QUEUED
+        m_tx_lock.lock();
+        bool tx_pending = (m_txbuf.GetReadLen() > 0u);
+        int wr_fd = m_wr_fd;
+        m_tx_lock.unlock();
+
+        // WITH BATCHED READS THE WRITES GO THROUGH A DESCRIPTOR OF THEIR OWN
+        nfds_t tx = 0;
+        pfd[0].events = POLLIN;
+        if (tx_pending && (wr_fd == m_fd))
+        {
+            pfd[0].events |= POLLOUT;
+        }
+        else if (tx_pending)
+        {
+            tx = nfds;
+            pfd[tx].fd = wr_fd;
+            pfd[tx].events = POLLOUT;
+        }
+        pfd[0].revents = 0;
+        pfd[1].revents = 0;
+        pfd[2].revents = 0;
+        int n = poll(pfd, nfds + ((tx != 0) ? 1 : 0), RemainingMs(deadline, timeout));
+
+        if (n == 0)
+        {
+            return ErrorTimeout;
+        }
+        if (n < 0)
+        {
+            return (errno == EINTR) ? ErrorTimeout : ErrorReceiveError;
+        }
+
+        if ((tx != 0) && (pfd[tx].revents & (POLLHUP | POLLERR | POLLNVAL)))
+        {
+            return ErrorReceiveError;
+        }
+        if ((pfd[0].revents & POLLOUT) || ((tx != 0) && (pfd[tx].revents & POLLOUT)))
+        {
+            std::lock_guard<std::mutex> lk(m_tx_lock);
+            Flush();
+        }
+
+        // DATA TAKES PRIORITY; A PENDING WAKEUP WILL BE SEEN ON THE NEXT CALL
+        if (pfd[0].revents & ~POLLOUT)
+        {
+            break;
+        }
+        if ((nfds > 1) && (pfd[1].revents != 0))
+        {
+            return ErrorWakeup;
+        }
+        if (RemainingMs(deadline, timeout) == 0)
+        {
+            return ErrorTimeout;
+        }
     }
 
     result = read(m_fd, data, maxSize);
     if (result < 0)
     {
+        return (errno == EAGAIN) ? ErrorTimeout : ErrorReceiveError;
+    }
+    if ((result == 0) && (pfd[0].revents & (POLLHUP | POLLERR | POLLNVAL)))
+    {
+        // THE DEVICE HAS GONE AWAY (E.G. A USB ADAPTER WAS UNPLUGGED)
         return ErrorReceiveError;
     }
 
@@ -25,6 +25,19 @@
 #include "server.h"
 
 
+//========================================================================
+SERVER::~SERVER ()
+{
+
+#ifndef WIN32
+	if (m_wake_pipe[0] != -1)
+	{
+		close(m_wake_pipe[0]);
+		close(m_wake_pipe[1]);
+	}
+#endif
+}
+
 //!
 //! \brief Perform some initialization and then start listening on the
 //! master socket.
@@ -48,6 +61,17 @@ bool SERVER::OnStart ()
 	FD_SET(m_sock, &m_fds);
 	m_highsock = m_sock;
 
+#ifndef WIN32
+	// A SELF-PIPE LETS SHUTDOWN() INTERRUPT THE MAIN LOOP IMMEDIATELY
+	if ((m_wake_pipe[0] == -1) && (pipe(m_wake_pipe) == 0))
+	{
+		fcntl(m_wake_pipe[0], F_SETFL, fcntl(m_wake_pipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl(m_wake_pipe[1], F_SETFL, fcntl(m_wake_pipe[1], F_GETFL) | O_NONBLOCK);
+		FD_SET(m_wake_pipe[0], &m_fds);
+		m_highsock = std::max(m_highsock, m_wake_pipe[0]);
+	}
+#endif
+
     int on = 1;
     setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char*>(&on), sizeof(on));
 
@@ -106,6 +130,16 @@ void SERVER::OnRun ()
 		{
 			LogWrite(LEVEL_ERROR, "Error %d in select()", errno);
 		}
+
+#ifndef WIN32
+		if ((m_wake_pipe[0] != -1) && FD_ISSET(m_wake_pipe[0], &readfds))
+		{
+			uint8_t junk[64];
+			while (read(m_wake_pipe[0], junk, sizeof(junk)) > 0)
+			{
+			}
+		}
+#endif
         
         // CHECK FOR AN INCOMING CONNECTION REQUEST
         if (FD_ISSET(m_sock, &readfds))
@@ -187,6 +221,37 @@ void SERVER::OnExit ()
     }
 }
 
+//!
+//! \brief Wake the main loop so that it notices the shutdown request
+//!
+//========================================================================
+void SERVER::OnShutdown ()
+{
+
+	Wake();
+}
+
+//!
+//! \internal
+//! \brief Interrupt the main loop's select()
+//!
+//! Used when there is something for the main loop to do that select() 
+//! cannot see, e.g. data queued for a client by another thread.
+//!
+//========================================================================
+void SERVER::Wake ()
+{
+
+#ifndef WIN32
+	if (m_wake_pipe[1] != -1)
+	{
+		uint8_t c = 0u;
+		ssize_t rc = write(m_wake_pipe[1], &c, 1);
+		(void)rc;
+	}
+#endif
+}
+
 //!
 //! \brief Called when a new client attempts to connect.
 //! Accepts the connection and adds a new client object to the client list.
@@ -299,6 +364,33 @@ bool SERVER::Broadcast (const uint8_t* buf, uint8_t len)
 		m_clients.end(), 
 		[&buf, len, &result](CLIENT* c) { if (!c->Send(buf, len)) result = false; });
 
+	// THE MAIN LOOP TRANSMITS THE DATA; DON'T LEAVE IT WAITING IN select()
+	Wake();
+
 	return result;
 }
 
+
+//!
+//! \brief Send a message to selected clients.
+//!
+//! \param[in] buf The message to send.
+//! \param[in] len The number of bytes in the message.
+//! \param[in] filter Returns true for each client which should receive
+//! the message. It is called with the client list locked.
+//!
+//! \retval bool Returns true if the operation was successful.
+//!
+//========================================================================
+bool SERVER::Broadcast (const uint8_t* buf, uint8_t len, const std::function<bool(CLIENT*)>& filter)
+{
+	std::lock_guard<std::mutex> lk(m_mutex);
+	bool result = true;
+
+	std::for_each(m_clients.begin(), 
+		m_clients.end(), 
+		[&buf, len, &result, &filter](CLIENT* c) { if (filter(c) && !c->Send(buf, len)) result = false; });
+	Wake();
+
+	return result;
+}
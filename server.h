@@ -24,6 +24,7 @@
 #define _SERVER_H_
 
 #include "pch.h"
+#include <functional>
 #include <list>
 #include <mutex>
 #include "ctask.h"
@@ -42,17 +43,19 @@ using std::list;
 class SERVER : public sr::CTask
 {
 public:
-	SERVER() : m_bufsize(0u), m_port(0u), m_sock(-1) { FD_ZERO(&m_fds);  }
-	virtual ~SERVER () { }
+	SERVER() : m_bufsize(0u), m_port(0u), m_sock(-1) { FD_ZERO(&m_fds); m_wake_pipe[0] = m_wake_pipe[1] = -1; }
+	virtual ~SERVER ();
 	void SetBufferSize (uint32_t bufsize) { m_bufsize = bufsize; }
 	void SetPort (uint16_t port) { m_port = port; }
 	void SetLocalAddress (string addr) { m_addr = addr; };
 	bool OnStart ();
 	void OnRun ();
 	void OnExit ();
+	void OnShutdown ();
 
 protected:
 	bool Broadcast (const uint8_t* buf, uint8_t len);
+	bool Broadcast (const uint8_t* buf, uint8_t len, const std::function<bool(CLIENT*)>& filter);
 	virtual void OnNewClient(CLIENT* client);
 	virtual void OnDrop(CLIENT* client);
 	virtual void Drop (CLIENT* client);
@@ -61,6 +64,7 @@ protected:
 private:
 	virtual CLIENT* NewClient (SOCKET s) { return new CLIENT(s, m_bufsize); }
 	bool OnConnect();
+	void Wake();
 
 	string m_addr;				//!< Address of the local interface
 	uint16_t m_port;			//!< Local port number on which we listen
@@ -69,6 +73,7 @@ private:
 	SOCKET m_highsock;			//!< Highest socket in m_fds (needed for select())
 	list<CLIENT*> m_clients;	//!< List of currently attached clients
 	std::mutex m_mutex;			//!< Serializes access to the client list
+	int m_wake_pipe[2];			//!< Self-pipe which interrupts select() on shutdown or new TX data
 };
 
 #endif
@@ -24,6 +24,7 @@
 #include "sirserver.h"
 #include "sirclient.h"
 
+static std::atomic<uint64_t> s_next_id(1u);	// IDS ARE NEVER REUSED
 
 //!
 //! \brief Constructor
@@ -36,7 +37,7 @@
 //!
 //========================================================================
 CSirClient::CSirClient (CSirServer& server, SOCKET socket, uint32_t bufsize) : 
-	CLIENT(socket, bufsize), m_server(server)
+	CLIENT(socket, bufsize), m_server(server), m_radio(0u), m_id(s_next_id++)
 { 
 
 }
@@ -60,16 +61,24 @@ uint32_t CSirClient::ProcessData (uint8_t* buf, uint32_t len)
 	{
 		// SCAN UNTIL EOL
 		string line;
+		bool complete = false;
 		for (uint32_t i = 0u; (offset + i) < len; ++i)
 		{
 			if (buf[offset + i] == '\n')
 			{
 				m_server.ProcessCommand(this, line);
 				offset += (i + 1);
+				complete = true;
 				break;
 			}
 			line += buf[offset + i];
 		}
+
+		// LEAVE A PARTIAL LINE IN THE BUFFER UNTIL THE REST ARRIVES
+		if (!complete)
+		{
+			break;
+		}
 	}
 
 	return offset;
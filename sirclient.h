@@ -24,6 +24,7 @@
 #define _SIRCLIENT_H_
 
 #include "pch.h"
+#include <atomic>
 #include "client.h"
 
 class CSirServer;
@@ -38,6 +39,9 @@ class CSirClient : public CLIENT
 {
 public:
 	CSirClient (CSirServer& server, SOCKET socket, uint32_t bufsize);
+	uint32_t GetRadio () { return m_radio; }
+	void SetRadio (uint32_t radio) { m_radio = radio; }
+	uint64_t GetId () { return m_id; }
 
 protected:
     virtual uint32_t ProcessData (uint8_t* buf, uint32_t len);
@@ -46,6 +50,8 @@ private:
 	CSirClient ();
 
 	CSirServer& m_server;
+	std::atomic<uint32_t> m_radio;		//!< Radio addressed by this client's commands
+	const uint64_t m_id;				//!< Unique for the life of the daemon, unlike the object's address
 };
 
 #endif
@@ -26,6 +26,13 @@
 //!
 
 #include "pch.h"
+#include <algorithm>
+#ifndef WIN32
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include "sircon.h"
 
 //!< Number of 100ms timer ticks to wait for a busy-retransmit
@@ -34,6 +41,9 @@ static const uint32_t BUSY_DELAY_COUNT = 1;
 //!< Maximum number of seconds which can elapse without link traffic
 static const uint32_t LINK_TIMEOUT = 30;
 
+//!< Receive timeout (ms) if the serial port cannot be woken
+static const uint32_t RX_POLL_INTERVAL = 100;
+
 //!
 //! \brief Public constructor
 //!
@@ -42,24 +52,54 @@ static const uint32_t LINK_TIMEOUT = 30;
 //========================================================================
 CSirCon::CSirCon (const string& device) :
 	m_port(nullptr),
+	m_clock(sr::CClock::GetSystemClock()),
+	m_device(device),
+	m_attached(false),
+	m_low_latency(false),
+	m_batching(false),
+	m_vmin(0u),
+	m_vtime(0u),
+	m_in_esc(false),
 	m_stagebuf(SCP_STAGEBUFSIZE),
 	m_last_rx(0),
 	m_busy_timer(0),
 	m_seq(0u),
-	m_last_seq(-1),
 	m_seq_expected(0u),
+	m_seq_reset(false),
+	m_last_refresh(0),
 	m_htimer(sr::INVALID_TIMER_HANDLE_VALUE),
 	m_curr_channel(SCP_INVALID_CHANNEL),
+	m_tune_target(SCP_INVALID_CHANNEL),
+	m_mute_pending(false),
+	m_async_flags(0u),
 	m_link_alive(false),
-	m_link_fail_cnt(0u)
+	m_first_frame_pending(true),
+	m_link_silent(false),
+	m_link_fail_cnt(0u),
+	m_window(1u),
+	m_fault(nullptr),
+	m_wakeable(false)
 {
 
-	m_port = sr::CSerialPort::New();
+	m_wake_pipe[0] = m_wake_pipe[1] = -1;
+#ifndef WIN32
+	if (pipe(m_wake_pipe) == 0)
+	{
+		fcntl(m_wake_pipe[0], F_SETFL, fcntl(m_wake_pipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl(m_wake_pipe[1], F_SETFL, fcntl(m_wake_pipe[1], F_GETFL) | O_NONBLOCK);
+	}
+	else
+	{
+		m_wake_pipe[0] = m_wake_pipe[1] = -1;
+	}
+#endif
+
+	m_port = sr::CSerialPort::Create(device);
     if (m_port != 0)
     {
 		if (Open(device.c_str()))
 		{
-    		m_last_rx = time(0);
+    		m_last_rx = m_clock->GetSeconds();
 		}
 		else
 		{
@@ -79,6 +119,161 @@ CSirCon::~CSirCon ()
 		delete m_port;
 		m_port = 0;
 	}
+
+#ifndef WIN32
+	if (m_wake_pipe[0] != -1)
+	{
+		close(m_wake_pipe[0]);
+		close(m_wake_pipe[1]);
+	}
+#endif
+}
+
+//!
+//! \brief Insert a fault injector between the radio and the serial port
+//!
+//! The (already open) serial port is wrapped in a CFaultSerialPort
+//! which damages the data passing through it according to the given
+//! policy. This is a test facility; it must be called before Start().
+//!
+//! \param[in] policy The fault injection policy
+//!
+//! \retval bool Returns true if the fault injector was installed
+//!
+//========================================================================
+bool CSirCon::SetFaultPolicy (const sr::FAULTPOLICY& policy)
+{
+
+	if ((m_port == 0) || (m_fault != nullptr))
+	{
+		return false;
+	}
+
+	m_fault = new sr::CFaultSerialPort(m_port, policy);
+	m_port = m_fault;
+	return true;
+}
+
+//!
+//! \brief Replace the clock used for link timing
+//!
+//! The clock is passed on to the timer manager and the serial port, so
+//! that a simulated radio can run on virtual time. It must be set before
+//! Start().
+//!
+//! \param[in] clock The clock to use.
+//!
+//========================================================================
+void CSirCon::SetClock (sr::CClock* clock)
+{
+
+	m_clock = clock;
+	m_timer.SetClock(clock);
+	if (m_port != 0)
+	{
+		m_port->SetClock(clock);
+		m_last_rx = m_clock->GetSeconds();
+	}
+}
+
+//!
+//! \brief Set the transmit window size
+//!
+//! By default only one frame is in flight at a time (stop-and-wait).
+//! Larger windows allow several frames to be outstanding, which raises
+//! command throughput if the radio can buffer them. This is an
+//! experimental mode; it must be set before Start().
+//!
+//! \param[in] frames Maximum number of unacknowledged frames 
+//! (1 - SIRCON_MAX_WINDOW)
+//!
+//========================================================================
+void CSirCon::SetTxWindow (uint32_t frames)
+{
+
+	m_window = std::max(1u, std::min(frames, SIRCON_MAX_WINDOW));
+}
+
+//!
+//! \brief Enable the serial driver's low latency mode
+//!
+//! Recommended for USB-serial adapters such as the TTS-100, which 
+//! otherwise add several milliseconds to every read. Must be called 
+//! before Start().
+//!
+//! \param[in] on True to enable low latency mode
+//!
+//! \retval bool Returns true if the port accepted the setting
+//!
+//========================================================================
+bool CSirCon::SetLowLatency (bool on)
+{
+
+	if (m_port == 0)
+	{
+		return false;
+	}
+	m_low_latency = on;
+	return (m_port->SetLowLatency(on) == 0);
+}
+
+//!
+//! \brief Configure serial read batching
+//!
+//! Larger batches mean fewer wakeups during metadata floods at the 
+//! cost of up to vtime tenths of a second of added latency per read.
+//! Must be called before Start().
+//!
+//! \param[in] vmin Minimum number of bytes per read
+//! \param[in] vtime Inter-byte timeout (tenths of a second)
+//!
+//! \retval bool Returns true if the port accepted the setting
+//!
+//========================================================================
+bool CSirCon::SetReadBatching (uint8_t vmin, uint8_t vtime)
+{
+
+	if (m_port == 0)
+	{
+		return false;
+	}
+	m_batching = true;
+	m_vmin = vmin;
+	m_vtime = vtime;
+	return (m_port->SetReadBatching(vmin, vtime) == 0);
+}
+
+//!
+//! \brief Retrieve a snapshot of the link counters
+//!
+//! \param[out] stats The link counters
+//!
+//========================================================================
+void CSirCon::GetLinkStats (SCLINKSTATS& stats)
+{
+	std::lock_guard<std::mutex> lk(m_stats_lock);
+
+	stats = m_stats;
+}
+
+//!
+//! \brief Retrieve the count of injected faults
+//!
+//! \param[out] rx Faults injected into data received from the radio
+//! \param[out] tx Faults injected into data sent to the radio
+//!
+//! \retval bool Returns false if no fault injector is installed
+//!
+//========================================================================
+bool CSirCon::GetFaultStats (sr::FAULTSTATS& rx, sr::FAULTSTATS& tx)
+{
+
+	if (m_fault == nullptr)
+	{
+		return false;
+	}
+	m_fault->GetStats(rx, tx);
+	return true;
 }
 
 //!
@@ -94,7 +289,7 @@ uint32_t CSirCon::GetTimeSinceLastRx ()
 
 	if (m_last_rx != 0)
 	{
-		time_t now = time(0);
+		time_t now = m_clock->GetSeconds();
 
 		retval = static_cast<uint32_t>(difftime(now, m_last_rx));
 	}
@@ -135,13 +330,15 @@ void CSirCon::Close ()
 //! \param[in,out] buf A pointer to the output buffer 
 //! \param[in] maxlen Size (in bytes) of the output buffer
 //! \param[out] bytesread Number of bytes actually read
+//! \param[in] timeout Maximum time to wait for data (ms)
 //!
 //! \retval bool Returns true if successful, or false if an error occurs
 //!
+//! \note A wakeup (see Wake()) ends the wait early with no data read.
+//!
 //========================================================================
-bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread)
+bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread, uint32_t timeout)
 {
-	static bool inESC = false;  // TRUE IF CURRENTLY IN AN ESCAPE SEQUENCE
     uint8_t tmpbuf[SCP_STAGEBUFSIZE];
     int32_t bytes = 0;
 
@@ -150,12 +347,23 @@ bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread)
     *bytesread = 0;
 
     // READ THE RAW DATA FROM THE RADIO INTO A TEMPORARY BUFFER
-    if ((bytes = m_port->Recv(tmpbuf, maxlen, 100U)) < 0)
+    if ((bytes = m_port->Recv(tmpbuf, maxlen, timeout)) < 0)
     {
 		if (bytes == sr::CSerialPort::ErrorTimeout)
 		{
 			return true;
 		}
+		if (bytes == sr::CSerialPort::ErrorWakeup)
+		{
+#ifndef WIN32
+			// DRAIN THE WAKE PIPE
+			uint8_t junk[64];
+			while (read(m_wake_pipe[0], junk, sizeof(junk)) > 0)
+			{
+			}
+#endif
+			return true;
+		}
 		LogWrite(LEVEL_ERROR, "Read() returned %d", bytes);
 		return false;
     }
@@ -166,21 +374,21 @@ bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread)
 		// CHECK FOR ESCAPE SEQUENCE
         if (tmpbuf[i] == ASCII_ESC)
         {
-            if (inESC)
+            if (m_in_esc)
             {
                 // THIS IS AN ESCAPED ESC
                 buf[(*bytesread)++] = ASCII_ESC;
-                inESC = false;
+                m_in_esc = false;
             }
             else
             {
                 // THIS IS THE FIRST BYTE OF AN ESCAPE SEQUENCE
-                inESC = true;
+                m_in_esc = true;
             }
         }
         else
         {
-            if (inESC)
+            if (m_in_esc)
             {
                 switch (tmpbuf[i])
                 {
@@ -194,7 +402,7 @@ bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread)
                                  tmpbuf[i]);
                     break;
                 }
-                inESC = false;
+                m_in_esc = false;
             }
             else
             {
@@ -205,7 +413,10 @@ bool CSirCon::Read (uint8_t* buf, uint32_t maxlen, uint32_t* bytesread)
 
     if (bytes > 0)
     {
-    	m_last_rx = time(0);
+    	m_last_rx = m_clock->GetSeconds();
+
+		std::lock_guard<std::mutex> lk(m_stats_lock);
+		m_stats.rx_bytes += bytes;
     }
     return true;
 }
@@ -436,6 +647,10 @@ void CSirCon::TimerProcWrapper (void* param)
 //! This function is invoked periodically from the timer thread to 
 //! (re)transmit pending frames to the radio.
 //!
+//! Each frame in the transmit window is (re)sent on every tick until it
+//! is acknowledged or its retries are exhausted. With the default window
+//! of one frame this is classic stop-and-wait.
+//!
 //========================================================================
 void CSirCon::TimerProc ()
 {
@@ -448,21 +663,37 @@ void CSirCon::TimerProc ()
     }
 
 	m_queue_lock.lock();
-	if (!m_queue.empty())
+	uint32_t slots = 0u;
+	size_t i = 0u;
+	while ((slots < m_window) && (i < m_queue.size()))
 	{
-		MSGBUFPTR bufptr = m_queue.front();
+		MSGBUFPTR bufptr = m_queue[i];
 
+		slots++;
 		if (++bufptr->retries > SIRCON_MAX_RETRIES)
 		{
 			// GIVING UP ON THIS FRAME
-			m_queue.pop();
+			m_queue.erase(m_queue.begin() + i);
 			OnTimeout(bufptr);
 			BufFree(bufptr);
 		}
 		else
 		{
 			LogWrite(LEVEL_DEBUG, "Transmitting frame %02x...", bufptr->seq);
+			{
+				std::lock_guard<std::mutex> lk(m_stats_lock);
+				if (bufptr->retries == 1u)
+				{
+					bufptr->sent = m_clock->Now();
+					m_stats.tx_frames++;
+				}
+				else
+				{
+					m_stats.tx_retries++;
+				}
+			}
 			TransmitFrame(bufptr);
+			i++;
 		}
 	}
 	m_queue_lock.unlock();
@@ -471,14 +702,46 @@ void CSirCon::TimerProc ()
 //!
 //! \brief Handler for frame acknowledgements.
 //!
+//! \retval SCP_CHANNEL_INDEX The channel being tuned if the frame was a
+//! SET CHANNEL request, otherwise SCP_INVALID_CHANNEL.
+//!
+//! \note Called with m_queue_lock held, so observers are not notified 
+//! here; the caller raises SCETuneAccepted once the lock is released.
+//!
 //========================================================================
-void CSirCon::OnACK(MSGBUFPTR bufptr)
+SCP_CHANNEL_INDEX CSirCon::OnACK(MSGBUFPTR bufptr)
 {
 
 	LogWrite(LEVEL_DEBUG, "ACK received for seq %02x", bufptr->seq);
 
+	{
+		std::lock_guard<std::mutex> lk(m_stats_lock);
+		uint32_t latency = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+			m_clock->Now() - bufptr->sent).count());
+
+		if ((m_stats.tx_acked == 0u) || (latency < m_stats.ack_min_ms))
+		{
+			m_stats.ack_min_ms = latency;
+		}
+		if (latency > m_stats.ack_max_ms)
+		{
+			m_stats.ack_max_ms = latency;
+		}
+		m_stats.ack_total_ms += latency;
+		m_stats.tx_acked++;
+	}
+
 	// INFORM THE APPLICATION OF THE RESULT
 	bufptr->result.set_value(SCR_SUCCESS);
+
+	// LET OBSERVERS GET A HEAD START ON A TUNE
+	uint8_t* payload = bufptr->data + sizeof(SHDR);
+	if ((payload[0] == MSG_SET) && (payload[1] == SCP_SET_CHANNEL))
+	{
+		return payload[2];
+	}
+
+	return SCP_INVALID_CHANNEL;
 }
 
 //!
@@ -504,9 +767,27 @@ void CSirCon::OnTimeout (MSGBUFPTR bufptr)
 
 	LogWrite(LEVEL_DEBUG, "Transmission timed out for seq %02x", bufptr->seq);
 
+	{
+		std::lock_guard<std::mutex> lk(m_stats_lock);
+		m_stats.tx_timeouts++;
+	}
+
 	// INFORM THE APPLICATION OF THE RESULT
 	bufptr->result.set_value(SCR_TIMEOUT);
 
+	// A MISSING DEVICE IS HANDLED BY Reattach(), NOT BY GIVING UP
+	if (!m_attached)
+	{
+		return;
+	}
+
+	// LET THE RX THREAD DECIDE WHETHER THE DEVICE NEEDS PREPARING AGAIN
+	if (m_first_frame_pending)
+	{
+		m_link_silent = true;
+		Wake();
+	}
+
 	m_link_alive = false;
 	if (++m_link_fail_cnt > SIRCON_MAX_LINK_FAILURES)
 	{
@@ -532,13 +813,18 @@ bool CSirCon::OnStart ()
 		return false;
 	}
 
+	// PREPARE THE DEVICE
+	m_attach_start = m_clock->Now();
+	if (!OnAttach())
+	{
+		return false;
+	}
+	m_attached = true;
+
     // CREATE THE RETRANSMISSION TIMER
     m_htimer = m_timer.Create(100, this, TimerProcWrapper);
     m_timer.Start();
 
-    // RESET THE RADIO
-    SetDataRate(57600);
-
 	// NOTIFY THE APPLICATION
 	SCEStartup s;
 	Notify(s);
@@ -546,6 +832,43 @@ bool CSirCon::OnStart ()
     return true;
 }
 
+//!
+//! \brief Prepare a freshly opened serial device for SCP traffic
+//!
+//! Called from OnStart() and again whenever the device is reopened 
+//! after having been unplugged. Interfaces which need a handshake 
+//! before the radio can be reached override this, and call it once 
+//! the handshake is complete.
+//!
+//! \retval bool Returns true if the device is ready for use
+//!
+//========================================================================
+bool CSirCon::OnAttach ()
+{
+
+	// LET THE RX THREAD SLEEP UNTIL THERE IS SOMETHING FOR IT TO DO
+	m_wakeable = (m_wake_pipe[0] != -1) && m_port->SetWakeFd(m_wake_pipe[0]);
+	if (!m_wakeable)
+	{
+		LogWrite(LEVEL_INFO, "Serial port is not wakeable; polling every %ums.", RX_POLL_INTERVAL);
+	}
+
+	// REAPPLY ANY DRIVER TUNING; THE SETTINGS DO NOT SURVIVE A REOPEN
+	if (m_low_latency)
+	{
+		m_port->SetLowLatency(true);
+	}
+	if (m_batching)
+	{
+		m_port->SetReadBatching(m_vmin, m_vtime);
+	}
+
+    // RESET THE RADIO
+    SetDataRate(57600);
+
+	return true;
+}
+
 //!
 //! \brief Main loop of the CSirCon object
 //!
@@ -561,12 +884,23 @@ void CSirCon::OnRun ()
         uint32_t resync = 0U;
         uint32_t bytes;
 
+		// THE DEVICE HAS NEVER ANSWERED; MAYBE IT WAS PREPARED THE WRONG WAY
+		if (m_link_silent.exchange(false) && OnSilentLink() && !Reprepare())
+		{
+			break;
+		}
+
         assert(m_stagebuf.GetWriteLen() > 0U);
 
 		// RETRIEVE ALL AVAILABLE DATA FROM THE RADIO
-        if (!Read(m_stagebuf.GetWritePtr(), m_stagebuf.GetWriteLen(), &bytes))
+        if (!Read(m_stagebuf.GetWritePtr(), m_stagebuf.GetWriteLen(), &bytes, GetRxTimeout()))
         {
-            break;
+			// THE DEVICE HAS PROBABLY BEEN UNPLUGGED; WAIT FOR IT TO RETURN
+			if (IsShutdown() || !Reattach())
+			{
+				break;
+			}
+			continue;
         }
 
         m_stagebuf.MarkWritten(bytes);
@@ -597,7 +931,7 @@ void CSirCon::OnRun ()
 					GetRSSI();
 
 					// AND RESET THE ACTIVITY TIMER
-					m_last_rx = time(0);
+					m_last_rx = m_clock->GetSeconds();
 				}
 			}
         }
@@ -621,6 +955,9 @@ void CSirCon::OnRun ()
             if (resync > 0U)
             {
 				LogWrite(LEVEL_WARNING, "Resync bytes = %u", resync);
+
+				std::lock_guard<std::mutex> lk(m_stats_lock);
+				m_stats.rx_resync += resync;
                 resync = 0;
             }
 
@@ -640,6 +977,20 @@ void CSirCon::OnRun ()
                          hdrptr->flags, 
                          hdrptr->len);
 
+				m_stats_lock.lock();
+				m_stats.rx_frames++;
+				if (hdrptr->flags & SF_ACK)
+				{
+					m_stats.rx_acks++;
+				}
+				if (m_first_frame_pending)
+				{
+					m_first_frame_pending = false;
+					m_stats.first_frame_ms = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(m_clock->Now() - m_attach_start).count());
+					LogWrite(LEVEL_INFO, "First frame from %s after %ums.", m_device.c_str(), m_stats.first_frame_ms);
+				}
+				m_stats_lock.unlock();
+
                 // WAS THIS AN ACKNOWLEDGEMENT?
                 if (hdrptr->flags & SF_ACK)
                 {
@@ -648,16 +999,22 @@ void CSirCon::OnRun ()
 							 hdrptr->flags,
 							 hdrptr->seq);
 
+					// FIND THE IN-FLIGHT FRAME BEING ACKNOWLEDGED
+					SCP_CHANNEL_INDEX tuning = SCP_INVALID_CHANNEL;
 					m_queue_lock.lock();
-					if (!m_queue.empty())
+					for (size_t i = 0u; (i < m_window) && (i < m_queue.size()); ++i)
 					{
-						MSGBUFPTR bufptr = m_queue.front();
-						if (hdrptr->seq == bufptr->seq)
+						MSGBUFPTR bufptr = m_queue[i];
+						if ((hdrptr->seq == bufptr->seq) && (bufptr->retries > 0u))
 						{
 							if (hdrptr->flags & SF_CHKSUM)
 							{
 								// CRC CHECK FAILED - RETRANSMIT IMMEDIATELY
 								LogWrite(LEVEL_DEBUG, "Bad CRC reported - resending now...");
+								m_stats_lock.lock();
+								m_stats.tx_naks_chksum++;
+								m_stats.tx_retries++;
+								m_stats_lock.unlock();
 								TransmitFrame(bufptr);
 							}
 							else if (hdrptr->flags & SF_BUSY)
@@ -665,37 +1022,81 @@ void CSirCon::OnRun ()
 								// RADIO IS BUSY - SCHEDULE A RETRANSMISSION ON THE NEXT TICK
 								LogWrite(LEVEL_DEBUG, "Radio is busy, resending later...");
 								m_busy_timer = BUSY_DELAY_COUNT;
+								m_stats_lock.lock();
+								m_stats.tx_naks_busy++;
+								m_stats_lock.unlock();
 							}
 							else
 							{
 								// RADIO RECEIVED THE FRAME OK
-								OnACK(bufptr);
-								m_queue.pop();
+								tuning = OnACK(bufptr);
+								m_queue.erase(m_queue.begin() + i);
 								BufFree(bufptr);
 							}
+							break;
 						}
 					}
 					m_queue_lock.unlock();
+
+					// OBSERVERS MAY SEND TO THE RADIO, SO ONLY NOTIFY THEM 
+					// ONCE THE QUEUE IS UNLOCKED
+					if (tuning != SCP_INVALID_CHANNEL)
+					{
+						SCETuneAccepted t;
+
+						t.channel = tuning;
+						Notify(t);
+					}
                 }
                 else
                 {
                     LogWrite(LEVEL_DEBUG, "Sending ACK for sequence %02x", hdrptr->seq);
                     SendACK(hdrptr->seq, SF_ACK);
 
-					if (hdrptr->seq != m_last_seq)
+					// A RADIO WHICH HAS RESTARTED NUMBERS ITS FRAMES AFRESH,
+					// AND MAY REUSE NUMBERS WHICH ARE STILL IN THE HISTORY
+					uint8_t* payload = m_stagebuf.GetReadPtr() + sizeof(SHDR);
+					if (m_seq_reset.exchange(false) || 
+						((hdrptr->len >= 2u) && (payload[0] == MSG_ASYNC) && (payload[1] == SCP_ASYNC_RESET)))
+					{
+						ResetSequence();
+					}
+
+					uint8_t expected = m_seq_expected;
+					uint32_t lost = 0u;
+					SCSEQCLASS sc = ClassifySequence(hdrptr->seq, lost);
+
+					if (sc != SEQ_DUPLICATE)
 					{
 						Dispatch(m_stagebuf.GetReadPtr() + sizeof(SHDR), hdrptr->len);
-						if (hdrptr->seq != m_seq_expected)
+						if (sc != SEQ_INORDER)
 						{
-							LogWrite(LEVEL_DEBUG, "Sequence error: expected %u, actual %u", static_cast<unsigned>(m_seq_expected), static_cast<unsigned>(hdrptr->seq));
+							LogWrite(LEVEL_DEBUG, "Sequence error: expected %u, actual %u", static_cast<unsigned>(expected), static_cast<unsigned>(hdrptr->seq));
+
+							m_stats_lock.lock();
+							m_stats.rx_seq_errors++;
+							if (sc == SEQ_GAP)
+							{
+								m_stats.rx_gaps++;
+								m_stats.rx_lost += lost;
+							}
+							else
+							{
+								m_stats.rx_seq_resyncs++;
+							}
+							m_stats_lock.unlock();
+
+							// SOMETHING WAS MISSED - RECOVER WHATEVER STATE IT MAY HAVE CARRIED
+							RefreshState();
 						}
 					}
 					else
 					{
 						LogWrite(LEVEL_DEBUG, "Ignoring duplicate frame.");
+
+						std::lock_guard<std::mutex> lk(m_stats_lock);
+						m_stats.rx_dups++;
 					}
-					m_last_seq = hdrptr->seq;
-					m_seq_expected = (hdrptr->seq + 1) % 256;
 
                     // RESET THE BUSY TIMER
                     m_busy_timer = 0;
@@ -704,6 +1105,9 @@ void CSirCon::OnRun ()
             else
             {
                 LogWrite(LEVEL_DEBUG, "Invalid chksum!");
+				m_stats_lock.lock();
+				m_stats.rx_chksum++;
+				m_stats_lock.unlock();
 				SendACK(hdrptr->seq, SF_ACK | SF_CHKSUM);
                 msglen = 1;                   // FORCE A RESYNC
             }
@@ -716,6 +1120,271 @@ void CSirCon::OnRun ()
     LogWrite(LEVEL_DEBUG, "CSirCon::OnRun() exiting.");
 }
 
+//!
+//! \brief Wake the RX thread so that it notices the shutdown request
+//!
+//========================================================================
+void CSirCon::OnShutdown ()
+{
+
+	Wake();
+}
+
+//!
+//! \brief Interrupt a Read() blocked in the RX thread
+//!
+//========================================================================
+void CSirCon::Wake ()
+{
+
+#ifndef WIN32
+	if (m_wake_pipe[1] != -1)
+	{
+		uint8_t c = 0u;
+		ssize_t rc = write(m_wake_pipe[1], &c, 1);
+		(void)rc;	// A FULL PIPE WILL WAKE THE THREAD ANYWAY
+	}
+#endif
+}
+
+//!
+//! \brief Compute how long the RX thread may block waiting for data
+//!
+//! If the port can be woken there is no reason to wake up until the
+//! keepalive probe is due (or never, if the link is down and no probe 
+//! will be sent). Otherwise fall back to polling.
+//!
+//! \retval uint32_t Receive timeout (ms)
+//!
+//========================================================================
+uint32_t CSirCon::GetRxTimeout ()
+{
+
+	if (!m_wakeable)
+	{
+		return RX_POLL_INTERVAL;
+	}
+	if (!m_link_alive)
+	{
+		return sr::CSerialPort::TimeoutInfinite;
+	}
+
+	uint32_t idle = GetTimeSinceLastRx();
+	if (idle > LINK_TIMEOUT)
+	{
+		return 0u;
+	}
+	return (LINK_TIMEOUT + 1u - idle) * 1000u;
+}
+
+//!
+//! \brief Recover from the loss of the serial device
+//!
+//! Frames awaiting transmission are failed, the port is closed and 
+//! observers are told that the device has gone. Once the device node
+//! reappears it is reopened and prepared exactly as it was at startup 
+//! (including TTS-100 detection), the RX state is reset and the 
+//! requested async notifications are re-enabled.
+//!
+//! \retval bool Returns true once the device is back, or false if a
+//! shutdown was requested while waiting for it
+//!
+//========================================================================
+bool CSirCon::Reattach ()
+{
+
+	LogWrite(LEVEL_WARNING, "Lost serial device %s; waiting for it to return.", m_device.c_str());
+
+	m_attached = false;
+	m_link_alive = false;
+	m_first_frame_pending = true;
+	FailQueuedFrames();
+	Close();
+
+	SCEDetached d;
+	Notify(d);
+
+	if (!WaitForDevice())
+	{
+		return false;
+	}
+
+	LogWrite(LEVEL_INFO, "Serial device %s reattached.", m_device.c_str());
+	Resume();
+	return true;
+}
+
+//!
+//! \brief Prepare the device again without closing it
+//!
+//! Used when the device has never answered and OnSilentLink() suspects
+//! it was prepared for the wrong interface. Frames awaiting transmission
+//! are failed, OnAttach() is run again and observers are told that the
+//! device has been reattached, so that the application starts over.
+//!
+//! \retval bool Returns false if a shutdown was requested while the 
+//! device could not be prepared
+//!
+//========================================================================
+bool CSirCon::Reprepare ()
+{
+
+	LogWrite(LEVEL_WARNING, "No response from %s; preparing it again.", m_device.c_str());
+
+	m_attached = false;
+	m_link_alive = false;
+	FailQueuedFrames();
+
+	m_first_frame_pending = true;
+	m_attach_start = m_clock->Now();
+	if (!OnAttach())
+	{
+		return Reattach();
+	}
+
+	Resume();
+	return true;
+}
+
+//!
+//! \internal
+//! \brief Reset the RX state of a newly prepared device and tell the 
+//! application that it is back
+//!
+//========================================================================
+void CSirCon::Resume ()
+{
+
+	// START AFRESH
+	m_stagebuf.Clear();
+	m_in_esc = false;
+	ResetSequence();
+	m_busy_timer = 0u;
+	m_link_fail_cnt = 0u;
+	m_last_rx = m_clock->GetSeconds();
+	m_attached = true;
+
+	SCEAttached a;
+	Notify(a);
+
+	m_cache_lock.lock();
+	uint8_t flags = m_async_flags;
+	m_cache_lock.unlock();
+	if (flags != 0u)
+	{
+		EnableAsyncNotifications(flags);
+	}
+}
+
+//!
+//! \brief Wait for the serial device to reappear and reopen it
+//!
+//! On Linux the device's directory is watched with inotify so that the
+//! device is reopened as soon as its node is created (or its permissions
+//! are fixed up by udev). The device is also retried every 
+//! SIRCON_REATTACH_INTERVAL ms, which covers platforms without inotify
+//! and directories (e.g. /dev/serial/by-id) which vanish along with the
+//! device.
+//!
+//! \retval bool Returns true if the device was reopened and prepared,
+//! or false if a shutdown was requested
+//!
+//========================================================================
+bool CSirCon::WaitForDevice ()
+{
+	bool attached = false;
+
+#ifdef __linux__
+	// NETWORK DEVICES HAVE NOTHING TO WATCH; JUST KEEP TRYING TO RECONNECT
+	int ifd = (m_device.find("://") == string::npos) ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+	if (ifd != -1)
+	{
+		string dir = m_device;
+		size_t slash = dir.find_last_of('/');
+
+		dir = (slash == string::npos) ? string(".") : dir.substr(0u, std::max<size_t>(slash, 1u));
+		if (inotify_add_watch(ifd, dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) == -1)
+		{
+			LogWrite(LEVEL_DEBUG, "Cannot watch %s; polling for the device.", dir.c_str());
+		}
+	}
+#endif
+
+	while (!attached && !IsShutdown())
+	{
+		if (Open(m_device.c_str()))
+		{
+			m_attach_start = m_clock->Now();
+			if (OnAttach())
+			{
+				attached = true;
+				break;
+			}
+			Close();
+		}
+
+#ifndef WIN32
+		struct pollfd pfd[2];
+		nfds_t nfds = 0;
+
+		if (m_wake_pipe[0] != -1)
+		{
+			pfd[nfds].fd = m_wake_pipe[0];
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+			nfds++;
+		}
+#ifdef __linux__
+		if (ifd != -1)
+		{
+			pfd[nfds].fd = ifd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+			nfds++;
+		}
+#endif
+		poll(pfd, nfds, SIRCON_REATTACH_INTERVAL);
+
+		// DISCARD THE WAKEUPS AND DIRECTORY EVENTS; ANY OF THEM MEANS "TRY AGAIN"
+		uint8_t junk[512];
+		for (nfds_t i = 0; i < nfds; ++i)
+		{
+			while ((pfd[i].revents & POLLIN) && (read(pfd[i].fd, junk, sizeof(junk)) > 0))
+			{
+			}
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(SIRCON_REATTACH_INTERVAL));
+#endif
+	}
+
+#ifdef __linux__
+	if (ifd != -1)
+	{
+		close(ifd);
+	}
+#endif
+	return attached;
+}
+
+//!
+//! \brief Fail every frame waiting to be (re)transmitted
+//!
+//========================================================================
+void CSirCon::FailQueuedFrames ()
+{
+	std::lock_guard<std::mutex> lk(m_queue_lock);
+
+	while (!m_queue.empty())
+	{
+		MSGBUFPTR bufptr = m_queue.front();
+
+		m_queue.pop_front();
+		bufptr->result.set_value(SCR_TIMEOUT);
+		BufFree(bufptr);
+	}
+}
+
 //========================================================================
 void CSirCon::OnExit ()
 {
@@ -731,7 +1400,7 @@ void CSirCon::OnExit ()
     while (!m_queue.empty())
     {
         MSGBUFPTR bufptr = m_queue.front();
-        m_queue.pop();
+        m_queue.pop_front();
         delete bufptr;
     }
     m_queue_lock.unlock();
@@ -783,12 +1452,20 @@ void CSirCon::BufFree(MSGBUFPTR bufptr)
 std::future<SCRESULT> CSirCon::Send (uint8_t* data, uint32_t len)
 {
 
+	if (!m_attached)
+	{
+		std::promise<SCRESULT> p;
+
+		p.set_value(SCR_TIMEOUT);
+		return (p.get_future());
+	}
+
 	try
 	{
 		MSGBUFPTR bufptr = ComposeFrame(data, len);
 		std::lock_guard<std::mutex> lk(m_queue_lock);
 
-		m_queue.push(bufptr);
+		m_queue.push_back(bufptr);
 		return bufptr->result.get_future();
 	}
 	catch (std::bad_alloc&)
@@ -801,6 +1478,126 @@ std::future<SCRESULT> CSirCon::Send (uint8_t* data, uint32_t len)
 	}
 }
 
+//!
+//! \brief Classify the sequence number of an incoming (non-ACK) frame
+//!
+//! A window of recently received sequence numbers is kept so that 
+//! retransmissions are recognized even if other frames arrived in 
+//! between. A forward jump of less than SIRCON_MAX_SEQ_GAP means that 
+//! frames were lost; anything else is treated as a resync and becomes 
+//! the new baseline.
+//!
+//! \param[in] seq The sequence number of the frame
+//! \param[out] lost The number of frames lost (SEQ_GAP only)
+//!
+//! \retval SCSEQCLASS The classification of the frame
+//!
+//========================================================================
+SCSEQCLASS CSirCon::ClassifySequence (uint8_t seq, uint32_t& lost)
+{
+	SCSEQCLASS sc = SEQ_INORDER;
+
+	lost = 0u;
+	if (!m_seq_history.empty() && (seq != m_seq_expected))
+	{
+		if (std::find(m_seq_history.begin(), m_seq_history.end(), seq) != m_seq_history.end())
+		{
+			// ALREADY SEEN; NOTHING TO UPDATE
+			return SEQ_DUPLICATE;
+		}
+
+		uint32_t distance = static_cast<uint8_t>(seq - m_seq_expected);
+		if (distance < SIRCON_MAX_SEQ_GAP)
+		{
+			sc = SEQ_GAP;
+			lost = distance;
+		}
+		else
+		{
+			sc = SEQ_RESYNC;
+		}
+	}
+
+	m_seq_history.push_back(seq);
+	if (m_seq_history.size() > SIRCON_SEQ_HISTORY)
+	{
+		m_seq_history.pop_front();
+	}
+	m_seq_expected = static_cast<uint8_t>(seq + 1u);
+
+	return sc;
+}
+
+//!
+//! \brief Forget the sequence numbers received so far
+//!
+//! Used when the radio restarts, so that its first frames are not taken
+//! for retransmissions of frames seen before the restart.
+//!
+//========================================================================
+void CSirCon::ResetSequence ()
+{
+
+	m_seq_history.clear();
+	m_seq_expected = 0u;
+}
+
+//!
+//! \brief Recover state which may have been carried by lost frames
+//!
+//! The content of a lost frame is unknown, so this issues the minimal 
+//! set of GETs needed to refresh whatever the radio might have been 
+//! telling us: the outcome of a tune or mute change that has not been 
+//! confirmed, and the current song info if async notifications are 
+//! enabled. Refreshes are limited to one per second so that a noisy 
+//! link does not turn into a request storm.
+//!
+//========================================================================
+void CSirCon::RefreshState ()
+{
+	SCP_CHANNEL_INDEX tune_target;
+	SCP_CHANNEL_INDEX channel;
+	bool mute_pending;
+	uint8_t async_flags;
+	time_t now = m_clock->GetSeconds();
+
+	if (now == m_last_refresh)
+	{
+		return;
+	}
+	m_last_refresh = now;
+
+	m_cache_lock.lock();
+	tune_target = m_tune_target;
+	channel = m_curr_channel;
+	mute_pending = m_mute_pending;
+	async_flags = m_async_flags;
+	m_cache_lock.unlock();
+
+	if (tune_target != SCP_INVALID_CHANNEL)
+	{
+		// THE TUNE CONFIRMATION MAY HAVE BEEN LOST
+		LogWrite(LEVEL_INFO, "Refreshing channel after lost frame(s).");
+		GetChannel();
+		GetChannelInfo(tune_target);
+	}
+	else if ((async_flags & (AF_CHANNELINFO | AF_ALLCHANNELINFO)) && (channel != SCP_INVALID_CHANNEL))
+	{
+		// A SONG CHANGE NOTIFICATION MAY HAVE BEEN LOST
+		LogWrite(LEVEL_INFO, "Refreshing song info after lost frame(s).");
+		GetSongInfo(channel);
+	}
+
+	if (mute_pending)
+	{
+		LogWrite(LEVEL_INFO, "Refreshing mute state after lost frame(s).");
+		GetMute();
+	}
+
+	std::lock_guard<std::mutex> lk(m_stats_lock);
+	m_stats.refreshes++;
+}
+
 //!
 //! \brief Dispatch a message from the radio to the appropriate handler 
 //! function
@@ -897,6 +1694,7 @@ void CSirCon::DispatchAsync (uint8_t* data, uint32_t len)
 
 					c.deserialize(data + 4, len - 4);
 					m_curr_channel = c.channel;
+					m_tune_target = SCP_INVALID_CHANNEL;
 					Notify(c);
 				}
 				break;
@@ -979,6 +1777,10 @@ void CSirCon::DispatchGetResponse (uint8_t* data, uint32_t len)
 			{
 				SCEMute m;
 
+				m_cache_lock.lock();
+				m_mute_pending = false;
+				m_cache_lock.unlock();
+
 				m.deserialize(data + 4, len - 4);
 				Notify(m);
 			}
@@ -1000,6 +1802,7 @@ void CSirCon::DispatchGetResponse (uint8_t* data, uint32_t len)
 
 				c.deserialize(data + 4, len - 4);
 				m_curr_channel = c.channel;
+				m_tune_target = SCP_INVALID_CHANNEL;
 				Notify(c);
 			}
 			break;
@@ -1114,8 +1917,23 @@ void CSirCon::DispatchSetResponse (uint8_t* data, uint32_t len)
 
 	SCESetResult res;
 	res.result = result;
+	res.id = data[1];
 	Notify(res);
 
+	// THE RADIO HAS ANSWERED; WHATEVER WAS PENDING IS NO LONGER IN DOUBT
+	m_cache_lock.lock();
+	switch (data[1])
+	{
+		case SCP_SET_CHANNEL:
+			m_tune_target = SCP_INVALID_CHANNEL;
+		break;
+
+		case SCP_SET_MUTE:
+			m_mute_pending = false;
+		break;
+	}
+	m_cache_lock.unlock();
+
 	if (result == 0u)
 	{
 		switch (data[1])
@@ -1135,6 +1953,12 @@ void CSirCon::DispatchSetResponse (uint8_t* data, uint32_t len)
 					Notify(s);
 				}
 			break;
+
+			case SCP_SET_RESET:
+			case SCP_SET_POWER:
+				// THE RADIO RESTARTS ITS SEQUENCE NUMBERS
+				ResetSequence();
+			break;
 		}
 	}
 }
@@ -1199,6 +2023,11 @@ std::future<SCRESULT> CSirCon::SetMute(bool on)
     {
         mute[2] = 0x01;
     }
+
+	m_cache_lock.lock();
+	m_mute_pending = true;
+	m_cache_lock.unlock();
+
     return Send(mute, sizeof(mute));
 }
 
@@ -1216,6 +2045,8 @@ std::future<SCRESULT> CSirCon::Reset()
 {
     uint8_t pwr_reset[2] = { MSG_SET, SCP_SET_RESET };
 
+	// THE RX THREAD FORGETS THE OLD SEQUENCE NUMBERS BEFORE THE NEXT FRAME
+	m_seq_reset = true;
     return Send(pwr_reset, sizeof(pwr_reset));
 }
 
@@ -1225,6 +2056,11 @@ std::future<SCRESULT> CSirCon::SetChannel(SCP_CHANNEL_INDEX channel)
     uint8_t set_channel[6] = { MSG_SET, SCP_SET_CHANNEL, 0x00, 0x00, 0x00, 0x0b };
 
     set_channel[2] = channel;
+
+	m_cache_lock.lock();
+	m_tune_target = channel;
+	m_cache_lock.unlock();
+
     return Send(set_channel, sizeof(set_channel));
 }
 
@@ -1250,9 +2086,28 @@ std::future<SCRESULT> CSirCon::EnableAsyncNotifications(uint8_t flags)
     uint8_t async[7] = { MSG_SET, SCP_SET_ASYNC, 0x00, 0x00, 0x00, 0x3f, 0x00 };
 
     async[5] = flags;
+
+	m_cache_lock.lock();
+	m_async_flags = flags;
+	m_cache_lock.unlock();
+
     return Send(async, sizeof(async));
 }
 
+//!
+//! \brief Seed the channel map (e.g. from a snapshot) until the radio 
+//! sends its own.
+//!
+//! \param[in] map SCP_CHANNEL_BITMAP_SIZE bytes, as in SCEChannelMap.
+//!
+//========================================================================
+void CSirCon::SetChannelMap (const uint8_t* map)
+{
+	std::lock_guard<std::mutex> lk(m_cache_lock);
+
+	memcpy(m_channel_map, map, SCP_CHANNEL_BITMAP_SIZE);
+}
+
 //========================================================================
 std::future<SCRESULT> CSirCon::GetChannelMap()
 {
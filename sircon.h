@@ -29,8 +29,8 @@
 //!
 
 #include <future>
-#include <queue>
-using std::queue;
+#include <deque>
+using std::deque;
 
 #include <string>
 using std::string;
@@ -39,6 +39,8 @@ using std::string;
 #include "scp.h"
 #include "scevents.h"
 #include "serial.h"
+#include "serial_fault.h"
+#include "clock.h"
 #include "ctask.h"
 #include "ctimer.h"
 #include "sobuf.h"
@@ -47,9 +49,21 @@ using std::string;
 //! Maximum number of times to retransmit a packet
 const uint32_t SIRCON_MAX_RETRIES = 3u;
 
+//! Largest supported transmit window (frames)
+const uint32_t SIRCON_MAX_WINDOW = 4u;
+
+//! Number of recently received sequence numbers remembered for duplicate detection
+const uint32_t SIRCON_SEQ_HISTORY = 16u;
+
+//! Largest sequence number jump treated as lost frames rather than a resync
+const uint32_t SIRCON_MAX_SEQ_GAP = 32u;
+
 //! Number of link failures before bailing out
 const uint32_t SIRCON_MAX_LINK_FAILURES = 10u;
 
+//! Interval between attempts to reopen a detached serial device (ms)
+const uint32_t SIRCON_REATTACH_INTERVAL = 1000u;
+
 //! Size of the input buffer (bytes)
 const uint32_t SCP_STAGEBUFSIZE = 2u * SCP_MAX_PKT;
 
@@ -61,6 +75,47 @@ enum SCRESULT
 	SCR_NOMEMORY
 };
 
+//! Link-level counters
+struct SCLINKSTATS
+{
+	uint64_t rx_bytes;			//!< Raw bytes received from the radio
+	uint64_t rx_frames;			//!< Frames received with a valid checksum (including ACKs)
+	uint64_t rx_acks;			//!< Acknowledgements received
+	uint64_t rx_chksum;			//!< Frames received with a bad checksum
+	uint64_t rx_resync;			//!< Bytes discarded while hunting for a frame sentinel
+	uint64_t rx_dups;			//!< Duplicate frames received
+	uint64_t rx_seq_errors;		//!< Frames received out of sequence
+	uint64_t rx_gaps;			//!< Sequence gaps (one or more frames lost)
+	uint64_t rx_lost;			//!< Frames inferred lost from sequence gaps
+	uint64_t rx_seq_resyncs;	//!< Sequence jumps too large to be gaps
+	uint64_t refreshes;			//!< State refreshes issued to recover from lost frames
+	uint64_t tx_frames;			//!< Frames transmitted (first attempts)
+	uint64_t tx_retries;		//!< Frames retransmitted
+	uint64_t tx_timeouts;		//!< Frames abandoned after all retries failed
+	uint64_t tx_naks_chksum;	//!< Frames rejected by the radio with a checksum error
+	uint64_t tx_naks_busy;		//!< Frames rejected by the radio because it was busy
+	uint64_t tx_acked;			//!< Frames acknowledged by the radio
+	uint64_t ack_total_ms;		//!< Sum of first-transmission to ACK latencies
+	uint32_t ack_min_ms;		//!< Shortest first-transmission to ACK latency
+	uint32_t ack_max_ms;		//!< Longest first-transmission to ACK latency
+	uint32_t first_frame_ms;	//!< Time from preparing the device to its first valid frame (0 = none yet)
+
+	SCLINKSTATS() : rx_bytes(0u), rx_frames(0u), rx_acks(0u), rx_chksum(0u), rx_resync(0u),
+		rx_dups(0u), rx_seq_errors(0u), rx_gaps(0u), rx_lost(0u), rx_seq_resyncs(0u),
+		refreshes(0u), tx_frames(0u), tx_retries(0u), tx_timeouts(0u),
+		tx_naks_chksum(0u), tx_naks_busy(0u), tx_acked(0u), ack_total_ms(0u), ack_min_ms(0u),
+		ack_max_ms(0u), first_frame_ms(0u) {}
+};
+
+//! Classification of an incoming frame's sequence number
+enum SCSEQCLASS
+{
+	SEQ_INORDER = 0,		//!< The expected sequence number (or the first frame seen)
+	SEQ_DUPLICATE,			//!< A retransmission of a recently received frame
+	SEQ_GAP,				//!< One or more frames were lost
+	SEQ_RESYNC				//!< An unexpected jump (e.g. the radio was reset)
+};
+
 //! A container for queued messages 
 typedef struct MSGBUF
 {
@@ -68,6 +123,7 @@ typedef struct MSGBUF
 	uint32_t retries;
 	uint32_t len;
 	uint32_t seq;
+	std::chrono::steady_clock::time_point sent;	//!< Time of first transmission
 	std::promise<SCRESULT> result;
 	uint8_t data[SCP_STAGEBUFSIZE];
 
@@ -106,47 +162,103 @@ public:
 	std::future<SCRESULT> GetTZ();
 
 	bool IsLinkAlive() { return m_link_alive; };
+	bool IsAttached() { return m_attached; }
+	const string& GetDevice() const { return m_device; }
+	bool SetFaultPolicy (const sr::FAULTPOLICY& policy);
+	void SetTxWindow (uint32_t frames);
+	bool SetLowLatency (bool on);
+	bool SetReadBatching (uint8_t vmin, uint8_t vtime);
+	void GetLinkStats (SCLINKSTATS& stats);
+	void SetTimerExecutors (uint32_t n) { m_timer.SetExecutors(n); }
+	void SetTimerThreadName (const string& name) { m_timer.SetThreadName(name); }
+	void SetTimerThreadAttributes (const sr::THREADATTR& attr) { m_timer.SetThreadAttributes(attr); }
+	void SetClock (sr::CClock* clock);
+	void GetTimerStats (sr::TIMERSTATS& stats) { m_timer.GetStats(stats); }
+	bool GetFaultStats (sr::FAULTSTATS& rx, sr::FAULTSTATS& tx);
     bool IsValidChannel (SCP_CHANNEL_INDEX channel);
+	void SetChannelMap (const uint8_t* map);
 	SCP_CHANNEL_INDEX GetCurrentChannel() { return m_curr_channel; }
 
     bool OnStart ();
+    virtual bool OnAttach ();
     void OnRun ();
     void OnExit ();
+    void OnShutdown ();
 
 protected:
     CSirCon ();
     bool Open (const char* device);
 	bool SetDataRate (uint32_t baud) { return (m_port->SetDataRate(baud) == 0); }
     void Close ();
-    bool Read (uint8_t* buf, uint32_t maxlen, uint32_t* uint8_tsread);
+    bool Read (uint8_t* buf, uint32_t maxlen, uint32_t* uint8_tsread, uint32_t timeout);
     bool Write (uint8_t* buf, uint32_t len);
     uint32_t GetTimeSinceLastRx ();
-	void OnACK(MSGBUFPTR bufptr);
+	SCP_CHANNEL_INDEX OnACK(MSGBUFPTR bufptr);
 	void OnTimeout (MSGBUFPTR bufptr);
+	virtual bool OnSilentLink () { return false; }
+
+	using Subject<SCEvent>::Notify;
+	//! \brief Send a decoded event to the observers
+	//! \note The event is moved into the SCEvent passed on, so it must not
+	//! be used afterwards.
+	template <typename E> void Notify (E& e)
+	{
+		SCEvent ev;
+
+		ev.emplace<E>(std::move(e));
+		Subject<SCEvent>::Notify(ev);
+	}
 
 	sr::CSerialPort* m_port;		//!< The serial port object
+	sr::CClock* m_clock;			//!< Source of time for link timeouts and the timer manager
 
 private:
+	string m_device;				//!< Name of the serial port device
+	std::atomic<bool> m_attached;	//!< True while the serial device is present and initialized
+	bool m_low_latency;				//!< Low latency mode requested (reapplied on reattach)
+	bool m_batching;				//!< Read batching requested (reapplied on reattach)
+	uint8_t m_vmin;					//!< Requested read batching VMIN
+	uint8_t m_vtime;				//!< Requested read batching VTIME
+	bool m_in_esc;					//!< True if the last byte received was an ESC
+
 	sr::SOBuffer m_stagebuf;		//!< Staging buffer for incoming SCP frames
     time_t m_last_rx;				//!< Timestamp of last received frame
     uint32_t m_busy_timer;          //!< Count of timer ticks to wait while radio is busy
     uint8_t m_seq;                  //!< Next outgoing frame sequence number
-    int32_t m_last_seq;				//!< Last frame sequence number seen
+	deque<uint8_t> m_seq_history;	//!< Recently received frame sequence numbers (newest last)
 	uint8_t m_seq_expected;			//!< Expected next incoming frame sequence number
+	std::atomic<bool> m_seq_reset;	//!< The radio is being reset; forget its sequence numbers
+	time_t m_last_refresh;			//!< Time of the last state refresh
 	sr::CTimer m_timer;             //!< Timer manager object
 	sr::HTIMER m_htimer;            //!< Handle to the (re)transmit timer instance
 
 	// QUEUE OF FRAMES WAITING TO BE TRANSMITTED
 	std::mutex m_queue_lock;        //!< Queue mutex
-    queue<MSGBUFPTR> m_queue;       //!< Queue of frames from the application
+    deque<MSGBUFPTR> m_queue;       //!< Queue of frames from the application; the first m_window are in flight
 
 	// CACHED RADIO STATE INFORMATION
 	std::mutex m_cache_lock;		//!< Serializes access to cached info
     uint8_t m_channel_map[SCP_CHANNEL_BITMAP_SIZE];	//!< Bitmap of valid channels
     SCP_CHANNEL_INDEX m_curr_channel;				//!< Channel to which the receiver is currently tuned
+	SCP_CHANNEL_INDEX m_tune_target;				//!< Channel requested by a tune still awaiting confirmation
+	bool m_mute_pending;							//!< True if a mute change is awaiting confirmation
+	uint8_t m_async_flags;							//!< Async notifications requested (AF_XXX)
 
 	bool m_link_alive;				//!< True if the SCP link to the radio is functional
+	sr::CLOCKTIME m_attach_start;	//!< When the device was last (re)opened
+	std::atomic<bool> m_first_frame_pending;	//!< True until the device sends a valid frame
+	std::atomic<bool> m_link_silent;	//!< A frame timed out before the device sent anything
 	uint32_t m_link_fail_cnt;		//!< Count of link failures
+	uint32_t m_window;				//!< Maximum number of unacknowledged frames in flight
+
+	// LINK STATISTICS
+	std::mutex m_stats_lock;		//!< Serializes access to the link counters
+	SCLINKSTATS m_stats;			//!< Link counters
+	sr::CFaultSerialPort* m_fault;	//!< Fault injector wrapping m_port, if any
+
+	// RX THREAD WAKEUP
+	int m_wake_pipe[2];				//!< Self-pipe which interrupts a blocked Read()
+	bool m_wakeable;				//!< True if the port honours the wake pipe
 
     std::future<SCRESULT> Send (uint8_t* data, uint32_t len);
     uint8_t ComputeChecksum (const uint8_t* data, uint32_t len);
@@ -155,10 +267,20 @@ private:
 	void BufFree(MSGBUFPTR bufptr);
 	MSGBUFPTR ComposeFrame (const uint8_t* databuf, uint32_t datalen);
 	bool TransmitFrame (MSGBUFPTR bufptr);
+    uint32_t GetRxTimeout ();
+    void Wake ();
+    bool Reattach ();
+    bool Reprepare ();
+    void Resume ();
+    bool WaitForDevice ();
+    void FailQueuedFrames ();
     static void TimerProcWrapper (void* param);
     void TimerProc ();
     bool SendACK (uint8_t ack, uint8_t flags);
 
+    SCSEQCLASS ClassifySequence (uint8_t seq, uint32_t& lost);
+	void ResetSequence ();
+    void RefreshState ();
     void Dispatch (uint8_t* data, uint32_t len);
     void DispatchAsync (uint8_t* data, uint32_t len);
     void DispatchGetResponse (uint8_t* data, uint32_t len);
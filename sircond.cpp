@@ -33,6 +33,14 @@
 #include <iostream>
 #include "sirserver.h"
 
+#ifdef WIN32
+// NO getopt() ON WINDOWS; USE THE PORTABLE ONE
+#include "pgetopt.h"
+#define getopt pgetopt
+#define optarg poptarg
+#define optind poptind
+#endif
+
 //!
 //! \brief A simple application wrapper.
 //!
@@ -46,22 +54,47 @@ protected:
 	bool Init (int argc, char* argv[]);
 	void Run ();
 	void Shutdown ();
+	void Usage (const char* prog);
 
 private:
 	string m_pidfile;
 	string m_logroot;
 	string m_logfile;
+	string m_probefile;
+	string m_snapshotfile;
 	bool m_shutdown;	
 	CSirServer* m_server;
+	CProbeCache* m_probe_cache;
+
+	// COMMAND LINE OPTIONS
+	bool m_inject_faults;			//!< True if a fault injection policy was given
+	sr::FAULTPOLICY m_fault_policy;	//!< Fault injection policy (testing only)
+	uint32_t m_tx_window;			//!< SCP transmit window (frames)
+	bool m_optimistic;				//!< Announce tunes as soon as they are ACKed
+	bool m_pooled;					//!< Spread metadata requests across idle radios
+	bool m_low_latency;				//!< Enable the serial driver's low latency mode
+	uint32_t m_vmin;				//!< Serial read batching: minimum bytes per read (0 = default)
+	uint32_t m_vtime;				//!< Serial read batching: inter-byte timeout (0.1s)
+	uint32_t m_executors;			//!< Timer callback executor threads (0 = run on the timer thread)
+	sr::THREADATTR m_thread_attr[TG_COUNT];	//!< Scheduling attributes for each group of threads
+
+	bool ParseThreadGroup (const char* spec);
 };
 
 //========================================================================
-CDaemon::CDaemon () : m_shutdown(false), m_server(0)
+CDaemon::CDaemon () : m_shutdown(false), m_server(0), m_probe_cache(0), m_inject_faults(false), m_tx_window(1u),
+	m_optimistic(false), m_pooled(false), m_low_latency(false), m_vmin(0u), m_vtime(0u),
+	m_executors(0u)
 {
 
 #ifndef WIN32
 	m_pidfile = "/var/run/sircond.pid";
 	m_logroot = "/var/log/";
+	m_probefile = "/var/cache/sircond.probe";
+	m_snapshotfile = "/var/cache/sircond.snapshot";
+#else
+	m_probefile = "sircond.probe";
+	m_snapshotfile = "sircond.snapshot";
 #endif
 	m_logfile = m_logroot + "sircond.log";
 }
@@ -80,8 +113,74 @@ bool CDaemon::Init (int argc, char* argv[])
 #endif
 
 	// PROCESS COMMAND LINE ARGS
-	if (argc < 2)
+	static char optstring[] = "b:c:e:f:ops:t:uw:";
+	int opt;
+
+	while ((opt = getopt(argc, argv, optstring)) != -1)
+	{
+		switch (opt)
+		{
+			case 'f':
+				if (!m_fault_policy.Parse(optarg))
+				{
+					std::cout << "Invalid fault policy: " << optarg << std::endl;
+					return false;
+				}
+				m_inject_faults = true;
+			break;
+
+			case 'b':
+				if ((sscanf(optarg, "%u,%u", &m_vmin, &m_vtime) < 1) || (m_vmin < 1u) || (m_vmin > 255u) || (m_vtime > 255u))
+				{
+					std::cout << "Invalid read batching: " << optarg << std::endl;
+					return false;
+				}
+			break;
+
+			case 'c':
+				m_probefile = optarg;
+			break;
+
+			case 'e':
+				m_executors = strtoul(optarg, 0, 10);
+			break;
+
+			case 'o':
+				m_optimistic = true;
+			break;
+
+			case 'p':
+				m_pooled = true;
+			break;
+
+			case 's':
+				m_snapshotfile = optarg;
+			break;
+
+			case 't':
+				if (!ParseThreadGroup(optarg))
+				{
+					std::cout << "Invalid thread attributes: " << optarg << std::endl;
+					return false;
+				}
+			break;
+
+			case 'u':
+				m_low_latency = true;
+			break;
+
+			case 'w':
+				m_tx_window = strtoul(optarg, 0, 10);
+			break;
+
+			default:
+				Usage(argv[0]);
+				return false;
+		}
+	}
+	if (optind >= argc)
 	{
+		Usage(argv[0]);
 		return false;
 	}
 
@@ -100,26 +199,107 @@ bool CDaemon::Init (int argc, char* argv[])
 	CreatePidFile(m_pidfile);
 #endif
 
-	// INSTANTIATE THE SERVER OBJECT
-	m_server = new CSirServer(argv[1]);
+	// INSTANTIATE THE SERVER OBJECT, WITH ONE RADIO PER DEVICE
+	vector<string> devices(argv + optind, argv + argc);
+	m_server = new CSirServer(devices);
 	if (m_server == 0)
 	{
 		LogWrite(LEVEL_CRITICAL, "Failed to instantiate server object.");
 		return false;
 	}
 
+	// APPLY THE COMMAND LINE OPTIONS
+	m_server->SetTxWindow(m_tx_window);
+	m_server->SetTimerExecutors(m_executors);
+	m_server->SetOptimisticTune(m_optimistic);
+	m_server->SetPooled(m_pooled);
+	m_server->SetSnapshot(m_snapshotfile);
+	if (!m_probefile.empty())
+	{
+		m_probe_cache = new CProbeCache(m_probefile);
+		m_server->SetProbeCache(m_probe_cache);
+	}
+	for (int g = 0; g < TG_COUNT; ++g)
+	{
+		m_server->SetThreadGroupAttributes(static_cast<THREADGROUP>(g), m_thread_attr[g]);
+	}
+	if (m_low_latency && !m_server->SetLowLatency(true))
+	{
+		LogWrite(LEVEL_WARNING, "Serial port does not support low latency mode.");
+	}
+	if ((m_vmin > 0u) && !m_server->SetReadBatching(static_cast<uint8_t>(m_vmin), static_cast<uint8_t>(m_vtime)))
+	{
+		LogWrite(LEVEL_WARNING, "Serial port rejected read batching %u,%u.", m_vmin, m_vtime);
+	}
+	if (m_inject_faults)
+	{
+		LogWrite(LEVEL_WARNING, "Fault injection enabled.");
+		m_server->SetFaultPolicy(m_fault_policy);
+	}
+
 	// LAUNCH THE SERVER
 	if (!m_server->Start())
 	{
 		return false;
 	}
-	while (m_server->GetState() == CSirServer::STARTING)
+
+	// RETURN LAUNCH STATUS
+	return m_server->WaitUntilRunning();
+}
+
+//========================================================================
+void CDaemon::Usage (const char* prog)
+{
+
+	std::cout << "Usage: " << prog << " [options] <device> [<device>...]" << std::endl;
+	std::cout << "  <device> is a serial port, tcp://host:port (raw TCP serial server)" << std::endl;
+	std::cout << "           or rfc2217://host:port (telnet serial server with baud control)," << std::endl;
+	std::cout << "           or sim:[tts][,rate=<n>] (built-in emulated radio, for testing)" << std::endl;
+	std::cout << "           One radio is managed per device; clients select one with RADIO <n>" << std::endl;
+	std::cout << "  -b <n>[,<t>] Serial read batching: VMIN n, VTIME t (tenths of a second)" << std::endl;
+	std::cout << "  -u           Enable the serial driver's low latency mode (USB-serial adapters)" << std::endl;
+	std::cout << "  -o           Announce channel changes as soon as the radio accepts them" << std::endl;
+	std::cout << "  -p           Spread GET CHANNELINFO/SONGINFO <channel> across idle radios" << std::endl;
+	std::cout << "  -c <file>    Remember the interface found on each device (default " << m_probefile << ", \"\" for none)" << std::endl;
+	std::cout << "  -s <file>    Save radio state here, to serve after a restart (default " << m_snapshotfile << ", \"\" for none)" << std::endl;
+	std::cout << "  -e <n>       Run timer callbacks on n executor threads (default 0: on the timer thread)" << std::endl;
+	std::cout << "  -t <group>:<attrs>  Scheduling for a group of threads (server, rx, timer, harvest, events)," << std::endl;
+	std::cout << "               e.g. rx:cpu=1,fifo=20 or server:cpu=0,nice=5 (repeatable)" << std::endl;
+	std::cout << "  -w <frames>  SCP transmit window, 1-" << SIRCON_MAX_WINDOW << " (default 1, experimental)" << std::endl;
+	std::cout << "  -f <policy>  Inject faults on the serial link (testing only), e.g." << std::endl;
+	std::cout << "               drop=0.001,corrupt=0.001,dup=0,loss=0.01,delay=0.05,delayms=200,dir=both,seed=1" << std::endl;
+}
+
+//!
+//! \brief Parse a -t option of the form <group>:<attributes>
+//!
+//========================================================================
+bool CDaemon::ParseThreadGroup (const char* spec)
+{
+	static const char* const names[TG_COUNT] = { "server", "rx", "timer", "harvest", "events" };
+	const char* colon = strchr(spec, ':');
+
+	if (colon == 0)
+	{
+		return false;
+	}
+
+	string group(spec, colon - spec);
+	for (int g = 0; g < TG_COUNT; ++g)
 	{
-		sleep(1);
+		if (group == names[g])
+		{
+			sr::THREADATTR attr;
+			if (!attr.Parse(colon + 1))
+			{
+				return false;
+			}
+			m_thread_attr[g] = attr;
+			return true;
+		}
 	}
 
-	// RETURN LAUNCH STATUS
-	return (m_server->GetState() == CSirServer::RUNNING);
+	return false;
 }
 
 //========================================================================
@@ -184,6 +364,8 @@ void CDaemon::Shutdown ()
 		delete m_server;
 		m_server = 0;
 	}
+	delete m_probe_cache;
+	m_probe_cache = 0;
 
 	LogClose();
 
@@ -22,7 +22,6 @@
 
 #include "pch.h"
 #include <sstream>
-#include <typeinfo>
 #include "sirserver.h"
 
 using std::stringstream;
@@ -30,38 +29,201 @@ using std::stringstream;
 static const uint16_t SIRCOND_PORT = 6114U;		// PORT FOR TEXT CLIENTS
 static const uint32_t SIRCOND_BUFSIZE = 512U;	// SIZE OF CLIENT I/O BUFFERS
 static const SCP_CHANNEL_INDEX SIRCOND_DEFAULT_CHANNEL = 184U;
+static const uint32_t SNAPSHOT_INTERVAL = 60000U;	// HOW OFTEN CHANGED RADIO STATE IS SAVED (ms)
+static const uint32_t EVENT_QUEUE_DEPTH = 1024U;	// EVENTS OUTSTANDING BEFORE METADATA IS DROPPED
 
+//!
+//! \brief Constructor
+//!
+//! \param[in] server The server which handles this radio's events.
+//! \param[in] index The radio's position in the server's list.
+//! \param[in] device The device to which the radio is connected.
+//!
+//========================================================================
+CSirRadio::CSirRadio (CSirServer& server, uint32_t index, const string& device) : m_index(index),
+	m_initialized(false), m_announced(SCP_INVALID_CHANNEL), m_stale(0u), m_controller(0), m_sircon(device),
+	m_server(server), m_harvest_depth(0u)
+{
+
+}
+
+//!
+//! \brief Queue an event from this radio's RX or timer thread for the server
+//!
+//! The server handles it on the event queue's thread, so the radio never
+//! waits for client I/O. Should the queue fill up, events which change
+//! the state of the link, and the results clients are waiting on for 
+//! their commands, are still queued; metadata and the like is dropped.
+//!
+//========================================================================
+void CSirRadio::Update (SCEvent& e)
+{
+	bool essential = false;
+
+	switch (e.eventid())
+	{
+		case SCE_STARTUP:
+		case SCE_SHUTDOWN:
+		case SCE_ATTACHED:
+		case SCE_DETACHED:
+		case SCE_RESET:
+		case SCE_POWER:
+		case SCE_SETRESULT:
+		case SCE_TUNEACCEPTED:
+			essential = true;
+		break;
+
+		default:
+		break;
+	}
+
+	m_server.m_events.Push(m_index, e, essential);
+}
+
+//!
+//! \brief Queue a pooled CHANNELINFO or SONGINFO request
+//!
+//! \param[in] client The client to be sent the result.
+//! \param[in] song True for song info, false for channel info.
+//! \param[in] channel The channel of interest.
+//!
 //========================================================================
-CSirServer::CSirServer(const string& device) : m_initialized(false), m_controller(0), m_sircon(device)
-{
-
-	// INITIALIZE EVENT HANDLER TABLE
-	m_evt_handlers[typeid(SCEStartup)] = &CSirServer::OnSCEStartup;
-	m_evt_handlers[typeid(SCEGetResult)] = &CSirServer::OnSCEGetResult;
-	m_evt_handlers[typeid(SCESetResult)] = &CSirServer::OnSCESetResult;
-	m_evt_handlers[typeid(SCESiriusID)] = &CSirServer::OnSCESID;
-	m_evt_handlers[typeid(SCEGain)] = &CSirServer::OnSCEGain;
-	m_evt_handlers[typeid(SCEMute)] = &CSirServer::OnSCEMute;
-	m_evt_handlers[typeid(SCEChannelInfo)] = &CSirServer::OnSCEChannelInfo;
-	m_evt_handlers[typeid(SCESongInfo)] = &CSirServer::OnSCESongInfo;
-	m_evt_handlers[typeid(SCEChannel)] = &CSirServer::OnSCEChannel;
-	m_evt_handlers[typeid(SCEChannelMap)] = &CSirServer::OnSCEChannelMap;
-	m_evt_handlers[typeid(SCEStatus)] = &CSirServer::OnSCEStatus;
-	m_evt_handlers[typeid(SCERSSI)] = &CSirServer::OnSCERSSI;
-	m_evt_handlers[typeid(SCESignal)] = &CSirServer::OnSCESignal;
-	m_evt_handlers[typeid(SCEReset)] = &CSirServer::OnSCEReset;
-	m_evt_handlers[typeid(SCEPower)] = &CSirServer::OnSCEPower;
-	m_evt_handlers[typeid(SCETime)] = &CSirServer::OnSCETime;
-	m_evt_handlers[typeid(SCETimeZoneInfo)] = &CSirServer::OnSCETZInfo;
-	m_evt_handlers[typeid(SCEShutdown)] = &CSirServer::OnSCEShutdown;
-
-	// REGISTER FOR SIRIUS EVENT NOTIFICATIONS
-	m_sircon.Attach(this);
+void CSirRadio::QueueHarvest (CLIENT* client, bool song, SCP_CHANNEL_INDEX channel)
+{
+	std::lock_guard<std::mutex> lk(m_harvest_lock);
+	HARVEST h;
+
+	h.client = static_cast<CSirClient*>(client)->GetId();
+	h.song = song;
+	h.channel = channel;
+	m_harvest.push_back(h);
+	m_harvest_depth++;
+	m_harvest_cv.notify_one();
+}
+
+//!
+//! \brief Discard a client's pooled requests which have not been issued
+//!
+//! \param[in] client The client, which is going away.
+//!
+//========================================================================
+void CSirRadio::CancelHarvest (CLIENT* client)
+{
+	std::lock_guard<std::mutex> lk(m_harvest_lock);
+	uint64_t id = static_cast<CSirClient*>(client)->GetId();
+
+	for (deque<HARVEST>::iterator h = m_harvest.begin(); h != m_harvest.end(); )
+	{
+		if (h->client == id)
+		{
+			h = m_harvest.erase(h);
+			m_harvest_depth--;
+		}
+		else
+		{
+			++h;
+		}
+	}
+}
+
+//!
+//! \brief Issue pooled requests as they arrive
+//!
+//! Everything queued is sent to the radio before waiting for any of the
+//! results, so the link stays busy while there is work to do.
+//!
+//========================================================================
+void CSirRadio::OnRun ()
+{
+
+	while (!IsShutdown())
+	{
+		deque<HARVEST> batch;
+		{
+			std::unique_lock<std::mutex> lk(m_harvest_lock);
+
+			m_harvest_cv.wait(lk, [this] { return (IsShutdown() || !m_harvest.empty()); });
+			batch.swap(m_harvest);
+		}
+
+		vector<std::future<SCRESULT>> results;
+		for (size_t i = 0u; i < batch.size(); ++i)
+		{
+			const HARVEST& h = batch[i];
+			results.push_back(h.song ? m_sircon.GetSongInfo(h.channel) : m_sircon.GetChannelInfo(h.channel));
+		}
+		for (size_t i = 0u; i < batch.size(); ++i)
+		{
+			SCRESULT rc = SCR_TIMEOUT;
+
+			// THE INTERFACE DISCARDS ITS QUEUE WHEN IT EXITS
+			try
+			{
+				rc = results[i].get();
+			}
+			catch (std::future_error&)
+			{
+			}
+			m_server.NotifyHarvest(batch[i].client, rc);
+			m_harvest_depth--;
+		}
+	}
+}
+
+//========================================================================
+void CSirRadio::OnShutdown ()
+{
+	std::lock_guard<std::mutex> lk(m_harvest_lock);
+
+	m_harvest_cv.notify_all();
+}
+
+//!
+//! \brief Constructor
+//!
+//! \param[in] devices The devices to which the radios are connected. One
+//! radio is created per device, each with its own SiriusConnect interface.
+//!
+//========================================================================
+CSirServer::CSirServer(const vector<string>& devices) : m_optimistic(false), m_pooled(false),
+	m_pool_next(0u), m_snapshot_dirty(false),
+	m_events(EVENT_QUEUE_DEPTH, [this](uint32_t radio, SCEvent& e) { Dispatch(*m_radios[radio], e); })
+{
+
+	for (size_t i = 0u; i < devices.size(); ++i)
+	{
+		m_radios.push_back(new CSirRadio(*this, static_cast<uint32_t>(i), devices[i]));
+	}
+
+	// NAME THE THREADS SO THEY CAN BE TOLD APART IN top, perf, ETC.
+	SetThreadName("server");
+	m_timermgr.SetThreadName("timer");
+	m_events.SetThreadName("events");
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		string n = std::to_string(i);
+		m_radios[i]->SetThreadName("harvest" + n);
+		m_radios[i]->m_sircon.SetThreadName("rx" + n);
+		m_radios[i]->m_sircon.SetTimerThreadName("timer" + n);
+	}
+
+	// THE RADIOS PASS ON ONLY THE EVENTS WHICH ARE HANDLED HERE
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		for (size_t id = 0u; id < SCE_COUNT; ++id)
+		{
+			if (IsHandled(static_cast<SCEVENTID>(id)))
+			{
+				m_radios[i]->m_sircon.Subscribe(m_radios[i], id);
+			}
+		}
+	}
 
 	// INITIALIZE MAIN COMMAND HANDLER TABLE
 	m_cmd_handlers["GET"] = { &CSirServer::ValidateGet, &CSirServer::ProcessGet };
 	m_cmd_handlers["SET"] = { &CSirServer::ValidateSet, &CSirServer::ProcessSet };
 	m_cmd_handlers["CONTROL"] = { &CSirServer::ValidateControl, &CSirServer::ProcessControl };
+	m_cmd_handlers["RADIO"] = { &CSirServer::ValidateRadio, &CSirServer::ProcessRadio };
 	m_cmd_handlers["QUIT"] = { &CSirServer::ValidateQuit, &CSirServer::ProcessQuit };
 
 	// INITIALIZE GET HANDLER TABLE
@@ -76,6 +238,9 @@ CSirServer::CSirServer(const string& device) : m_initialized(false), m_controlle
 	m_get_handlers["TIME"] = { &CSirServer::ValidateGetTime, &CSirServer::ProcessGetTime };
 	m_get_handlers["STATUS"] = { &CSirServer::ValidateGetStatus, &CSirServer::ProcessGetStatus };
 	m_get_handlers["RSSI"] = { &CSirServer::ValidateGetRSSI, &CSirServer::ProcessGetRSSI };
+	m_get_handlers["LINKSTATS"] = { &CSirServer::ValidateGetLinkStats, &CSirServer::ProcessGetLinkStats };
+	m_get_handlers["TIMERSTATS"] = { &CSirServer::ValidateGetTimerStats, &CSirServer::ProcessGetTimerStats };
+	m_get_handlers["EVENTSTATS"] = { &CSirServer::ValidateGetEventStats, &CSirServer::ProcessGetEventStats };
 
 	// INITIALIZE SET HANDLER TABLE
 	m_set_handlers["RESET"] = { &CSirServer::ValidateSetReset, &CSirServer::ProcessSetReset };
@@ -90,6 +255,166 @@ CSirServer::CSirServer(const string& device) : m_initialized(false), m_controlle
 	SetBufferSize(SIRCOND_BUFSIZE);
 }
 
+//========================================================================
+CSirServer::~CSirServer ()
+{
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		delete m_radios[i];
+	}
+	m_radios.clear();
+}
+
+//========================================================================
+bool CSirServer::SetFaultPolicy (const sr::FAULTPOLICY& policy)
+{
+	bool result = true;
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		result = m_radios[i]->m_sircon.SetFaultPolicy(policy) && result;
+	}
+	return result;
+}
+
+//========================================================================
+void CSirServer::SetTxWindow (uint32_t frames)
+{
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->m_sircon.SetTxWindow(frames);
+	}
+}
+
+//========================================================================
+bool CSirServer::SetLowLatency (bool on)
+{
+	bool result = true;
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		result = m_radios[i]->m_sircon.SetLowLatency(on) && result;
+	}
+	return result;
+}
+
+//!
+//! \brief Run timer callbacks on a pool of executor threads
+//!
+//! \param[in] n The number of executors per timer manager (0 to run
+//! callbacks on the timer manager's own thread). Must be set before 
+//! Start().
+//!
+//========================================================================
+void CSirServer::SetTimerExecutors (uint32_t n)
+{
+
+	m_timermgr.SetExecutors(n);
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->m_sircon.SetTimerExecutors(n);
+	}
+}
+
+//!
+//! \brief Set the CPU affinity and priority of a group of threads
+//!
+//! This allows the latency-critical RX and timer threads to be kept apart
+//! from client I/O and bulk work. Must be set before Start().
+//!
+//! \param[in] group The threads affected.
+//! \param[in] attr The scheduling attributes to give them.
+//!
+//========================================================================
+void CSirServer::SetThreadGroupAttributes (THREADGROUP group, const sr::THREADATTR& attr)
+{
+
+	switch (group)
+	{
+		case TG_SERVER:
+			SetThreadAttributes(attr);
+		break;
+
+		case TG_TIMER:
+			m_timermgr.SetThreadAttributes(attr);
+			for (size_t i = 0u; i < m_radios.size(); ++i)
+			{
+				m_radios[i]->m_sircon.SetTimerThreadAttributes(attr);
+			}
+		break;
+
+		case TG_RX:
+			for (size_t i = 0u; i < m_radios.size(); ++i)
+			{
+				m_radios[i]->m_sircon.SetThreadAttributes(attr);
+			}
+		break;
+
+		case TG_HARVEST:
+			for (size_t i = 0u; i < m_radios.size(); ++i)
+			{
+				m_radios[i]->SetThreadAttributes(attr);
+			}
+		break;
+
+		case TG_EVENTS:
+			m_events.SetThreadAttributes(attr);
+		break;
+
+		default:
+		break;
+	}
+}
+
+//!
+//! \brief Replace the clock used by the timers and the radio links
+//!
+//! The server's own loop has no deadlines, so only the timer manager 
+//! and the radios need it. Must be set before Start().
+//!
+//! \param[in] clock The clock to use, e.g. a virtual one for simulation.
+//!
+//========================================================================
+void CSirServer::SetClock (sr::CClock* clock)
+{
+
+	m_timermgr.SetClock(clock);
+	m_events.SetClock(clock);
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->m_sircon.SetClock(clock);
+	}
+}
+
+//!
+//! \brief Share a record of the interface found on each device, so that
+//! TTS-100 detection can be skipped where there wasn't one last time.
+//! Must be set before Start().
+//!
+//========================================================================
+void CSirServer::SetProbeCache (CProbeCache* cache)
+{
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->m_sircon.SetProbeCache(cache);
+	}
+}
+
+//========================================================================
+bool CSirServer::SetReadBatching (uint8_t vmin, uint8_t vtime)
+{
+	bool result = true;
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		result = m_radios[i]->m_sircon.SetReadBatching(vmin, vtime) && result;
+	}
+	return result;
+}
+
 //========================================================================
 bool CSirServer::OnStart ()
 {
@@ -100,45 +425,99 @@ bool CSirServer::OnStart ()
 		return false;
 	}
 
-	// START THE TIMER MANAGER
-	if (!m_timermgr.Start())
-	{
-		return false;
-	}
-	while (m_timermgr.GetState() == STARTING)
+	// PICK UP WHERE THE LAST RUN LEFT OFF, SO THERE IS SOMETHING TO SAY
+	// BEFORE THE RADIOS ARE READY
+	if (!m_snapshot_path.empty())
 	{
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		LoadState();
+		m_timermgr.Create(SNAPSHOT_INTERVAL, this, SnapshotProc);
 	}
-	if (m_timermgr.GetState() != RUNNING)
+
+	// START THE TIMER MANAGER
+	if (!m_timermgr.Start() || !m_timermgr.WaitUntilRunning())
 	{
 		return false;
 	}
 
-	// START THE RADIO INTERFACE
-	if (!m_sircon.Start())
+	// THE RADIOS' EVENTS ARE HANDLED ON THEIR OWN THREAD FROM THE START
+	if (!m_events.Start() || !m_events.WaitUntilRunning())
 	{
 		return false;
 	}
-	while (m_sircon.GetState() == STARTING)
+
+	// START THE RADIO INTERFACES. EACH PREPARES ITS DEVICE ON ITS OWN 
+	// THREAD, SO THE MAIN LOOP CAN TAKE CLIENTS WHILE THAT IS GOING ON. 
+	// THE INITIALIZATION SEQUENCE BEGINS WHEN A RADIO REPORTS STARTUP; A 
+	// RADIO WHICH FAILS SHUTS DOWN, AND THE SERVER WITH THE LAST ONE.
+	for (size_t i = 0u; i < m_radios.size(); ++i)
 	{
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		if (!m_radios[i]->m_sircon.Start())
+		{
+			return false;
+		}
 	}
-	if (m_sircon.GetState() != RUNNING)
+
+	// START THE POOLED REQUEST TASKS
+	if (m_pooled)
 	{
-		return false;
+		for (size_t i = 0u; i < m_radios.size(); ++i)
+		{
+			if (!m_radios[i]->Start())
+			{
+				return false;
+			}
+		}
 	}
 
-	// BEGIN THE INITIALIZATION SEQUENCE
-	m_sircon.GetPower();
-
 	return true;
 }
 
+//!
+//! \brief Determine whether any radio is still being brought up
+//!
+//! The server is running (and taking clients) as soon as the radio 
+//! interfaces have been started, before any of them is ready.
+//!
+//! \retval bool Returns true while a radio's interface is preparing its
+//! device.
+//!
+//========================================================================
+bool CSirServer::IsInitializing ()
+{
+
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		if (m_radios[i]->m_sircon.GetState() == sr::CTask::STARTING)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 //========================================================================
 void CSirServer::OnExit ()
 {
 
     LogWrite(LEVEL_INFO, "CSirServer::OnExit()");
+
+	// STOP THE RADIO INTERFACES FIRST, SO THAT CLIENTS HEAR ABOUT IT. 
+	// POOLED REQUESTS STILL IN FLIGHT ARE WAITING ON THE INTERFACES, SO 
+	// THEY GO BEFORE THAT.
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->Stop();
+	}
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		m_radios[i]->m_sircon.Stop();
+	}
+	m_events.Stop();
+	m_timermgr.Stop();
+	if (!m_snapshot_path.empty() && m_snapshot_dirty)
+	{
+		SaveState();
+	}
     SERVER::OnExit();
 
 #ifndef WIN32
@@ -150,16 +529,63 @@ void CSirServer::OnExit ()
 }
 
 //!
-//! \brief Determine whether a client is in the control waiting queue.
+//! \brief Find the radio currently selected by a client
+//!
+//========================================================================
+CSirRadio& CSirServer::Radio (CLIENT* client)
+{
+
+	return *m_radios[static_cast<CSirClient*>(client)->GetRadio()];
+}
+
+//!
+//! \brief Choose the radio to serve a pooled request
+//!
+//! Radios which are under a client's control stay with that client; of 
+//! the rest, the one with the fewest pooled requests outstanding is 
+//! chosen. Ties are broken round robin. If every radio is controlled (or
+//! detached) the client's selected radio is used.
+//!
+//! \note Only the pooled requests are counted, not the interface's own
+//! transmit queue; they are what this spreads across the radios.
+//!
+//========================================================================
+CSirRadio& CSirServer::PoolRadio (CLIENT* client)
+{
+	std::lock_guard<std::mutex> lk(m_queue_mutex);
+	CSirRadio* best = 0;
+	uint32_t best_depth = 0u;
+
+	for (size_t n = 0u; n < m_radios.size(); ++n)
+	{
+		CSirRadio* r = m_radios[(m_pool_next + n) % m_radios.size()];
+
+		if ((r->m_controller == 0) && r->m_sircon.IsAttached())
+		{
+			uint32_t depth = r->GetHarvestDepth();
+			if ((best == 0) || (depth < best_depth))
+			{
+				best = r;
+				best_depth = depth;
+			}
+		}
+	}
+	m_pool_next = (m_pool_next + 1u) % m_radios.size();
+
+	return (best != 0) ? *best : Radio(client);
+}
+
+//!
+//! \brief Determine whether a client is in a radio's control waiting queue.
 //!
 //! \note Assumes the caller is already holding the wait queue mutex.
 //!
 //========================================================================
-bool CSirServer::IsWaitingForControl (CLIENT* client)
+bool CSirServer::IsWaitingForControl (CSirRadio& radio, CLIENT* client)
 {
 
-	list<CLIENT*>::iterator i = m_control_queue.begin();
-	while (i != m_control_queue.end())
+	list<CLIENT*>::iterator i = radio.m_control_queue.begin();
+	while (i != radio.m_control_queue.end())
 	{
 		if (*i == client)
 		{
@@ -174,40 +600,40 @@ bool CSirServer::IsWaitingForControl (CLIENT* client)
 }
 
 //!
-//! \brief Determine whether a client owns the control mutex
+//! \brief Determine whether a client owns a radio's control mutex
 //!
 //! \note Assumes the caller is already holding the wait queue mutex.
 //!
 //========================================================================
-bool CSirServer::HasControl(CLIENT* client)
+bool CSirServer::HasControl(CSirRadio& radio, CLIENT* client)
 {
 
-	return (client == m_controller);
+	return (client == radio.m_controller);
 }
 
 //========================================================================
-bool CSirServer::AcquireControl (CLIENT* client)
+bool CSirServer::AcquireControl (CSirRadio& radio, CLIENT* client)
 {
 	std::lock_guard<std::mutex> lk(m_queue_mutex);
 	bool result = false;
 
 	// IF NOBODY CURRENTLY HAS THE CONN, TAKE IT NOW
-	if ((m_controller == 0) && m_control_queue.empty())
+	if ((radio.m_controller == 0) && radio.m_control_queue.empty())
 	{
-		m_controller = client;
+		radio.m_controller = client;
 		result = true;
 	}
 	else
 	{
-		if (HasControl(client))
+		if (HasControl(radio, client))
 		{
 			// ALREADY HAS IT!
 			result = true;
 		}		
-		else if (!IsWaitingForControl(client))
+		else if (!IsWaitingForControl(radio, client))
 		{
 			// NOT ALREADY IN THE WAIT QUEUE
-			m_control_queue.push_back(client);
+			radio.m_control_queue.push_back(client);
 		}
 	}
 
@@ -215,91 +641,402 @@ bool CSirServer::AcquireControl (CLIENT* client)
 }
 
 //========================================================================
-void CSirServer::ReleaseControl (CLIENT* client)
+void CSirServer::ReleaseControl (CSirRadio& radio, CLIENT* client)
 {
 	std::lock_guard<std::mutex> lk(m_queue_mutex);
 
-	if (HasControl(client))
+	if (HasControl(radio, client))
 	{
 		// CLIENT HAD THE CONN
-		if (m_control_queue.empty())
+		if (radio.m_control_queue.empty())
 		{
 			// NO ONE ELSE IS WAITING
-			m_controller = 0;
+			radio.m_controller = 0;
 		}
 		else
 		{
 			// GIVE CONTROL TO THE NEXT GUY
-			m_controller = m_control_queue.front();
-			m_control_queue.pop_front();
-			Notify(m_controller, "CONTROL,ACQUIRED\n");
+			radio.m_controller = radio.m_control_queue.front();
+			radio.m_control_queue.pop_front();
+			Notify(radio.m_controller, "CONTROL,ACQUIRED\n");
 		}
 	}
 	else
 	{
-		// CLIENT DID NOT HAVE THE CONN
-		list<CLIENT*>::iterator i = m_control_queue.begin();
-		while (i != m_control_queue.end())
+		// CLIENT DID NOT HAVE THE CONN
+		list<CLIENT*>::iterator i = radio.m_control_queue.begin();
+		while (i != radio.m_control_queue.end())
+		{
+			if (*i == client)
+			{
+				i = radio.m_control_queue.erase(i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+}
+
+//========================================================================
+void CSirServer::Notify (CLIENT* client, string msg)
+{
+
+	if (client != 0)
+	{
+		client->Send(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+	}
+}
+
+//========================================================================
+static string ResultText (SCRESULT rc)
+{
+
+	switch (rc)
+	{
+		case SCR_SUCCESS:
+			return "OK\n";
+
+		case SCR_TIMEOUT:
+			return "TIMEOUT\n";
+
+		default:
+			return "ERROR\n";
+	}
+}
+
+//========================================================================
+void CSirServer::NotifyResult(CLIENT* client, std::future<SCRESULT>& result)
+{
+
+	Notify(client, ResultText(result.get()));
+}
+
+//!
+//! \brief Send the result of a pooled request to the client which made it
+//!
+//! \note Called on a radio's task, so the client list must be locked
+//! (and the client may have gone away in the meantime). The client is
+//! matched by ID, as a new client may have been given the address of
+//! the old one.
+//!
+//========================================================================
+void CSirServer::NotifyHarvest(uint64_t client, SCRESULT rc)
+{
+	string msg = ResultText(rc);
+
+	Broadcast(reinterpret_cast<const uint8_t*>(msg.data()), msg.size(),
+		[client](CLIENT* c) { return (static_cast<CSirClient*>(c)->GetId() == client); });
+}
+
+//!
+//! \brief Send a message to every client which has selected a radio
+//!
+//========================================================================
+void CSirServer::NotifyAll (CSirRadio& radio, string msg)
+{
+	uint32_t index = radio.m_index;
+
+	Broadcast(reinterpret_cast<const uint8_t*>(msg.data()), msg.size(),
+		[index](CLIENT* c) { return (static_cast<CSirClient*>(c)->GetRadio() == index); });
+}
+
+//!
+//! \brief Send channel or song info to the clients which should hear it
+//!
+//! Info for a channel is the same whichever radio fetched it, so in 
+//! pooled mode it goes to every client (including the one which asked 
+//! for it, whichever radio it has selected).
+//!
+//========================================================================
+void CSirServer::NotifyInfo (CSirRadio& radio, string msg)
+{
+
+	if (m_pooled)
+	{
+		Broadcast(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+	}
+	else
+	{
+		NotifyAll(radio, msg);
+	}
+}
+
+//!
+//! \brief Announce a channel to a radio's clients from its info cache
+//!
+//! Sends CHANNEL followed by whatever CHANNELINFO and SONGINFO were 
+//! last seen for the channel. Each line is broadcast separately, as 
+//! Broadcast() is limited to 255 bytes.
+//!
+//! \param[in] radio The radio which has tuned to the channel
+//! \param[in] channel The channel to announce
+//!
+//========================================================================
+void CSirServer::NotifyCachedChannel (CSirRadio& radio, SCP_CHANNEL_INDEX channel)
+{
+	SCEChannel c;
+	string info;
+	string song;
+	stringstream ss;
+
+	c.channel = channel;
+	ss << c << std::endl;
+	NotifyAll(radio, ss.str());
+
+	// FORMAT THE CACHED LINES FIRST; THE CACHE LOCK ISN'T HELD WHILE BROADCASTING
+	{
+		std::lock_guard<std::mutex> lk(m_info_cache.lock);
+
+		map<SCP_CHANNEL_INDEX, SCEChannelInfo>::iterator ci = m_info_cache.channel_info.find(channel);
+		if (ci != m_info_cache.channel_info.end())
+		{
+			ss.str("");
+			ss << ci->second << std::endl;
+			info = ss.str();
+		}
+
+		map<SCP_CHANNEL_INDEX, SCESongInfo>::iterator si = m_info_cache.song_info.find(channel);
+		if (si != m_info_cache.song_info.end())
+		{
+			ss.str("");
+			ss << si->second << std::endl;
+			song = ss.str();
+		}
+	}
+
+	if (!info.empty())
+	{
+		NotifyAll(radio, info);
+	}
+	if (!song.empty())
+	{
+		NotifyAll(radio, song);
+	}
+}
+
+//!
+//! \brief Answer a GET from the snapshot while the radio isn't ready
+//!
+//! The value is sent as a STALE line, followed by OK.
+//!
+//! \param[in] client The client which asked.
+//! \param[in] radio The radio it asked about.
+//! \param[in] field The setting asked for (RS_XXX).
+//!
+//! \retval bool Returns false if the request should go to the radio, 
+//! i.e. the radio is ready or the setting has been refreshed since the
+//! snapshot was loaded.
+//!
+//========================================================================
+bool CSirServer::NotifyStale (CLIENT* client, CSirRadio& radio, uint32_t field)
+{
+	stringstream ss;
+
+	if (radio.m_initialized)
+	{
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+
+		if ((radio.m_stale & field) == 0u)
+		{
+			return false;
+		}
+
+		ss << "STALE,";
+		switch (field)
+		{
+			case RS_SID:
+			{
+				SCESiriusID s;
+				s.sid = radio.m_state.sid;
+				ss << s;
+			}
+			break;
+
+			case RS_CHANNEL:
+			{
+				SCEChannel c;
+				c.channel = radio.m_state.channel;
+				ss << c;
+			}
+			break;
+
+			case RS_GAIN:
+			{
+				SCEGain g;
+				g.gain = radio.m_state.gain;
+				ss << g;
+			}
+			break;
+
+			case RS_MUTE:
+			{
+				SCEMute m;
+				m.mute = radio.m_state.mute;
+				ss << m;
+			}
+			break;
+
+			default:
+				return false;
+		}
+	}
+
+	ss << std::endl << "OK" << std::endl;
+	Notify(client, ss.str());
+	return true;
+}
+
+//!
+//! \brief Refuse a command while the radio is still being brought up
+//!
+//! Until its interface has prepared the device (including TTS-100 
+//! detection and authentication) a radio cannot take requests, so the
+//! client is told INITIALIZING rather than left to time out.
+//!
+//! \retval bool Returns true if the command was refused.
+//!
+//========================================================================
+bool CSirServer::NotifyInitializing (CLIENT* client, CSirRadio& radio)
+{
+
+	if (radio.m_sircon.GetState() != sr::CTask::STARTING)
+	{
+		return false;
+	}
+
+	Notify(client, "INITIALIZING\n");
+	return true;
+}
+
+//!
+//! \brief Record that a setting has been heard from the radio itself
+//!
+//! \note Must be called with the radio's m_state_lock held.
+//!
+//========================================================================
+void CSirServer::MarkLive (CSirRadio& radio, uint32_t field)
+{
+
+	radio.m_state.known |= field;
+	radio.m_stale &= ~field;
+	m_snapshot_dirty = true;
+}
+
+//!
+//! \brief Load the radio state saved by the last run
+//!
+//! Entries are matched to radios by device name. Everything loaded is 
+//! marked stale until the radio reports it again.
+//!
+//========================================================================
+void CSirServer::LoadState ()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	vector<SNAPSHOTENTRY> entries;
+	uint32_t loaded = 0u;
+
+	LoadSnapshot(m_snapshot_path, entries);
+	for (size_t i = 0u; i < entries.size(); ++i)
+	{
+		for (size_t r = 0u; r < m_radios.size(); ++r)
 		{
-			if (*i == client)
+			CSirRadio& radio = *m_radios[r];
+
+			if (radio.m_sircon.GetDevice() != entries[i].device)
 			{
-				i = m_control_queue.erase(i);
+				continue;
 			}
-			else
+
 			{
-				i++;
+				std::lock_guard<std::mutex> lk(radio.m_state_lock);
+				radio.m_state = entries[i].state;
+				radio.m_stale = entries[i].state.known;
+			}
+			if (entries[i].state.known & RS_CHANNELMAP)
+			{
+				radio.m_sircon.SetChannelMap(entries[i].state.channel_map);
+			}
+
+			std::lock_guard<std::mutex> lk(m_info_cache.lock);
+			for (map<SCP_CHANNEL_INDEX, SCEChannelInfo>::iterator c = entries[i].lineup.begin(); c != entries[i].lineup.end(); ++c)
+			{
+				if (m_info_cache.channel_info.insert(*c).second)
+				{
+					m_info_cache.stale.insert(c->first);
+				}
 			}
+			loaded++;
+			break;
 		}
 	}
-}
-
-//========================================================================
-void CSirServer::Notify (CLIENT* client, string msg)
-{
 
-	if (client != 0)
+	if (loaded > 0u)
 	{
-		client->Send(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+		LogWrite(LEVEL_INFO, "Loaded the state of %u radio(s) from %s in %ums.", loaded, m_snapshot_path.c_str(),
+			static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
 	}
 }
 
+//!
+//! \brief Save every radio's state, for the next run
+//!
 //========================================================================
-void CSirServer::NotifyResult(CLIENT* client, std::future<SCRESULT>& result)
+void CSirServer::SaveState ()
 {
-	SCRESULT rc = result.get();
-	stringstream ss;
+	vector<SNAPSHOTENTRY> entries(m_radios.size());
 
-	switch (rc)
+	m_snapshot_dirty = false;
+	for (size_t r = 0u; r < m_radios.size(); ++r)
 	{
-		case SCR_SUCCESS:
-			ss << "OK";
-		break;
-
-		case SCR_TIMEOUT:
-			ss << "TIMEOUT";
-		break;
+		CSirRadio& radio = *m_radios[r];
 
-		default:
-			ss << "ERROR";
-		break;
+		entries[r].device = radio.m_sircon.GetDevice();
+		{
+			std::lock_guard<std::mutex> lk(radio.m_state_lock);
+			entries[r].state = radio.m_state;
+		}
+		std::lock_guard<std::mutex> lk(m_info_cache.lock);
+		entries[r].lineup = m_info_cache.channel_info;
 	}
-	ss << std::endl;
 
-	Notify(client, ss.str());
+	if (!SaveSnapshot(m_snapshot_path, entries))
+	{
+		m_snapshot_dirty = true;
+	}
 }
 
+//!
+//! \internal
+//! \brief Periodically save the radio state if it has changed
+//!
+//! \note Called on the timer manager's thread.
+//!
 //========================================================================
-void CSirServer::NotifyAll (string msg)
+void CSirServer::SnapshotProc (void* param)
 {
+	CSirServer* server = static_cast<CSirServer*>(param);
 
-	Broadcast(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+	if (server->m_snapshot_dirty)
+	{
+		server->SaveState();
+	}
 }
 
 //========================================================================
 void CSirServer::OnDrop (CLIENT* client)
 {
 
-	ReleaseControl(client);
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		ReleaseControl(*m_radios[i], client);
+		m_radios[i]->CancelHarvest(client);
+	}
 	SERVER::OnDrop(client);
 }
 
@@ -339,14 +1076,14 @@ bool CSirServer::ValidateGetChannel(CLIENT* client, vector<string>& tokens)
 bool CSirServer::ValidateGetChannelInfo (CLIENT* client, vector<string>& tokens)
 {
 
-	return (tokens.size() == 2);
+	return ((tokens.size() == 2) || (tokens.size() == 3));
 }
 
 //========================================================================
 bool CSirServer::ValidateGetSongInfo (CLIENT* client, vector<string>& tokens)
 {
 
-	return (tokens.size() == 2);
+	return ((tokens.size() == 2) || (tokens.size() == 3));
 }
 
 //========================================================================
@@ -384,67 +1121,164 @@ bool CSirServer::ValidateGetRSSI (CLIENT* client, vector<string>& tokens)
 	return (tokens.size() == 2);
 }
 
+//========================================================================
+bool CSirServer::ValidateGetLinkStats (CLIENT* client, vector<string>& tokens)
+{
+
+	return (tokens.size() == 2);
+}
+
 //========================================================================
 void CSirServer::ProcessGetGain (CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetGain();
 
+	if (NotifyStale(client, Radio(client), RS_GAIN) || NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetGain();
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetMute(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetMute();
 
+	if (NotifyStale(client, Radio(client), RS_MUTE) || NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetMute();
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetPower(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetPower();
 
+	if (NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetPower();
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetChannel(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetChannel();
 
+	if (NotifyStale(client, Radio(client), RS_CHANNEL) || NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetChannel();
+	NotifyResult(client, r);
+}
+
+//!
+//! \brief Request channel or song info
+//!
+//! Without a channel number the info is for the selected radio's current
+//! channel. In pooled mode a request for a given channel is handed to 
+//! the least busy idle radio and answered when it completes, leaving the
+//! main loop free to take the next one.
+//!
+//! Until the radio is ready, channel info loaded from the snapshot is 
+//! sent as a STALE line instead.
+//!
+//========================================================================
+void CSirServer::ProcessGetInfo(CLIENT* client, vector<string>& tokens, bool song)
+{
+	CSirRadio& radio = Radio(client);
+	CTTS100& sircon = radio.m_sircon;
+	SCP_CHANNEL_INDEX channel = sircon.GetCurrentChannel();
+
+	if (tokens.size() == 3)
+	{
+		channel = static_cast<SCP_CHANNEL_INDEX>(strtoul(tokens[2].c_str(), 0, 10));
+	}
+
+	if (!song && !radio.m_initialized)
+	{
+		stringstream ss;
+
+		if (tokens.size() == 2)
+		{
+			std::lock_guard<std::mutex> lk(radio.m_state_lock);
+			if (radio.m_stale & RS_CHANNEL)
+			{
+				channel = radio.m_state.channel;
+			}
+		}
+
+		std::unique_lock<std::mutex> lk(m_info_cache.lock);
+		map<SCP_CHANNEL_INDEX, SCEChannelInfo>::iterator ci = m_info_cache.channel_info.find(channel);
+		if ((ci != m_info_cache.channel_info.end()) && (m_info_cache.stale.count(channel) > 0u))
+		{
+			ss << "STALE," << ci->second << std::endl << "OK" << std::endl;
+			lk.unlock();
+			Notify(client, ss.str());
+			return;
+		}
+	}
+
+	if ((tokens.size() == 3) && m_pooled)
+	{
+		PoolRadio(client).QueueHarvest(client, song, channel);
+		return;
+	}
+
+	if (NotifyInitializing(client, radio))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = song ? sircon.GetSongInfo(channel) : sircon.GetChannelInfo(channel);
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetChannelInfo(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetChannelInfo(m_sircon.GetCurrentChannel());
 
-	NotifyResult(client, r);
+	ProcessGetInfo(client, tokens, false);
 }
 
 //========================================================================
 void CSirServer::ProcessGetSongInfo(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetSongInfo(m_sircon.GetCurrentChannel());
 
-	NotifyResult(client, r);
+	ProcessGetInfo(client, tokens, true);
 }
 
 //========================================================================
 void CSirServer::ProcessGetTZInfo(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetTZ();
 
+	if (NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetTZ();
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetTime(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetTime();
 
+	if (NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetTime();
 	NotifyResult(client, r);
 }
 
@@ -452,27 +1286,173 @@ void CSirServer::ProcessGetTime(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessGetStatus(CLIENT* client, vector<string>& tokens)
 {
 	SCP_STATUS_TYPE st = static_cast<SCP_STATUS_TYPE>(strtoul(tokens[2].c_str(), 0, 10));
-	std::future<SCRESULT> r = m_sircon.GetStatus(st);
 
+	if (NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetStatus(st);
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetSID(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetSID();
 
+	if (NotifyStale(client, Radio(client), RS_SID) || NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetSID();
 	NotifyResult(client, r);
 }
 
 //========================================================================
 void CSirServer::ProcessGetRSSI(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.GetRSSI();
 
+	if (NotifyInitializing(client, Radio(client)))
+	{
+		return;
+	}
+
+	std::future<SCRESULT> r = Radio(client).m_sircon.GetRSSI();
 	NotifyResult(client, r);
 }
 
+//!
+//! \brief Report the SCP link counters (and injected faults, if any)
+//!
+//! These are maintained locally, so no request is sent to the radio.
+//!
+//========================================================================
+void CSirServer::ProcessGetLinkStats(CLIENT* client, vector<string>& tokens)
+{
+	SCLINKSTATS ls;
+	sr::FAULTSTATS rx;
+	sr::FAULTSTATS tx;
+	stringstream ss;
+
+	Radio(client).m_sircon.GetLinkStats(ls);
+	ss << "LINKSTATS"
+	   << ",RXBYTES=" << ls.rx_bytes
+	   << ",RXFRAMES=" << ls.rx_frames
+	   << ",RXACKS=" << ls.rx_acks
+	   << ",RXCHKSUM=" << ls.rx_chksum
+	   << ",RXRESYNC=" << ls.rx_resync
+	   << ",RXDUPS=" << ls.rx_dups
+	   << ",RXSEQERR=" << ls.rx_seq_errors
+	   << ",RXGAPS=" << ls.rx_gaps
+	   << ",RXLOST=" << ls.rx_lost
+	   << ",RXSEQRESYNC=" << ls.rx_seq_resyncs
+	   << ",REFRESHES=" << ls.refreshes
+	   << ",TXFRAMES=" << ls.tx_frames
+	   << ",TXRETRIES=" << ls.tx_retries
+	   << ",TXTIMEOUTS=" << ls.tx_timeouts
+	   << ",TXNAKCHKSUM=" << ls.tx_naks_chksum
+	   << ",TXNAKBUSY=" << ls.tx_naks_busy
+	   << ",TXACKED=" << ls.tx_acked
+	   << ",ACKMIN=" << ls.ack_min_ms
+	   << ",ACKAVG=" << ((ls.tx_acked > 0u) ? (ls.ack_total_ms / ls.tx_acked) : 0u)
+	   << ",ACKMAX=" << ls.ack_max_ms
+	   << ",FIRSTFRAME=" << ls.first_frame_ms
+	   << std::endl;
+
+	if (Radio(client).m_sircon.GetFaultStats(rx, tx))
+	{
+		ss << "FAULTSTATS,RX"
+		   << ",BYTES=" << rx.bytes
+		   << ",DROPPED=" << rx.dropped
+		   << ",CORRUPTED=" << rx.corrupted
+		   << ",DUPLICATED=" << rx.duplicated
+		   << ",DELAYED=" << rx.delayed
+		   << ",FRAMESLOST=" << rx.frames_lost
+		   << std::endl;
+		ss << "FAULTSTATS,TX"
+		   << ",BYTES=" << tx.bytes
+		   << ",DROPPED=" << tx.dropped
+		   << ",CORRUPTED=" << tx.corrupted
+		   << ",DUPLICATED=" << tx.duplicated
+		   << ",DELAYED=" << tx.delayed
+		   << ",FRAMESLOST=" << tx.frames_lost
+		   << std::endl;
+	}
+	ss << "OK" << std::endl;
+
+	Notify(client, ss.str());
+}
+
+//========================================================================
+bool CSirServer::ValidateGetTimerStats (CLIENT* client, vector<string>& tokens)
+{
+
+	return (tokens.size() == 2);
+}
+
+//!
+//! \brief Report the selected radio's retransmission timer metrics
+//!
+//! Times are in microseconds past the deadline (see sr::TIMERSTATS).
+//!
+//========================================================================
+void CSirServer::ProcessGetTimerStats(CLIENT* client, vector<string>& tokens)
+{
+	sr::TIMERSTATS ts;
+	stringstream ss;
+
+	Radio(client).m_sircon.GetTimerStats(ts);
+	ss << "TIMERSTATS"
+	   << ",FIRED=" << ts.fired
+	   << ",OVERRUNS=" << ts.overruns
+	   << ",JITTERAVG=" << ((ts.fired > 0u) ? (ts.jitter_total_us / ts.fired) : 0u)
+	   << ",JITTERMAX=" << ts.jitter_max_us
+	   << ",LATENCYAVG=" << ((ts.fired > 0u) ? (ts.latency_total_us / ts.fired) : 0u)
+	   << ",LATENCYMAX=" << ts.latency_max_us
+	   << ",RUNAVG=" << ((ts.fired > 0u) ? (ts.run_total_us / ts.fired) : 0u)
+	   << ",RUNMAX=" << ts.run_max_us
+	   << std::endl;
+	ss << "OK" << std::endl;
+
+	Notify(client, ss.str());
+}
+
+//========================================================================
+bool CSirServer::ValidateGetEventStats (CLIENT* client, vector<string>& tokens)
+{
+
+	return (tokens.size() == 2);
+}
+
+//!
+//! \brief Report the metrics of the queue between the radios and the server
+//!
+//! The queue is shared by all the radios. Waits are in microseconds (see
+//! EVENTSTATS).
+//!
+//========================================================================
+void CSirServer::ProcessGetEventStats(CLIENT* client, vector<string>& tokens)
+{
+	EVENTSTATS es;
+	stringstream ss;
+
+	m_events.GetStats(es);
+	uint64_t handled = es.queued - es.depth;
+	ss << "EVENTSTATS"
+	   << ",QUEUED=" << es.queued
+	   << ",DROPPED=" << es.dropped
+	   << ",DEPTH=" << es.depth
+	   << ",MAXDEPTH=" << es.max_depth
+	   << ",CAPACITY=" << es.capacity
+	   << ",WAITAVG=" << ((handled > 0u) ? (es.wait_total_us / handled) : 0u)
+	   << ",WAITMAX=" << es.wait_max_us
+	   << std::endl;
+	ss << "OK" << std::endl;
+
+	Notify(client, ss.str());
+}
+
 //========================================================================
 bool CSirServer::ValidateSetReset(CLIENT* client, vector<string>& tokens)
 {
@@ -525,7 +1505,7 @@ bool CSirServer::ValidateSetAsync(CLIENT* client, vector<string>& tokens)
 //========================================================================
 void CSirServer::ProcessSetReset(CLIENT* client, vector<string>& tokens)
 {
-	std::future<SCRESULT> r = m_sircon.Reset();
+	std::future<SCRESULT> r = Radio(client).m_sircon.Reset();
 
 	NotifyResult(client, r);
 }
@@ -534,7 +1514,7 @@ void CSirServer::ProcessSetReset(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessSetGain(CLIENT* client, vector<string>& tokens)
 {
 	int8_t gain = static_cast<int8_t>(atoi(tokens[2].c_str()));
-	std::future<SCRESULT> r = m_sircon.SetGain(gain);
+	std::future<SCRESULT> r = Radio(client).m_sircon.SetGain(gain);
 
 	NotifyResult(client, r);
 }
@@ -543,7 +1523,7 @@ void CSirServer::ProcessSetGain(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessSetMute(CLIENT* client, vector<string>& tokens)
 {
 	bool on = (strtoul(tokens[2].c_str(), 0, 10) > 0u);
-	std::future<SCRESULT> r = m_sircon.SetMute(on);
+	std::future<SCRESULT> r = Radio(client).m_sircon.SetMute(on);
 
 	NotifyResult(client, r);
 }
@@ -552,7 +1532,7 @@ void CSirServer::ProcessSetMute(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessSetPower(CLIENT* client, vector<string>& tokens)
 {
 	uint32_t mode = strtoul(tokens[2].c_str(), 0, 10);
-	std::future<SCRESULT> r = m_sircon.SetPower(mode);
+	std::future<SCRESULT> r = Radio(client).m_sircon.SetPower(mode);
 
 	NotifyResult(client, r);
 }
@@ -561,7 +1541,7 @@ void CSirServer::ProcessSetPower(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessSetChannel(CLIENT* client, vector<string>& tokens)
 {
 	SCP_CHANNEL_INDEX channel = static_cast<SCP_CHANNEL_INDEX>(strtoul(tokens[2].c_str(), 0, 10));
-	std::future<SCRESULT> r = m_sircon.SetChannel(channel);
+	std::future<SCRESULT> r = Radio(client).m_sircon.SetChannel(channel);
 
 	NotifyResult(client, r);
 }
@@ -571,7 +1551,7 @@ void CSirServer::ProcessSetTZInfo(CLIENT* client, vector<string>& tokens)
 {
 	int16_t offset = atoi(tokens[2].c_str());
 	bool dst = (strtoul(tokens[3].c_str(), 0, 10) > 0u);
-	std::future<SCRESULT> r = m_sircon.SetTZ(offset, dst);
+	std::future<SCRESULT> r = Radio(client).m_sircon.SetTZ(offset, dst);
 
 	NotifyResult(client, r);
 }
@@ -580,7 +1560,7 @@ void CSirServer::ProcessSetTZInfo(CLIENT* client, vector<string>& tokens)
 void CSirServer::ProcessSetAsync(CLIENT* client, vector<string>& tokens)
 {
 	uint32_t flags = strtoul(tokens[2].c_str(), 0, 10);
-	std::future<SCRESULT> r = m_sircon.EnableAsyncNotifications(flags);
+	std::future<SCRESULT> r = Radio(client).m_sircon.EnableAsyncNotifications(flags);
 
 	NotifyResult(client, r);
 }
@@ -596,7 +1576,7 @@ bool CSirServer::ValidateGet(CLIENT* client, vector<string>& tokens)
 bool CSirServer::ValidateSet(CLIENT* client, vector<string>& tokens)
 {
 
-	return ((tokens.size() >= 2) && HasControl(client));
+	return ((tokens.size() >= 2) && HasControl(Radio(client), client));
 }
 
 //========================================================================
@@ -606,6 +1586,17 @@ bool CSirServer::ValidateControl(CLIENT* client, vector<string>& tokens)
 	return (tokens.size() == 2);
 }
 
+//========================================================================
+bool CSirServer::ValidateRadio(CLIENT* client, vector<string>& tokens)
+{
+
+	if (tokens.size() == 1)
+	{
+		return true;
+	}
+	return ((tokens.size() == 2) && (strtoul(tokens[1].c_str(), 0, 10) < m_radios.size()));
+}
+
 //========================================================================
 bool CSirServer::ValidateQuit(CLIENT* client, vector<string>& tokens)
 {
@@ -654,7 +1645,11 @@ void CSirServer::ProcessSet (CLIENT* client, vector<string>& tokens)
 
 		if ((this->*v)(client, tokens))
 		{
-			(this->*p)(client, tokens);
+			// EVERY SETTING GOES TO THE RADIO
+			if (!NotifyInitializing(client, Radio(client)))
+			{
+				(this->*p)(client, tokens);
+			}
 		}
 		else
 		{
@@ -674,7 +1669,7 @@ void CSirServer::ProcessControl (CLIENT* client, vector<string>& tokens)
 
 	if (tokens[1] == "ACQUIRE")
 	{
-		if (AcquireControl(client))
+		if (AcquireControl(Radio(client), client))
 		{
 			ss << "CONTROL,ACQUIRED";
 		}
@@ -685,13 +1680,35 @@ void CSirServer::ProcessControl (CLIENT* client, vector<string>& tokens)
 	}
 	else if (tokens[1] == "RELEASE")
 	{
-		ReleaseControl(client);
+		ReleaseControl(Radio(client), client);
 		ss << "CONTROL,RELEASED";
 	}
 	ss << std::endl;
 	Notify(client, ss.str());
 }
 
+//!
+//! \brief Select the radio addressed by a client
+//!
+//! "RADIO <n>" selects radio n (numbered from 0 in command line order);
+//! "RADIO" alone just reports the selection. The reply gives the 
+//! selected radio and the number of radios. From then on the client's
+//! commands go to, and it hears the events from, the selected radio.
+//!
+//========================================================================
+void CSirServer::ProcessRadio (CLIENT* client, vector<string>& tokens)
+{
+	CSirClient* c = static_cast<CSirClient*>(client);
+	stringstream ss;
+
+	if (tokens.size() == 2)
+	{
+		c->SetRadio(strtoul(tokens[1].c_str(), 0, 10));
+	}
+	ss << "RADIO," << c->GetRadio() << "," << m_radios.size() << std::endl;
+	Notify(client, ss.str());
+}
+
 //========================================================================
 void CSirServer::ProcessQuit (CLIENT* client, vector<string>& tokens)
 {
@@ -752,204 +1769,354 @@ bool CSirServer::CopyString (char* dest, string& src, uint32_t maxlen)
 //
 
 //========================================================================
-void CSirServer::OnSCEStartup (SCEvent& param)
+void CSirServer::OnSCEStartup (CSirRadio& radio, const SCEStartup& s)
 {
-	SCEStartup& s = static_cast<SCEStartup&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
+
+	// THE DEVICE IS READY - BEGIN THE INITIALIZATION SEQUENCE
+	radio.m_sircon.GetPower();
+}
+
+//========================================================================
+void CSirServer::OnSCEDetached (CSirRadio& radio, const SCEDetached& d)
+{
+	stringstream ss;
+
+	ss << d << std::endl;
+	NotifyAll(radio, ss.str());
+
+	radio.m_initialized = false;
+}
+
+//========================================================================
+void CSirServer::OnSCEAttached (CSirRadio& radio, const SCEAttached& a)
+{
+	stringstream ss;
+
+	ss << a << std::endl;
+	NotifyAll(radio, ss.str());
+
+	// THE RADIO MAY HAVE LOST POWER ALONG WITH THE ADAPTER - START OVER
+	radio.m_sircon.GetPower();
 }
 
 //========================================================================
-void CSirServer::OnSCEGetResult(SCEvent& param)
+void CSirServer::OnSCEGetResult (CSirRadio& radio, const SCEGetResult& s)
 {
-	SCEGetResult& s = static_cast<SCEGetResult&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	Notify(m_controller, ss.str());
+	Notify(radio.m_controller, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCESetResult(SCEvent& param)
+void CSirServer::OnSCESetResult (CSirRadio& radio, const SCESetResult& s)
 {
-	SCESetResult& s = static_cast<SCESetResult&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	Notify(m_controller, ss.str());
+	Notify(radio.m_controller, ss.str());
+
+	if ((s.id == SCP_SET_CHANNEL) && (radio.m_announced != SCP_INVALID_CHANNEL))
+	{
+		// RECONCILE AN OPTIMISTIC TUNE. ON SUCCESS THE AUTHORITATIVE INFO
+		// FOLLOWS THIS RESULT; ON FAILURE PUT THE CLIENTS RIGHT.
+		if (s.result != 0u)
+		{
+			SCP_CHANNEL_INDEX channel = radio.m_sircon.GetCurrentChannel();
+
+			LogWrite(LEVEL_INFO, "Tune to %u failed; correcting.", static_cast<unsigned>(radio.m_announced));
+			if (channel != SCP_INVALID_CHANNEL)
+			{
+				NotifyCachedChannel(radio, channel);
+			}
+		}
+		radio.m_announced = SCP_INVALID_CHANNEL;
+	}
 }
 
 //========================================================================
-void CSirServer::OnSCESID(SCEvent& param)
+void CSirServer::OnSCESID (CSirRadio& radio, const SCESiriusID& s)
 {
-	SCESiriusID& s = static_cast<SCESiriusID&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+		radio.m_state.sid = s.sid;
+		MarkLive(radio, RS_SID);
+	}
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEGain(SCEvent& param)
+void CSirServer::OnSCEGain (CSirRadio& radio, const SCEGain& g)
 {
-	SCEGain& g = static_cast<SCEGain&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+		radio.m_state.gain = g.gain;
+		MarkLive(radio, RS_GAIN);
+	}
 	ss << g << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEMute(SCEvent& param)
+void CSirServer::OnSCEMute (CSirRadio& radio, const SCEMute& m)
 {
-	SCEMute& m = static_cast<SCEMute&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+		radio.m_state.mute = m.mute;
+		MarkLive(radio, RS_MUTE);
+	}
 	ss << m << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCETime(SCEvent& param)
+void CSirServer::OnSCETime (CSirRadio& radio, const SCETime& t)
 {
-	SCETime& t = static_cast<SCETime&>(param);
 	stringstream ss;
 
 	ss << t << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCETZInfo(SCEvent& param)
+void CSirServer::OnSCETZInfo (CSirRadio& radio, const SCETimeZoneInfo& t)
 {
-	SCETimeZoneInfo& t = static_cast<SCETimeZoneInfo&>(param);
 	stringstream ss;
 
 	ss << t << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCESongInfo(SCEvent& param)
+void CSirServer::OnSCESongInfo (CSirRadio& radio, const SCESongInfo& s)
 {
-	SCESongInfo& s = static_cast<SCESongInfo&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(m_info_cache.lock);
+		m_info_cache.song_info[s.channel] = s;
+	}
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyInfo(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEChannel(SCEvent& param)
+void CSirServer::OnSCEChannel (CSirRadio& radio, const SCEChannel& c)
 {
-	SCEChannel& c = static_cast<SCEChannel&>(param);
 	stringstream ss;
 
+	// THE RADIO HAS SPOKEN; ANY OPTIMISTIC ANNOUNCEMENT IS SUPERSEDED
+	radio.m_announced = SCP_INVALID_CHANNEL;
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+		radio.m_state.channel = c.channel;
+		MarkLive(radio, RS_CHANNEL);
+	}
 	ss << c << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
+}
+
+//!
+//! \brief Handler for accepted tune requests
+//!
+//! In optimistic mode the new channel, along with any cached channel 
+//! and song info, is announced as soon as the radio ACKs the request 
+//! rather than when the tune completes. The announcement is reconciled 
+//! when the SET response or tune status arrives.
+//!
+//========================================================================
+void CSirServer::OnSCETuneAccepted (CSirRadio& radio, const SCETuneAccepted& t)
+{
+
+	if (m_optimistic)
+	{
+		radio.m_announced = t.channel;
+		NotifyCachedChannel(radio, t.channel);
+	}
 }
 
 //========================================================================
-void CSirServer::OnSCEChannelInfo(SCEvent& param)
+void CSirServer::OnSCEChannelInfo (CSirRadio& radio, const SCEChannelInfo& c)
 {
-	SCEChannelInfo& c = static_cast<SCEChannelInfo&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(m_info_cache.lock);
+		m_info_cache.channel_info[c.channel] = c;
+		m_info_cache.stale.erase(c.channel);
+	}
+	m_snapshot_dirty = true;
 	ss << c << std::endl;
-	NotifyAll(ss.str());
+	NotifyInfo(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEChannelMap(SCEvent& param)
+void CSirServer::OnSCEChannelMap (CSirRadio& radio, const SCEChannelMap& m)
 {
-	SCEChannelMap& m = static_cast<SCEChannelMap&>(param);
 	stringstream ss;
 
+	{
+		std::lock_guard<std::mutex> lk(radio.m_state_lock);
+		memcpy(radio.m_state.channel_map, m.channel_map, sizeof(radio.m_state.channel_map));
+		MarkLive(radio, RS_CHANNELMAP);
+	}
 	ss << m << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEStatus(SCEvent& param)
+void CSirServer::OnSCEStatus (CSirRadio& radio, const SCEStatus& s)
 {
-	SCEStatus& s = static_cast<SCEStatus&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCERSSI(SCEvent& param)
+void CSirServer::OnSCERSSI (CSirRadio& radio, const SCERSSI& r)
 {
-	SCERSSI& r = static_cast<SCERSSI&>(param);
 	stringstream ss;
 
 	ss << r << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCESignal(SCEvent& param)
+void CSirServer::OnSCESignal (CSirRadio& radio, const SCESignal& s)
 {
-	SCESignal& s = static_cast<SCESignal&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 }
 
 //========================================================================
-void CSirServer::OnSCEPower(SCEvent& param)
+void CSirServer::OnSCEPower (CSirRadio& radio, const SCEPower& p)
 {
-	SCEPower& p = static_cast<SCEPower&>(param);
 	stringstream ss;
 
 	ss << p << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
 
-	if (!m_initialized && (p.power > 0u))
+	if (!radio.m_initialized && (p.power > 0u))
 	{
 		LogWrite(LEVEL_DEBUG, "I have the power!");
-		m_initialized = true;
+		radio.m_initialized = true;
 	}
 }
 
 //========================================================================
-void CSirServer::OnSCEReset(SCEvent& param)
+void CSirServer::OnSCEReset (CSirRadio& radio, const SCEReset& r)
 {
 
 	// THE RADIO HAS JUST BEEN RESET - RESTART THE INITIALIZATION SEQUENCE
-	m_initialized = false;
-	m_sircon.SetPower(0x03);
+	radio.m_initialized = false;
+	radio.m_sircon.SetPower(0x03);
 }
 
 //========================================================================
-void CSirServer::OnSCEShutdown(SCEvent& param)
+void CSirServer::OnSCEShutdown (CSirRadio& radio, const SCEShutdown& s)
 {
-	SCEShutdown& s = static_cast<SCEShutdown&>(param);
 	stringstream ss;
 
 	ss << s << std::endl;
-	NotifyAll(ss.str());
+	NotifyAll(radio, ss.str());
+
+	// CARRY ON WHILE ANY OTHER RADIO IS STILL IN SERVICE
+	for (size_t i = 0u; i < m_radios.size(); ++i)
+	{
+		if ((m_radios[i] != &radio) && !m_radios[i]->m_sircon.IsShutdown())
+		{
+			LogWrite(LEVEL_WARNING, "Radio %u has shut down.", radio.m_index);
+			return;
+		}
+	}
 
 	Shutdown();
 }
 
+//!
+//! \brief The events the server handles, with the handler for each
+//!
+//! Dispatch() and IsHandled() are both generated from this list, so a 
+//! handler can't be added to one and forgotten in the other.
+//!
+#define SERVER_EVENT_HANDLERS(X) \
+	X(SCE_STARTUP, SCEStartup, OnSCEStartup) \
+	X(SCE_DETACHED, SCEDetached, OnSCEDetached) \
+	X(SCE_ATTACHED, SCEAttached, OnSCEAttached) \
+	X(SCE_GETRESULT, SCEGetResult, OnSCEGetResult) \
+	X(SCE_SETRESULT, SCESetResult, OnSCESetResult) \
+	X(SCE_SIRIUSID, SCESiriusID, OnSCESID) \
+	X(SCE_GAIN, SCEGain, OnSCEGain) \
+	X(SCE_MUTE, SCEMute, OnSCEMute) \
+	X(SCE_CHANNELINFO, SCEChannelInfo, OnSCEChannelInfo) \
+	X(SCE_SONGINFO, SCESongInfo, OnSCESongInfo) \
+	X(SCE_CHANNEL, SCEChannel, OnSCEChannel) \
+	X(SCE_TUNEACCEPTED, SCETuneAccepted, OnSCETuneAccepted) \
+	X(SCE_CHANNELMAP, SCEChannelMap, OnSCEChannelMap) \
+	X(SCE_STATUS, SCEStatus, OnSCEStatus) \
+	X(SCE_RSSI, SCERSSI, OnSCERSSI) \
+	X(SCE_SIGNAL, SCESignal, OnSCESignal) \
+	X(SCE_RESET, SCEReset, OnSCEReset) \
+	X(SCE_POWER, SCEPower, OnSCEPower) \
+	X(SCE_TIME, SCETime, OnSCETime) \
+	X(SCE_TIMEZONEINFO, SCETimeZoneInfo, OnSCETZInfo) \
+	X(SCE_SHUTDOWN, SCEShutdown, OnSCEShutdown)
+
+//!
+//! \brief Invoke the handler for an event from one of the radios
+//!
+//! The switch over the closed set of event types compiles to a jump 
+//! table, and each handler is given the concrete event.
+//!
+//! \note Called on the event queue's thread.
+//!
 //========================================================================
-void CSirServer::Update(SCEvent& e)
+void CSirServer::Dispatch(CSirRadio& radio, SCEvent& e)
 {
 
-	// INVOKE THE CORRESPONDING HANDLER
-	map<std::type_index, EVTHANDLER>::iterator it = m_evt_handlers.find(typeid(e));
-	if (it != m_evt_handlers.end())
+	switch (e.eventid())
 	{
-		(this->*(it->second))(e);
+#define SERVER_DISPATCH_CASE(id, type, handler) case id: handler(radio, e.get<type>()); break;
+		SERVER_EVENT_HANDLERS(SERVER_DISPATCH_CASE)
+#undef SERVER_DISPATCH_CASE
+
+		default:
+			LogWrite(LEVEL_DEBUG, "Unhandled Sirius event type %u", static_cast<unsigned>(e.eventid()));
+		break;
 	}
-	else
+}
+
+//!
+//! \brief True if Dispatch() has a handler for events of the given type
+//!
+//! The radios pass on only these.
+//!
+//========================================================================
+bool CSirServer::IsHandled (SCEVENTID id)
+{
+
+	switch (id)
 	{
-		LogWrite(LEVEL_DEBUG, "Unhandled Sirius event type %s", typeid(e).name());
+#define SERVER_HANDLED_CASE(id, type, handler) case id:
+		SERVER_EVENT_HANDLERS(SERVER_HANDLED_CASE)
+#undef SERVER_HANDLED_CASE
+			return true;
+
+		default:
+			return false;
 	}
 }
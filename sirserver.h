@@ -30,23 +30,112 @@
 #define _SIRSERVER_H_
 
 #include "pch.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <list>
-#include <typeinfo>
-#include <typeindex>
+#include <set>
 #include "observer.h"
 #include "server.h"
 #include "sirclient.h"
 #include "ctimer.h"
+#include "eventq.h"
+#include "snapshot.h"
 #include "timetrax.h"
 
+using std::deque;
 using std::list;
 using std::map;
 
+class CSirRadio;
+
 // HANDLER FUNCTION SIGNATURES
 typedef bool (CSirServer::*VALIDATIONFUNC)(CLIENT*, vector<string>&);
 typedef void (CSirServer::*HANDLERFUNC)(CLIENT*,vector<string>&);
-typedef void (CSirServer::*EVTHANDLER)(SCEvent&);
+
+//!
+//! \brief Groups of threads which share scheduling attributes
+//!
+enum THREADGROUP
+{
+	TG_SERVER,		//!< The server's main loop (client I/O and commands)
+	TG_RX,			//!< Each radio's receive thread
+	TG_TIMER,		//!< The timer managers and their executors
+	TG_HARVEST,		//!< Each radio's pooled request worker
+	TG_EVENTS,		//!< The thread which handles the radios' events
+	TG_COUNT
+};
+
+//!
+//! \brief Last known info for each channel
+//!
+struct INFOCACHE
+{
+	std::mutex lock;				//!< Written on the event thread while the main loop reads
+	map<SCP_CHANNEL_INDEX, SCEChannelInfo> channel_info;
+	map<SCP_CHANNEL_INDEX, SCESongInfo> song_info;
+	std::set<SCP_CHANNEL_INDEX> stale;	//!< Channels whose info came from a snapshot
+};
+
+//!
+//! \brief One tuner managed by a CSirServer
+//!
+//! Bundles a SiriusConnect interface (with its own RX and timer threads)
+//! with the server-side state that belongs to that tuner: its settings
+//! and the control queue. Channel and song info is cached by the server
+//! for all the tuners. Events from the tuner are queued for
+//! the server tagged with the radio they came from.
+//!
+//! In pooled mode the radio's own task issues metadata requests handed
+//! to it by the server, so that a slow request doesn't hold up the 
+//! server's main loop and requests on different radios overlap.
+//!
+class CSirRadio : public IObserver<SCEvent>, public sr::CTask
+{
+public:
+	CSirRadio (CSirServer& server, uint32_t index, const string& device);
+	void Update (SCEvent& e);
+	void QueueHarvest (CLIENT* client, bool song, SCP_CHANNEL_INDEX channel);
+	void CancelHarvest (CLIENT* client);
+	uint32_t GetHarvestDepth () { return m_harvest_depth; }
+
+	const uint32_t m_index;				//!< Position on the command line (as selected by RADIO)
+	std::atomic<bool> m_initialized;				//!< Written on the event queue's thread, read on the server's
+	std::atomic<SCP_CHANNEL_INDEX> m_announced;	//!< Channel announced optimistically and not yet confirmed
+
+	std::mutex m_state_lock;			//!< Guards m_state and m_stale
+	RADIOSTATE m_state;					//!< Last known settings, as saved in the snapshot
+	uint32_t m_stale;					//!< RS_XXX flags of the settings loaded from the snapshot and not yet refreshed
+
+	list<CLIENT*> m_control_queue;		//!< Protected by CSirServer::m_queue_mutex
+	CLIENT* m_controller;
+
+	//! \brief The SiriusConnect tuner
+	//! \note If no TTS-100 hardware is being used, this can be replaced by a CSirCon object instead.
+	CTTS100 m_sircon;
+
+protected:
+	void OnRun ();
+	void OnShutdown ();
+
+private:
+	CSirRadio ();
+
+	//! A pooled CHANNELINFO or SONGINFO request
+	struct HARVEST
+	{
+		uint64_t client;				//!< ID of the client to be sent the result
+		bool song;						//!< True for SONGINFO, false for CHANNELINFO
+		SCP_CHANNEL_INDEX channel;
+	};
+
+	CSirServer& m_server;
+	std::mutex m_harvest_lock;
+	std::condition_variable m_harvest_cv;	//!< Signalled when a request is queued, or on shutdown
+	deque<HARVEST> m_harvest;				//!< Requests not yet issued
+	std::atomic<uint32_t> m_harvest_depth;	//!< Requests queued or awaiting a result
+};
 
 //!
 //! \brief A SiriusConnect Server object
@@ -55,13 +144,28 @@ typedef void (CSirServer::*EVTHANDLER)(SCEvent&);
 //! functionality, including handlers for all of the Sirius
 //! radio events as well as handlers for client commands.
 //!
-class CSirServer : public SERVER, public IObserver<SCEvent>
+class CSirServer : public SERVER
 {
+	friend class CSirRadio;
+
 public:
-	CSirServer (const string& device);
+	CSirServer (const vector<string>& devices);
+	~CSirServer ();
 	bool OnStart ();
 	void OnExit ();
 	void ProcessCommand (CLIENT* client, string& cmd);
+	bool SetFaultPolicy (const sr::FAULTPOLICY& policy);
+	void SetTxWindow (uint32_t frames);
+	bool SetLowLatency (bool on);
+	bool SetReadBatching (uint8_t vmin, uint8_t vtime);
+	void SetTimerExecutors (uint32_t n);
+	void SetThreadGroupAttributes (THREADGROUP group, const sr::THREADATTR& attr);
+	void SetClock (sr::CClock* clock);
+	void SetProbeCache (CProbeCache* cache);
+	void SetOptimisticTune (bool on) { m_optimistic = on; }
+	void SetPooled (bool on) { m_pooled = on; }
+	void SetSnapshot (const string& path) { m_snapshot_path = path; }
+	bool IsInitializing ();
 
 protected:
 	virtual void OnDrop (CLIENT* client);
@@ -70,14 +174,26 @@ private:
 	CSirServer ();
 	virtual CLIENT* NewClient (SOCKET s) { return new CSirClient(*this, s, m_bufsize); }
 
-	bool IsWaitingForControl(CLIENT* client);
-	bool HasControl(CLIENT* client);
-	bool AcquireControl(CLIENT* client);
-	void ReleaseControl(CLIENT* client);
+	CSirRadio& Radio(CLIENT* client);
+	CSirRadio& PoolRadio(CLIENT* client);
+	bool IsWaitingForControl(CSirRadio& radio, CLIENT* client);
+	bool HasControl(CSirRadio& radio, CLIENT* client);
+	bool AcquireControl(CSirRadio& radio, CLIENT* client);
+	void ReleaseControl(CSirRadio& radio, CLIENT* client);
 	bool CopyString(char* dest, string& src, uint32_t maxlen);
 	void Notify(CLIENT* client, string msg);
 	void NotifyResult(CLIENT* client, std::future<SCRESULT>& result);
-	void NotifyAll(string msg);
+	void NotifyAll(CSirRadio& radio, string msg);
+	void NotifyInfo(CSirRadio& radio, string msg);
+	void NotifyHarvest(uint64_t client, SCRESULT rc);
+	void ProcessGetInfo(CLIENT* client, vector<string>& tokens, bool song);
+	void NotifyCachedChannel(CSirRadio& radio, SCP_CHANNEL_INDEX channel);
+	bool NotifyStale(CLIENT* client, CSirRadio& radio, uint32_t field);
+	bool NotifyInitializing(CLIENT* client, CSirRadio& radio);
+	void MarkLive(CSirRadio& radio, uint32_t field);
+	void LoadState();
+	void SaveState();
+	static void SnapshotProc(void* param);
 
 	// CLIENT MESSAGE HANDLERS
 	bool ValidateGetActivation(CLIENT* client, vector<string>& tokens);
@@ -92,6 +208,9 @@ private:
 	bool ValidateGetTime(CLIENT* client, vector<string>& tokens);
 	bool ValidateGetStatus(CLIENT* client, vector<string>& tokens);
 	bool ValidateGetRSSI(CLIENT* client, vector<string>& tokens);
+	bool ValidateGetLinkStats(CLIENT* client, vector<string>& tokens);
+	bool ValidateGetTimerStats(CLIENT* client, vector<string>& tokens);
+	bool ValidateGetEventStats(CLIENT* client, vector<string>& tokens);
 
 	void ProcessGetActivation(CLIENT* client, vector<string>& tokens);
 	void ProcessGetGain(CLIENT* client, vector<string>& tokens);
@@ -105,6 +224,9 @@ private:
 	void ProcessGetTime(CLIENT* client, vector<string>& tokens);
 	void ProcessGetStatus(CLIENT* client, vector<string>& tokens);
 	void ProcessGetRSSI(CLIENT* client, vector<string>& tokens);
+	void ProcessGetLinkStats(CLIENT* client, vector<string>& tokens);
+	void ProcessGetTimerStats(CLIENT* client, vector<string>& tokens);
+	void ProcessGetEventStats(CLIENT* client, vector<string>& tokens);
 
 	bool ValidateSetReset(CLIENT* client, vector<string>& tokens);
 	bool ValidateSetGain(CLIENT* client, vector<string>& tokens);
@@ -125,47 +247,54 @@ private:
 	bool ValidateGet(CLIENT* client, vector<string>& tokens);
 	bool ValidateSet(CLIENT* client, vector<string>& tokens);
 	bool ValidateControl(CLIENT* client, vector<string>& tokens);
+	bool ValidateRadio(CLIENT* client, vector<string>& tokens);
 	bool ValidateQuit(CLIENT* client, vector<string>& tokens);
 
 	void ProcessGet(CLIENT* client, vector<string>& tokens);
 	void ProcessSet(CLIENT* client, vector<string>& tokens);
 	void ProcessControl (CLIENT* client, vector<string>& tokens);
+	void ProcessRadio (CLIENT* client, vector<string>& tokens);
 	void ProcessQuit (CLIENT* client, vector<string>& tokens);
 
 	// SIRIUS EVENT HANDLERS
-	void OnSCEStartup(SCEvent& param);
-	void OnSCEGetResult(SCEvent& param);
-	void OnSCESetResult(SCEvent& param);
-	void OnSCESID(SCEvent& param);
-	void OnSCEGain(SCEvent& param);
-	void OnSCEMute(SCEvent& param);
-	void OnSCEChannelInfo(SCEvent& param);
-	void OnSCESongInfo(SCEvent& param);
-	void OnSCEChannel(SCEvent& param);
-	void OnSCEChannelMap(SCEvent& param);
-	void OnSCEStatus(SCEvent& param);
-	void OnSCERSSI(SCEvent& param);
-	void OnSCESignal(SCEvent& param);
-	void OnSCEPower(SCEvent& param);
-	void OnSCEReset(SCEvent& param);
-	void OnSCETime(SCEvent& param);
-	void OnSCETZInfo(SCEvent& param);
-	void OnSCEShutdown(SCEvent& param);
-	void Update(SCEvent& e);
-
-	bool m_initialized;
+	void OnSCEStartup(CSirRadio& radio, const SCEStartup& s);
+	void OnSCEDetached(CSirRadio& radio, const SCEDetached& d);
+	void OnSCEAttached(CSirRadio& radio, const SCEAttached& a);
+	void OnSCEGetResult(CSirRadio& radio, const SCEGetResult& s);
+	void OnSCESetResult(CSirRadio& radio, const SCESetResult& s);
+	void OnSCESID(CSirRadio& radio, const SCESiriusID& s);
+	void OnSCEGain(CSirRadio& radio, const SCEGain& g);
+	void OnSCEMute(CSirRadio& radio, const SCEMute& m);
+	void OnSCEChannelInfo(CSirRadio& radio, const SCEChannelInfo& c);
+	void OnSCESongInfo(CSirRadio& radio, const SCESongInfo& s);
+	void OnSCEChannel(CSirRadio& radio, const SCEChannel& c);
+	void OnSCETuneAccepted(CSirRadio& radio, const SCETuneAccepted& t);
+	void OnSCEChannelMap(CSirRadio& radio, const SCEChannelMap& m);
+	void OnSCEStatus(CSirRadio& radio, const SCEStatus& s);
+	void OnSCERSSI(CSirRadio& radio, const SCERSSI& r);
+	void OnSCESignal(CSirRadio& radio, const SCESignal& s);
+	void OnSCEPower(CSirRadio& radio, const SCEPower& p);
+	void OnSCEReset(CSirRadio& radio, const SCEReset& r);
+	void OnSCETime(CSirRadio& radio, const SCETime& t);
+	void OnSCETZInfo(CSirRadio& radio, const SCETimeZoneInfo& t);
+	void OnSCEShutdown(CSirRadio& radio, const SCEShutdown& s);
+	void Dispatch(CSirRadio& radio, SCEvent& e);
+	static bool IsHandled (SCEVENTID id);
+
+	bool m_optimistic;					//!< Announce tunes as soon as the radio ACKs them
+	bool m_pooled;						//!< Spread metadata requests across idle radios
+	vector<CSirRadio*> m_radios;		//!< The tuners, in command line order (fixed once constructed)
+	INFOCACHE m_info_cache;				//!< Info seen by any radio; a channel's info doesn't depend on the tuner
+	uint32_t m_pool_next;				//!< Where the next search for an idle radio begins
+	string m_snapshot_path;				//!< Where radio state is saved across restarts (empty for nowhere)
+	std::atomic<bool> m_snapshot_dirty;	//!< True if radio state has changed since it was saved
 
 	map<string, std::pair<VALIDATIONFUNC, HANDLERFUNC>> m_cmd_handlers;
 	map<string, std::pair<VALIDATIONFUNC,HANDLERFUNC>> m_get_handlers;
 	map<string, std::pair<VALIDATIONFUNC, HANDLERFUNC>> m_set_handlers;
-	map<std::type_index,EVTHANDLER> m_evt_handlers;
-	list<CLIENT*> m_control_queue;
-	CLIENT* m_controller;
 	std::mutex m_queue_mutex;
 	sr::CTimer m_timermgr;
-	//! \brief The SiriusConnect tuner
-	//! \note If no TTS-100 hardware is being used, this can be replaced by a CSirCon object instead.
-	CTTS100 m_sircon;
+	CEventQueue m_events;				//!< Events from the radios, handled on the queue's thread
 };
 
 #endif
@@ -0,0 +1,244 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file snapshot.cpp
+//! \brief Reading and writing the radio state snapshot file.
+//!
+//! The file is a header followed by one fixed-size record per radio.
+//! Strings are stored in fixed, NUL-padded fields and the lineup is an
+//! array indexed by channel number, so the file has no pointers or 
+//! variable-length parts and can be mapped and used in place. It is 
+//! written in host byte order, for the host that wrote it.
+//!
+
+#include "pch.h"
+#include "snapshot.h"
+
+static const uint32_t SNAPSHOT_MAGIC = 0x4e534353u;	// "SCSN"
+static const uint32_t SNAPSHOT_VERSION = 1u;
+static const uint32_t SNAP_NAME_LEN = 64u;		// LONGEST NAME KEPT FOR A CHANNEL (INCLUDING THE NUL)
+
+//! File header
+struct SNAPHDR
+{
+	uint32_t magic;			//!< SNAPSHOT_MAGIC
+	uint32_t version;		//!< SNAPSHOT_VERSION
+	uint32_t radios;		//!< Number of SNAPRADIO records which follow
+	uint32_t record_size;	//!< sizeof(SNAPRADIO), as a check on the layout
+};
+
+//! A channel in the lineup
+struct SNAPCHANNEL
+{
+	uint8_t valid;			//!< Non-zero if the rest of the entry is filled in
+	uint8_t genre;
+	uint8_t reserved[2];
+	char sname[SNAP_NAME_LEN];
+	char lname[SNAP_NAME_LEN];
+	char sgenre[SNAP_NAME_LEN];
+	char lgenre[SNAP_NAME_LEN];
+};
+
+//! A radio
+struct SNAPRADIO
+{
+	char device[256];
+	char sid[32];
+	uint32_t known;			//!< RS_XXX
+	uint8_t channel;
+	int8_t gain;
+	uint8_t mute;
+	uint8_t reserved;
+	uint8_t channel_map[SCP_CHANNEL_BITMAP_SIZE];
+	SNAPCHANNEL lineup[SCP_MAX_CHANNELS];
+};
+
+//========================================================================
+static void PutString (char* dest, size_t size, const string& src)
+{
+
+	strncpy(dest, src.c_str(), size - 1u);
+	dest[size - 1u] = '\0';
+}
+
+//========================================================================
+static string GetString (const char* src, size_t size)
+{
+
+	return string(src, strnlen(src, size));
+}
+
+//!
+//! \brief Write a snapshot
+//!
+//! The records are written to a temporary file which then replaces the
+//! snapshot, so a crash can't leave it half written.
+//!
+//! \param[in] path The snapshot file.
+//! \param[in] entries The radios to record.
+//!
+//! \retval bool Returns false if the file could not be written.
+//!
+//========================================================================
+bool SaveSnapshot (const string& path, const vector<SNAPSHOTENTRY>& entries)
+{
+	SNAPHDR hdr;
+	vector<SNAPRADIO> records(entries.size());
+
+	hdr.magic = SNAPSHOT_MAGIC;
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.radios = static_cast<uint32_t>(entries.size());
+	hdr.record_size = sizeof(SNAPRADIO);
+
+	memset(records.data(), 0, records.size() * sizeof(SNAPRADIO));
+	for (size_t i = 0u; i < entries.size(); ++i)
+	{
+		const SNAPSHOTENTRY& e = entries[i];
+		SNAPRADIO& r = records[i];
+
+		PutString(r.device, sizeof(r.device), e.device);
+		PutString(r.sid, sizeof(r.sid), e.state.sid);
+		r.known = e.state.known;
+		r.channel = e.state.channel;
+		r.gain = e.state.gain;
+		r.mute = e.state.mute;
+		memcpy(r.channel_map, e.state.channel_map, sizeof(r.channel_map));
+		for (map<SCP_CHANNEL_INDEX, SCEChannelInfo>::const_iterator c = e.lineup.begin(); c != e.lineup.end(); ++c)
+		{
+			if (c->first < SCP_MAX_CHANNELS)
+			{
+				SNAPCHANNEL& s = r.lineup[c->first];
+
+				s.valid = 1u;
+				s.genre = c->second.genre;
+				PutString(s.sname, sizeof(s.sname), c->second.text[c->second.sname].str());
+				PutString(s.lname, sizeof(s.lname), c->second.text[c->second.lname].str());
+				PutString(s.sgenre, sizeof(s.sgenre), c->second.text[c->second.sgenre].str());
+				PutString(s.lgenre, sizeof(s.lgenre), c->second.text[c->second.lgenre].str());
+			}
+		}
+	}
+
+	string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == 0)
+	{
+		LogWrite(LEVEL_WARNING, "Cannot write snapshot %s.", tmp.c_str());
+		return false;
+	}
+	bool ok = (fwrite(&hdr, sizeof(hdr), 1u, f) == 1u) && 
+		(records.empty() || (fwrite(records.data(), sizeof(SNAPRADIO), records.size(), f) == records.size()));
+	if ((fclose(f) != 0) || !ok)
+	{
+		LogWrite(LEVEL_WARNING, "Error writing snapshot %s.", tmp.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+
+#ifdef WIN32
+	// rename() WON'T REPLACE AN EXISTING FILE HERE
+	remove(path.c_str());
+#endif
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		LogWrite(LEVEL_WARNING, "Cannot replace snapshot %s.", path.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+//!
+//! \brief Read a snapshot
+//!
+//! \param[in] path The snapshot file.
+//! \param[out] entries The radios recorded in it.
+//!
+//! \retval bool Returns false if there is no snapshot, or it was written
+//! by an incompatible version.
+//!
+//========================================================================
+bool LoadSnapshot (const string& path, vector<SNAPSHOTENTRY>& entries)
+{
+	SNAPHDR hdr;
+	FILE* f = fopen(path.c_str(), "rb");
+
+	entries.clear();
+	if (f == 0)
+	{
+		return false;
+	}
+	// THE RECORD COUNT MUST ACCOUNT FOR THE REST OF THE FILE, SO THAT A 
+	// CORRUPT ONE CAN'T ASK FOR AN ARBITRARY AMOUNT OF MEMORY
+	long size = -1;
+	if (fseek(f, 0, SEEK_END) == 0)
+	{
+		size = ftell(f);
+		rewind(f);
+	}
+	if ((fread(&hdr, sizeof(hdr), 1u, f) != 1u) || (hdr.magic != SNAPSHOT_MAGIC) ||
+		(hdr.version != SNAPSHOT_VERSION) || (hdr.record_size != sizeof(SNAPRADIO)) || (size < 0) ||
+		((static_cast<uint64_t>(size) - sizeof(hdr)) != (static_cast<uint64_t>(hdr.radios) * sizeof(SNAPRADIO))))
+	{
+		LogWrite(LEVEL_WARNING, "Ignoring unrecognized snapshot %s.", path.c_str());
+		fclose(f);
+		return false;
+	}
+
+	vector<SNAPRADIO> records(hdr.radios);
+	size_t n = records.empty() ? 0u : fread(records.data(), sizeof(SNAPRADIO), records.size(), f);
+	fclose(f);
+
+	for (size_t i = 0u; i < n; ++i)
+	{
+		const SNAPRADIO& r = records[i];
+		SNAPSHOTENTRY e;
+
+		e.device = GetString(r.device, sizeof(r.device));
+		e.state.sid = GetString(r.sid, sizeof(r.sid));
+		e.state.known = r.known;
+		e.state.channel = r.channel;
+		e.state.gain = r.gain;
+		e.state.mute = r.mute;
+		memcpy(e.state.channel_map, r.channel_map, sizeof(e.state.channel_map));
+		for (uint32_t c = 0u; c < SCP_MAX_CHANNELS; ++c)
+		{
+			const SNAPCHANNEL& s = r.lineup[c];
+
+			if (s.valid != 0u)
+			{
+				SCEChannelInfo& info = e.lineup[static_cast<SCP_CHANNEL_INDEX>(c)];
+
+				info.channel = static_cast<SCP_CHANNEL_INDEX>(c);
+				info.genre = s.genre;
+				info.sname = info.text.Append(GetString(s.sname, sizeof(s.sname)));
+				info.lname = info.text.Append(GetString(s.lname, sizeof(s.lname)));
+				info.sgenre = info.text.Append(GetString(s.sgenre, sizeof(s.sgenre)));
+				info.lgenre = info.text.Append(GetString(s.lgenre, sizeof(s.lgenre)));
+			}
+		}
+		entries.push_back(e);
+	}
+
+	return (n == records.size());
+}
@@ -0,0 +1,81 @@
+/**
+ * $DateTime$
+ * $Id$
+ * $Change$
+ *
+ * Copyright (C) 2015 Swarga Research (http://www.swarga-research.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//!
+//! \file snapshot.h
+//! \brief Declarations for the radio state snapshot file.
+//!
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "scevents.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+//! Fields held by a RADIOSTATE
+enum
+{
+	RS_SID = 0x01,
+	RS_CHANNEL = 0x02,
+	RS_GAIN = 0x04,
+	RS_MUTE = 0x08,
+	RS_CHANNELMAP = 0x10
+};
+
+//!
+//! \brief The settings of a radio which are worth keeping across a restart
+//!
+struct RADIOSTATE
+{
+	uint32_t known;					//!< RS_XXX flags of the fields which hold a value
+	string sid;						//!< Sirius ID
+	SCP_CHANNEL_INDEX channel;		//!< Channel last tuned
+	int8_t gain;
+	uint8_t mute;
+	uint8_t channel_map[SCP_CHANNEL_BITMAP_SIZE];	//!< Valid channels (as SCEChannelMap)
+
+	RADIOSTATE() : known(0u), channel(SCP_INVALID_CHANNEL), gain(0), mute(0u)
+	{
+		memset(channel_map, 0, sizeof(channel_map));
+	}
+};
+
+//!
+//! \brief One radio's entry in a snapshot
+//!
+struct SNAPSHOTENTRY
+{
+	string device;									//!< The radio's device (entries are matched by name)
+	RADIOSTATE state;
+	map<SCP_CHANNEL_INDEX, SCEChannelInfo> lineup;	//!< Channel info, by channel
+};
+
+bool SaveSnapshot (const string& path, const vector<SNAPSHOTENTRY>& entries);
+bool LoadSnapshot (const string& path, vector<SNAPSHOTENTRY>& entries);
+
+#endif
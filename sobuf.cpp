@@ -98,16 +98,31 @@ size_t SOBuffer::GetWriteLen ()
 	size_t len = m_size - (m_bufpos - m_buf) - m_buflen;
 
 	if (len == 0u)
+	{
+		Compact();
+		len = m_size - m_buflen;
+	}
+
+	return len;
+}
+
+//!
+//! \brief Slide the buffer contents down to the start of the buffer
+//!
+//! After this call GetWriteLen() == GetFreeLen().
+//!
+//========================================================================
+void SOBuffer::Compact ()
+{
+
+	if (m_bufpos != m_buf)
 	{
 		// SLIDE OVER, BABY!
 		memmove(m_buf, m_bufpos, m_buflen);
 		m_bufpos = m_buf;
-		len = m_size - m_buflen;
 		m_slidecnt++;
 		LogWrite(LEVEL_DEBUG, "SOB! %u", m_slidecnt);
 	}
-
-	return len;
 }
 
 //!
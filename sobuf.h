@@ -58,6 +58,8 @@ public:
 	uint8_t* GetWritePtr() { return (m_bufpos + m_buflen); }
 	size_t GetWriteLen ();
 	void MarkWritten (size_t len);
+	size_t GetFreeLen () { return (m_size - m_buflen); }
+	void Compact ();
 	void Clear () { MarkRead(GetReadLen()); }
 
 private:
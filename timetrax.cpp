@@ -211,18 +211,27 @@ bool CTTS100::Authenticate ()
 //========================================================================
 //!
 //! \internal
-//! \brief Perform startup initialization
+//! \brief Prepare the serial device
 //!
 //! Attempt to detect the presence of a TTS-100 interface. If one is 
-//! detected, attempt to authenticate with it.
+//! detected, attempt to authenticate with it. This happens at startup 
+//! and again whenever the device is reattached, since a TTS-100 which
+//! has been unplugged has also lost power.
+//!
+//! Detection takes MAX_AUTH_ATTEMPTS unanswered version requests when 
+//! the radio is connected directly, so if the probe cache says that is 
+//! how it was last time, detection is skipped. OnSilentLink() falls back
+//! to full detection if the radio then fails to answer. (A TTS-100 
+//! answers the first request, so remembering one saves nothing.)
 //!
 //! \retval bool Returns TRUE if the initialization succeeded.
 //!
 //========================================================================
-bool CTTS100::OnStart ()
+bool CTTS100::OnAttach ()
 {
 	bool isTTS100 = false;
     uint32_t cnt = 0;
+	PROBERESULT probe;
 
 	// VERIFY THAT THE SERIAL PORT EXISTS
 	if (m_port == 0)
@@ -230,19 +239,26 @@ bool CTTS100::OnStart ()
 		LogWrite(LEVEL_CRITICAL, "Error accessing serial port - bailing.");
 		return false;
 	}
+
+	// TRY THE INTERFACE THAT WAS THERE LAST TIME
+	m_remembered = (m_probe_cache != 0) && m_probe_cache->Lookup(GetDevice(), probe) && !probe.tts100;
+	if (m_remembered)
+	{
+		LogWrite(LEVEL_INFO, "No TimeTrax interface on %s last time; skipping detection.", GetDevice().c_str());
+		return CSirCon::OnAttach();
+	}
 	
     // ATTEMPT TO AUTO-DETECT A TTS-100 INTERFACE
 	LogWrite(LEVEL_INFO, "Checking for TimeTrax interface...");
     for (cnt = 0U; cnt < MAX_AUTH_ATTEMPTS; ++cnt)
     {
-        uint32_t major, minor;
-
-        isTTS100 = QueryVersion(major, minor);
+        isTTS100 = QueryVersion(probe.major, probe.minor);
 		if (isTTS100)
 		{
 			break;
 		}
     }
+	probe.tts100 = isTTS100;
 
     // IF A TTS-100 WAS DETECTED, ATTEMPT TO AUTHENTICATE WITH IT
     if (isTTS100)
@@ -259,7 +275,7 @@ bool CTTS100::OnStart ()
 			else
 			{
 				LogWrite(LEVEL_DEBUG, "TimeTrax authentication failed - retrying...");
-				sleep(1);
+				m_clock->SleepFor(1000u);
 			}
 		}
 		if (!auth)
@@ -273,7 +289,38 @@ bool CTTS100::OnStart ()
 		LogWrite(LEVEL_INFO, "No TimeTrax interface was detected.");
 	}
 
-	return CSirCon::OnStart();
+	if (m_probe_cache != 0)
+	{
+		m_probe_cache->Store(GetDevice(), probe);
+	}
+
+	return CSirCon::OnAttach();
+}
+
+//!
+//! \internal
+//! \brief Handle a device which has not answered since it was prepared
+//!
+//! If TTS-100 detection was skipped on the strength of the probe cache,
+//! the interface may have changed (e.g. a TTS-100 was put in the way).
+//! The entry is dropped so that the device is prepared again with full
+//! detection.
+//!
+//! \retval bool Returns TRUE if the device should be prepared again.
+//!
+//========================================================================
+bool CTTS100::OnSilentLink ()
+{
+
+	if (!m_remembered)
+	{
+		return false;
+	}
+
+	LogWrite(LEVEL_WARNING, "No response from %s with the remembered interface.", GetDevice().c_str());
+	m_probe_cache->Forget(GetDevice());
+	m_remembered = false;
+	return true;
 }
 
 //!
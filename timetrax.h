@@ -82,6 +82,7 @@
 #define _TIMETRAX_H_
 
 #include "sircon.h"
+#include "probecache.h"
 
 //!
 //! \brief The interface class for the TTS-100 hardware.
@@ -89,13 +90,19 @@
 class CTTS100 : public CSirCon
 {
 public:
-	CTTS100 (const string& device) : CSirCon(device) { }
-	bool OnStart ();
+	CTTS100 (const string& device) : CSirCon(device), m_probe_cache(0), m_remembered(false) { }
+	bool OnAttach ();
     bool QueryVersion (uint32_t& major, uint32_t& minor);
     bool Authenticate ();
+	void SetProbeCache (CProbeCache* cache) { m_probe_cache = cache; }
 
 protected:
 	CTTS100 ();
+	bool OnSilentLink ();
+
+private:
+	CProbeCache* m_probe_cache;		//!< Interfaces found on previous runs, if any
+	bool m_remembered;				//!< True if detection was skipped because of m_probe_cache
 };
 
 #endif